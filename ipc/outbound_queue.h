@@ -0,0 +1,290 @@
+#ifndef IQOPTIONTESTTASK_OUTBOUND_QUEUE_H
+#define IQOPTIONTESTTASK_OUTBOUND_QUEUE_H
+
+#include <vector>
+#include <unordered_map>
+#include <condition_variable>
+#include <algorithm>
+#include <chrono>
+
+#include "../utils/types.h"
+#include "../utils/spinlock.h"
+#include "protocol.h"
+
+/*
+ *  The messages waiting to be written to a connection, along with the ones being written, may take up to
+ *  the buffer size. Once it's reached, a producer waits up to the block time for the writer to make room,
+ *  and then the connection is dropped. Zero block time drops the connection right away. The producers
+ *  holding the data pin (the workers) hold the recalculation back while they wait, so they never wait
+ *  longer than the pinned block time
+ */
+
+struct OutboundPolicy {
+    static constexpr std::chrono::milliseconds maxPinnedBlockTime {100};
+
+    size_t bufferSize {16 << 20};
+    std::chrono::milliseconds maxBlockTime {5000};
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  OutboundQueue class
+ *
+ *  the bounded buffer of the complete messages waiting for the writer thread of a connection.
+ *  A periodic rating pack still waiting when a newer pack for the same user comes is dropped
+ *  right away, the client only ever needs the newest one. Past that, nothing is ever dropped,
+ *  the queue is closed instead once it overflows. The writer takes all the messages at once
+ *  and writes them out as they are, without copying; they keep counting against the buffer size
+ *  until the writer comes back for more. The written buffers are kept for the next messages, up to
+ *  a quarter of the buffer size, so the messages are copied into them outside the lock and nothing
+ *  is allocated once the traffic settles. The buffer size and that quarter is all the memory it takes
+ */
+// --------------------------------------------------------------------- //
+
+class OutboundQueue {
+public:
+
+    struct Statistics {
+        size_t depth {0}; // the bytes waiting or being written at the moment
+        size_t peakDepth {0};
+        unsigned long long messages {0};
+        unsigned long long stalePacksDropped {0};
+        unsigned long long blockedPushes {0};
+        std::chrono::nanoseconds blockedTime {0};
+        bool overflown {false};
+    };
+
+public:
+
+    OutboundQueue (Spinlock& lock, const OutboundPolicy& policy) : m_lock {lock}, m_policy {policy} {}
+
+    // the user id is only given for the rating packs, false means the queue is closed, maybe by this very push
+    bool push (const buffer_t& message, IpcProto::id_t userId = IpcProto::ProtocolConstants::invalidUserId, bool periodic = false,
+               bool dataPinned = false) {
+        buffer_t data = takeSpareBuffer();
+
+        data.assign(message.begin(), message.end());
+
+        std::unique_lock<Spinlock> lock(m_lock);
+
+        if (m_closed) {
+            return false;
+        }
+
+        auto ratingPack = userId != IpcProto::ProtocolConstants::invalidUserId;
+
+        if (ratingPack) {
+            dropStalePack(userId);
+        }
+
+        // a message larger than the whole buffer still goes through alone
+        if (m_depth + m_inFlight != 0 && m_depth + m_inFlight + message.size() > m_policy.bufferSize &&
+            !waitForRoom(lock, message.size(), dataPinned)) {
+            if (!m_closed) {
+                m_closed = true;
+                m_statistics.overflown = true;
+
+                lock.unlock();
+
+                m_dataTrigger.notify_all();
+                m_roomTrigger.notify_all();
+            }
+
+            return false;
+        }
+
+        auto wasEmpty = m_messages.empty();
+
+        if (ratingPack) {
+            m_queuedPacks[userId] = m_frontSequence + m_messages.size();
+        }
+
+        m_messages.push_back(QueuedMessage {std::move(data), periodic});
+        m_depth += message.size();
+
+        m_statistics.peakDepth = std::max(m_statistics.peakDepth, m_depth + m_inFlight);
+        ++m_statistics.messages;
+
+        lock.unlock();
+
+        if (wasEmpty) {
+            m_dataTrigger.notify_one();
+        }
+
+        return true;
+    }
+
+    // the previous batch is done with; waits for the messages and moves them all into the batch,
+    // the ones dropped as stale being empty; false means the queue is closed
+    bool pop (std::vector<buffer_t>& batch) {
+        auto roomMade {false};
+
+        {
+            std::lock_guard lg(m_lock);
+
+            roomMade = m_inFlight != 0;
+            m_inFlight = 0;
+
+            for (auto& message : batch) {
+                recycleBuffer(message);
+            }
+        }
+
+        // the buffers not kept are freed outside the lock
+        batch.clear();
+
+        if (roomMade) {
+            m_roomTrigger.notify_all();
+        }
+
+        {
+            std::unique_lock<Spinlock> lock(m_lock);
+
+            m_dataTrigger.wait(lock, [this]()->bool{
+                return m_closed || !m_messages.empty();
+            });
+
+            if (m_closed) {
+                return false;
+            }
+
+            // the two vectors take turns, neither is ever reallocated once large enough
+            m_takenMessages.swap(m_messages);
+            m_queuedPacks.clear();
+            m_frontSequence += m_takenMessages.size();
+            m_inFlight = m_depth;
+            m_depth = 0;
+        }
+
+        for (auto& message : m_takenMessages) {
+            batch.push_back(std::move(message.data));
+        }
+
+        m_takenMessages.clear();
+
+        return true;
+    }
+
+    // the messages still waiting are dropped
+    void close () {
+        {
+            std::lock_guard lg(m_lock);
+
+            m_closed = true;
+        }
+
+        m_dataTrigger.notify_all();
+        m_roomTrigger.notify_all();
+    }
+
+    Statistics statistics () const {
+        std::lock_guard lg(m_lock);
+
+        Statistics stats {m_statistics};
+
+        stats.depth = m_depth + m_inFlight;
+
+        return stats;
+    }
+
+private:
+
+    struct QueuedMessage {
+        buffer_t data; // emptied once the message is dropped
+        bool periodic {false};
+    };
+
+private:
+
+    void dropStalePack (IpcProto::id_t userId) {
+        auto queuedPack = m_queuedPacks.find(userId);
+
+        if (queuedPack == m_queuedPacks.end()) {
+            return;
+        }
+
+        QueuedMessage& message = m_messages[queuedPack->second - m_frontSequence];
+
+        // the connect-triggered packs are never dropped, there's a user waiting for each of them
+        if (!message.periodic || message.data.empty()) {
+            return;
+        }
+
+        // the storage goes back to the spares along with the rest of the batch
+        m_depth -= message.data.size();
+        message.data.clear();
+
+        ++m_statistics.stalePacksDropped;
+    }
+
+    bool waitForRoom (std::unique_lock<Spinlock>& lock, size_t messageSize, bool dataPinned) {
+        auto maxBlockTime = dataPinned ? std::min(m_policy.maxBlockTime, OutboundPolicy::maxPinnedBlockTime) : m_policy.maxBlockTime;
+
+        if (maxBlockTime == std::chrono::milliseconds::zero()) {
+            return false;
+        }
+
+        auto blockedAt = std::chrono::steady_clock::now();
+        auto roomMade = m_roomTrigger.wait_for(lock, maxBlockTime, [this, messageSize]()->bool{
+            auto depth = m_depth + m_inFlight;
+
+            return m_closed || depth == 0 || depth + messageSize <= m_policy.bufferSize;
+        });
+
+        ++m_statistics.blockedPushes;
+        m_statistics.blockedTime += std::chrono::steady_clock::now() - blockedAt;
+
+        return roomMade && !m_closed;
+    }
+
+    buffer_t takeSpareBuffer () {
+        buffer_t spareBuffer;
+        std::lock_guard lg(m_lock);
+
+        if (!m_spareBuffers.empty()) {
+            spareBuffer.swap(m_spareBuffers.back());
+            m_spareBuffers.pop_back();
+            m_spareBytes -= spareBuffer.capacity();
+        }
+
+        return spareBuffer;
+    }
+
+    // under the lock; the buffer is left as it is if there's no room for it among the spares
+    void recycleBuffer (buffer_t& buffer) {
+        auto capacity = buffer.capacity();
+
+        if (capacity == 0 || capacity > spareBufferMaxSize || m_spareBytes + capacity > m_policy.bufferSize / 4) {
+            return;
+        }
+
+        buffer.clear();
+        m_spareBuffers.push_back(std::move(buffer));
+        m_spareBytes += capacity;
+    }
+
+private:
+
+    Spinlock& m_lock;
+    const OutboundPolicy m_policy;
+
+    std::condition_variable_any m_dataTrigger;
+    std::condition_variable_any m_roomTrigger;
+
+    static constexpr size_t spareBufferMaxSize {64 << 10}; // the larger ones would waste the room on the small messages
+
+    std::vector<QueuedMessage> m_messages;
+    std::vector<QueuedMessage> m_takenMessages; // the writer's, out of the lock
+    std::unordered_map<IpcProto::id_t, size_t> m_queuedPacks; // the sequence number of the newest pack of the user waiting
+    size_t m_frontSequence {0}; // the sequence number of the first message waiting
+    size_t m_depth {0};
+    size_t m_inFlight {0}; // the bytes the writer has taken and not come back for more yet
+    bool m_closed {false};
+
+    std::vector<buffer_t> m_spareBuffers;
+    size_t m_spareBytes {0};
+
+    Statistics m_statistics;
+};
+
+#endif //IQOPTIONTESTTASK_OUTBOUND_QUEUE_H
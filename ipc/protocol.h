@@ -7,6 +7,7 @@
 #include <climits>
 #include <cassert>
 #include <algorithm>
+#include <type_traits>
 
 #include "../utils/types.h"
 #include "../utils/binary_storage.h"
@@ -19,6 +20,9 @@ using error_code_t = unsigned int;
 using protocol_version_t = unsigned int;
 using monetary_t = long;
 using message_size_t = unsigned short;
+using extended_message_size_t = unsigned int;
+using request_id_t = unsigned int;
+using rating_dimension_t = unsigned short;
 
 // --------------------------------------------------------------------- //
 /*
@@ -32,6 +36,9 @@ struct ProtocolConstants {
     static constexpr id_t invalidUserId {-1};
     static constexpr message_code_t invalidMessageCode {static_cast<message_code_t>(-1)};
 
+    // a zero size prefix means the actual size follows as extended_message_size_t, no message is shorter than its prefix
+    static constexpr message_size_t extendedSizeMarker {0};
+
     enum class ClientMessageCode : message_code_t {
         HANDSHAKE = 111,
 
@@ -39,24 +46,76 @@ struct ProtocolConstants {
         USER_RENAMED = 2,
         USER_DEAL_WON = 3,
         USER_CONNECTED = 4,
-        USER_DISCONNECTED = 5
+        USER_DISCONNECTED = 5,
+
+        GET_RATING = 6,
+        GET_RATING_SNAPSHOT = 7,
+        RATING_SNAPSHOT_CREDIT = 8,
+        SUBSCRIBE_TOP = 9,
+
+        SUBSCRIBE_RATINGS = 10 // only ever sent to the subscriber port, right after the handshake
     };
 
     enum class ServiceMessageCode : message_code_t {
         PROTOCOL_ERROR = 1,
-        USER_RATING = 2
+        USER_RATING = 2,
+        RATING_QUERY_RESULT = 3,
+        RATING_SNAPSHOT_FRAME = 4,
+        TOP_RATING_DIFF = 5
     };
 
     enum class ProtocolError : error_code_t {
         PROTOCOL_VERSION_UNSUPPORTED = 1,
         USER_UNRECOGNIZED = 2,
-        MULTIPLE_REGISTRATION = 3
+        MULTIPLE_REGISTRATION = 3,
+        RATING_QUERY_REJECTED = 4 // the service is too busy to answer the query right now, it may be retried
     };
 
     struct RatingDimensions {
         static constexpr int topPositions {10};
         static constexpr int competitionDistance {10}; // how many positions before and after the user's one to fetch
     };
+
+    // the rating queries choose their own dimensions, which are clamped to these
+    struct RatingQueryLimits {
+        static constexpr int maxTopPositions {100};
+        static constexpr int maxCompetitionDistance {50};
+    };
+
+    // the rating snapshot streams choose their frame size and flow control window, which are clamped to these
+    struct SnapshotStreamLimits {
+        static constexpr unsigned int maxPositionsPerFrame {16384};
+        static constexpr unsigned int maxCredits {16};
+    };
+
+    enum class SnapshotEncoding : unsigned char {
+        PLAIN = 0,
+        DELTA_VARINT = 1 // the ids and amounts as zigzag varints of the differences from the previous entry
+    };
+
+    struct SnapshotFrameFlags {
+        static constexpr unsigned char lastFrame {1};
+        static constexpr unsigned char streamRejected {2}; // too many streams at once, no entries follow
+    };
+
+    struct TopFeedLimits {
+        static constexpr rating_dimension_t maxTopPositions {1000};
+        static constexpr size_t maxSubscriptions {64};
+    };
+
+    // what has happened to a user within the top, a user might have both moved and changed the amount
+    struct TopChangeFlags {
+        static constexpr unsigned char entered {1};
+        static constexpr unsigned char left {2};
+        static constexpr unsigned char moved {4};
+        static constexpr unsigned char amountChanged {8};
+        static constexpr unsigned char renamed {16};
+    };
+
+    enum class SubscriberFilterKind : unsigned char {
+        ID_RANGE = 0,
+        ID_HASH = 1
+    };
 };
 
 // --------------------------------------------------------------------- //
@@ -194,6 +253,221 @@ private:
     monetary_t m_winnings {0};
 };
 
+// --------------------------------------------------------------------- //
+
+/*
+ *  A request for the current rating of a user, answered with a RatingQueryResult carrying the same
+ *  request id. Unlike the connect it has no effect on the user's state whatsoever. The user id goes first,
+ *  just like in every other client message
+ */
+
+class GetRatingMsg : public GenericIdMsg {
+public:
+
+    GetRatingMsg () = default;
+    GetRatingMsg (id_t userId, request_id_t requestId,
+                  rating_dimension_t topPositions, rating_dimension_t positionsBefore, rating_dimension_t positionsAfter)
+    : GenericIdMsg(userId)
+    , m_requestId {requestId}
+    , m_topPositions {topPositions}
+    , m_positionsBefore {positionsBefore}
+    , m_positionsAfter {positionsAfter} {}
+
+    request_id_t requestId () const { return m_requestId; }
+    rating_dimension_t topPositions () const { return m_topPositions; }
+    rating_dimension_t positionsBefore () const { return m_positionsBefore; }
+    rating_dimension_t positionsAfter () const { return m_positionsAfter; }
+
+    void init (BinaryIStream& buffer) {
+        GenericIdMsg::init(buffer);
+
+        buffer >> m_requestId >> m_topPositions >> m_positionsBefore >> m_positionsAfter;
+    }
+
+    void store (BinaryOStream& buffer) const {
+        GenericIdMsg::store(buffer);
+
+        buffer << m_requestId << m_topPositions << m_positionsBefore << m_positionsAfter;
+    }
+
+private:
+
+    request_id_t m_requestId {0};
+    rating_dimension_t m_topPositions {0};
+    rating_dimension_t m_positionsBefore {0};
+    rating_dimension_t m_positionsAfter {0};
+};
+
+// --------------------------------------------------------------------- //
+
+/*
+ *  A request to stream the whole rating, answered with a series of RatingSnapshotFrame messages.
+ *  The service only sends as many frames as the client has given credits for, starting with the ones
+ *  of the request itself, and the client grants more with RatingSnapshotCreditMsg as it consumes them.
+ *  There is no user id in these two, the request id takes its place
+ */
+
+class GetRatingSnapshotMsg {
+public:
+
+    GetRatingSnapshotMsg () = default;
+    GetRatingSnapshotMsg (request_id_t requestId, unsigned int positionsPerFrame, unsigned short credits,
+                          ProtocolConstants::SnapshotEncoding encoding)
+    : m_requestId {requestId}
+    , m_positionsPerFrame {positionsPerFrame}
+    , m_credits {credits}
+    , m_encoding {encoding} {}
+
+    request_id_t requestId () const { return m_requestId; }
+    unsigned int positionsPerFrame () const { return m_positionsPerFrame; }
+    unsigned short credits () const { return m_credits; }
+    ProtocolConstants::SnapshotEncoding encoding () const { return m_encoding; }
+
+    void init (BinaryIStream& buffer) {
+        buffer >> m_requestId >> m_positionsPerFrame >> m_credits >> m_encoding;
+    }
+
+    void store (BinaryOStream& buffer) const {
+        buffer << m_requestId << m_positionsPerFrame << m_credits << m_encoding;
+    }
+
+private:
+
+    request_id_t m_requestId {0};
+    unsigned int m_positionsPerFrame {0};
+    unsigned short m_credits {0};
+    ProtocolConstants::SnapshotEncoding m_encoding {ProtocolConstants::SnapshotEncoding::PLAIN};
+};
+
+class RatingSnapshotCreditMsg {
+public:
+
+    RatingSnapshotCreditMsg () = default;
+    RatingSnapshotCreditMsg (request_id_t requestId, unsigned short credits)
+    : m_requestId {requestId}
+    , m_credits {credits} {}
+
+    request_id_t requestId () const { return m_requestId; }
+    unsigned short credits () const { return m_credits; }
+
+    void init (BinaryIStream& buffer) {
+        buffer >> m_requestId >> m_credits;
+    }
+
+    void store (BinaryOStream& buffer) const {
+        buffer << m_requestId << m_credits;
+    }
+
+private:
+
+    request_id_t m_requestId {0};
+    unsigned short m_credits {0};
+};
+
+/*
+ *  A subscription to the changes of the top positions, answered with a baseline TopRatingDiff right away
+ *  and then with a diff after every recalculation that has changed the top. Subscribing again with the same
+ *  id changes the number of positions and starts over with a new baseline, zero positions unsubscribe.
+ *  The subscription id is routed in place of the user id, just like the snapshot request id
+ */
+
+class SubscribeTopMsg {
+public:
+
+    SubscribeTopMsg () = default;
+    SubscribeTopMsg (request_id_t subscriptionId, rating_dimension_t topPositions)
+    : m_subscriptionId {subscriptionId}
+    , m_topPositions {topPositions} {}
+
+    request_id_t subscriptionId () const { return m_subscriptionId; }
+    rating_dimension_t topPositions () const { return m_topPositions; }
+
+    void init (BinaryIStream& buffer) {
+        buffer >> m_subscriptionId >> m_topPositions;
+    }
+
+    void store (BinaryOStream& buffer) const {
+        buffer << m_subscriptionId << m_topPositions;
+    }
+
+private:
+
+    request_id_t m_subscriptionId {0};
+    rating_dimension_t m_topPositions {0};
+};
+
+static_assert(sizeof(request_id_t) == sizeof(id_t), "the request id is routed in place of the user id");
+
+/*
+ *  The subscription of a subscriber connection (e.g. a gateway process) to the rating packs of the users
+ *  it owns: either the ids within a range, both ends included, or the ids falling into one of the buckets
+ *  of hashBucket. The subscriber sends it once, right after the handshake, and from then on only receives
+ */
+
+class SubscribeRatingsMsg {
+public:
+
+    SubscribeRatingsMsg () = default;
+
+    static SubscribeRatingsMsg idRange (id_t firstId, id_t lastId) {
+        return SubscribeRatingsMsg {ProtocolConstants::SubscriberFilterKind::ID_RANGE, firstId, lastId};
+    }
+
+    static SubscribeRatingsMsg idHash (unsigned int bucketCount, unsigned int bucket) {
+        return SubscribeRatingsMsg {ProtocolConstants::SubscriberFilterKind::ID_HASH,
+                                    static_cast<id_t>(bucketCount), static_cast<id_t>(bucket)};
+    }
+
+    // a multiplicative hash scaled to the bucket count, so the ids following some pattern still spread evenly
+    static unsigned int hashBucket (id_t id, unsigned int bucketCount) {
+        auto hash = static_cast<unsigned int>(id) * 2654435761u;
+
+        return static_cast<unsigned int>((static_cast<unsigned long long>(hash) * bucketCount) >> 32);
+    }
+
+    ProtocolConstants::SubscriberFilterKind kind () const { return m_kind; }
+
+    bool valid () const {
+        switch (m_kind) {
+            case ProtocolConstants::SubscriberFilterKind::ID_RANGE: return m_first <= m_second;
+            case ProtocolConstants::SubscriberFilterKind::ID_HASH:
+                return static_cast<unsigned int>(m_second) < static_cast<unsigned int>(m_first);
+            default: return false;
+        }
+    }
+
+    bool matches (id_t id) const {
+        if (m_kind == ProtocolConstants::SubscriberFilterKind::ID_RANGE) {
+            return id >= m_first && id <= m_second;
+        }
+
+        return hashBucket(id, static_cast<unsigned int>(m_first)) == static_cast<unsigned int>(m_second);
+    }
+
+    void init (BinaryIStream& buffer) {
+        buffer >> m_kind >> m_first >> m_second;
+    }
+
+    void store (BinaryOStream& buffer) const {
+        buffer << m_kind << m_first << m_second;
+    }
+
+private:
+
+    SubscribeRatingsMsg (ProtocolConstants::SubscriberFilterKind kind, id_t first, id_t second)
+    : m_kind {kind}
+    , m_first {first}
+    , m_second {second} {}
+
+private:
+
+    ProtocolConstants::SubscriberFilterKind m_kind {ProtocolConstants::SubscriberFilterKind::ID_RANGE};
+
+    // the first and the last id of the range, or the bucket count and the bucket of the hash
+    id_t m_first {0};
+    id_t m_second {-1};
+};
+
 class UserRegisteredMsg : public GenericIdNameMsg { public: using GenericIdNameMsg::GenericIdNameMsg; };
 class UserRenamedMsg : public GenericIdNameMsg { public: using GenericIdNameMsg::GenericIdNameMsg; };
 class UserConnectedMsg : public GenericIdMsg { public: using GenericIdMsg::GenericIdMsg; };
@@ -239,6 +513,31 @@ class UserMsgCodePrefixer<UserDisconnectedMsg> {
 public: static void prefix (BinaryOStream& buffer) { buffer << static_cast<message_code_t>(ProtocolConstants::ClientMessageCode::USER_DISCONNECTED); }
 };
 
+template<>
+class UserMsgCodePrefixer<GetRatingMsg> {
+public: static void prefix (BinaryOStream& buffer) { buffer << static_cast<message_code_t>(ProtocolConstants::ClientMessageCode::GET_RATING); }
+};
+
+template<>
+class UserMsgCodePrefixer<GetRatingSnapshotMsg> {
+public: static void prefix (BinaryOStream& buffer) { buffer << static_cast<message_code_t>(ProtocolConstants::ClientMessageCode::GET_RATING_SNAPSHOT); }
+};
+
+template<>
+class UserMsgCodePrefixer<RatingSnapshotCreditMsg> {
+public: static void prefix (BinaryOStream& buffer) { buffer << static_cast<message_code_t>(ProtocolConstants::ClientMessageCode::RATING_SNAPSHOT_CREDIT); }
+};
+
+template<>
+class UserMsgCodePrefixer<SubscribeTopMsg> {
+public: static void prefix (BinaryOStream& buffer) { buffer << static_cast<message_code_t>(ProtocolConstants::ClientMessageCode::SUBSCRIBE_TOP); }
+};
+
+template<>
+class UserMsgCodePrefixer<SubscribeRatingsMsg> {
+public: static void prefix (BinaryOStream& buffer) { buffer << static_cast<message_code_t>(ProtocolConstants::ClientMessageCode::SUBSCRIBE_RATINGS); }
+};
+
 // --------------------------------------------------------------------- //
 /*
 *  Outgoing (service-to-client) messages
@@ -318,6 +617,33 @@ public:
     : GenericUserIdError (ProtocolConstants::ProtocolError::MULTIPLE_REGISTRATION, userId) {}
 };
 
+class RatingQueryRejectedError : public GenericUserIdError {
+public:
+
+    RatingQueryRejectedError () : GenericUserIdError(ProtocolConstants::ProtocolError::RATING_QUERY_REJECTED) {}
+
+    RatingQueryRejectedError (id_t userId, request_id_t requestId)
+    : GenericUserIdError (ProtocolConstants::ProtocolError::RATING_QUERY_REJECTED, userId), m_requestId {requestId} {}
+
+    request_id_t getRequestId () const { return m_requestId; }
+
+    void init (BinaryIStream& buffer) override {
+        GenericUserIdError::init(buffer);
+
+        buffer >> m_requestId;
+    }
+
+    void store (BinaryOStream& buffer) const override {
+        GenericUserIdError::store(buffer);
+
+        buffer << m_requestId;
+    }
+
+private:
+
+    request_id_t m_requestId {0};
+};
+
 // --------------------------------------------------------------------- //
 
 class UnsupportedProtocolVersionError : public GenericProtocolError {
@@ -342,6 +668,83 @@ private:
     protocol_version_t m_expectedVersion;
 };
 
+// --------------------------------------------------------------------- //
+/*
+ *  ProtocolErrorRecord
+ *
+ *  a plain value counterpart of the error classes above, for passing the errors
+ *  around without allocations and virtual calls. It is serialized exactly the same
+ *  way as the corresponding error class, while a default constructed record holds no error
+ */
+
+struct ProtocolErrorRecord {
+    static ProtocolErrorRecord userUnrecognized (id_t userId) {
+        ProtocolErrorRecord record;
+
+        record.code = ProtocolConstants::ProtocolError::USER_UNRECOGNIZED;
+        record.userId = userId;
+
+        return record;
+    }
+
+    static ProtocolErrorRecord multipleRegistration (id_t userId) {
+        ProtocolErrorRecord record;
+
+        record.code = ProtocolConstants::ProtocolError::MULTIPLE_REGISTRATION;
+        record.userId = userId;
+
+        return record;
+    }
+
+    static ProtocolErrorRecord ratingQueryRejected (id_t userId, request_id_t requestId) {
+        ProtocolErrorRecord record;
+
+        record.code = ProtocolConstants::ProtocolError::RATING_QUERY_REJECTED;
+        record.userId = userId;
+        record.requestId = requestId;
+
+        return record;
+    }
+
+    static ProtocolErrorRecord protocolVersionUnsupported () {
+        ProtocolErrorRecord record;
+
+        record.code = ProtocolConstants::ProtocolError::PROTOCOL_VERSION_UNSUPPORTED;
+        record.version = ProtocolConstants::version;
+
+        return record;
+    }
+
+    explicit operator bool () const {
+        return code != ProtocolConstants::ProtocolError {};
+    }
+
+    void store (BinaryOStream& buffer) const {
+        buffer << static_cast<error_code_t>(code);
+
+        if (code == ProtocolConstants::ProtocolError::PROTOCOL_VERSION_UNSUPPORTED) {
+            buffer << version;
+        } else {
+            buffer << userId;
+        }
+
+        if (code == ProtocolConstants::ProtocolError::RATING_QUERY_REJECTED) {
+            buffer << requestId;
+        }
+    }
+
+    ProtocolConstants::ProtocolError code {};
+
+    union {
+        id_t userId;
+        protocol_version_t version;
+    };
+
+    request_id_t requestId {0}; // only for the rejected rating queries
+};
+
+static_assert(std::is_trivially_copyable_v<ProtocolErrorRecord>, "error records are copied around as plain values");
+
 // --------------------------------------------------------------------- //
 /*
  *  Rating message
@@ -425,6 +828,303 @@ private:
     rating_pack_t m_ratings;
 };
 
+// --------------------------------------------------------------------- //
+/*
+ *  Rating query result message
+ *
+ *  the answer to GetRatingMsg. The top positions go first, then the positions around the user's one,
+ *  starting at 'surroundingsBegin' and never overlapping the top. Both counts are given explicitly,
+ *  since the service may have clamped the requested dimensions. An unknown user gets position -1
+ *  and no surroundings
+ */
+
+class RatingQueryResult {
+public:
+
+    using rating_pack_t = RatingPackMessage::rating_pack_t;
+
+    class StorageBuilder {
+    public:
+        static void storeResultHeader (BinaryOStream& buffer, request_id_t requestId, id_t id, int ratingLength, int ratingPos,
+                                       rating_dimension_t topCount, int surroundingsBegin, rating_dimension_t surroundingsCount) {
+            buffer << requestId << id << ratingLength << ratingPos << topCount << surroundingsBegin << surroundingsCount;
+        }
+    };
+
+public:
+
+    request_id_t getRequestId () const { return m_requestId; }
+    id_t getUserId () const { return m_userId; }
+    int getRatingLength () const { return m_ratingLength; }
+    int getRatingPos () const { return m_ratingPos; }
+    int getSurroundingsBegin () const { return m_surroundingsBegin; }
+    const rating_pack_t& getTopRatings () const { return m_topRatings; }
+    const rating_pack_t& getSurroundings () const { return m_surroundings; }
+
+public:
+
+    void init (BinaryIStream& buffer) {
+        rating_dimension_t topCount {0};
+        rating_dimension_t surroundingsCount {0};
+
+        buffer >> m_requestId >> m_userId >> m_ratingLength >> m_ratingPos >> topCount >> m_surroundingsBegin >> surroundingsCount;
+
+        readEntries(buffer, m_topRatings, topCount);
+        readEntries(buffer, m_surroundings, surroundingsCount);
+    }
+
+private:
+
+    static void readEntries (BinaryIStream& buffer, rating_pack_t& entries, rating_dimension_t count) {
+        entries.resize(count);
+
+        for (auto& entry : entries) {
+            buffer >> entry.id >> entry.winnings;
+
+#ifdef PASS_NAMES_AROUND
+            buffer >> entry.name;
+#endif
+        }
+    }
+
+private:
+
+    request_id_t m_requestId {0};
+    id_t m_userId {ProtocolConstants::invalidUserId};
+    int m_ratingLength {0};
+    int m_ratingPos {-1};
+    int m_surroundingsBegin {0};
+    rating_pack_t m_topRatings;
+    rating_pack_t m_surroundings;
+};
+
+// even with the longest names, the largest possible result must fit into a single message
+static_assert(sizeof(message_size_t) + sizeof(message_code_t) +
+              sizeof(request_id_t) + sizeof(id_t) + 3 * sizeof(int) + 2 * sizeof(rating_dimension_t) +
+              (ProtocolConstants::RatingQueryLimits::maxTopPositions + 2 * ProtocolConstants::RatingQueryLimits::maxCompetitionDistance + 1) *
+              (sizeof(id_t) + sizeof(monetary_t) + 1 + UCHAR_MAX) <= USHRT_MAX, "rating query limits are too generous");
+
+// --------------------------------------------------------------------- //
+/*
+ *  Rating snapshot frame message
+ *
+ *  a range of consecutive positions of a single rating generation, the frames of a stream going in
+ *  the position order. Every frame is decoded on its own, the delta encoding starts over in each.
+ *  The frames may be larger than a regular message allows, so they always come with the extended size
+ */
+
+class RatingSnapshotFrame {
+public:
+
+    using rating_pack_t = RatingPackMessage::rating_pack_t;
+    using SnapshotEncoding = ProtocolConstants::SnapshotEncoding;
+
+    // zigzag LEB128, so the small differences of either sign take a byte or two
+    struct VarintCoding {
+        static void store (BinaryOStream& buffer, long long value) {
+            auto bits = (static_cast<unsigned long long>(value) << 1) ^ static_cast<unsigned long long>(value >> 63);
+
+            while (bits >= 0x80) {
+                buffer << static_cast<unsigned char>(bits | 0x80);
+                bits >>= 7;
+            }
+
+            buffer << static_cast<unsigned char>(bits);
+        }
+
+        static long long load (BinaryIStream& buffer) {
+            unsigned long long bits {0};
+
+            for (auto shift = 0; shift < 64; shift += 7) {
+                unsigned char byte {0};
+
+                buffer >> byte;
+                bits |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+
+                if (!(byte & 0x80)) {
+                    return static_cast<long long>(bits >> 1) ^ -static_cast<long long>(bits & 1);
+                }
+            }
+
+            throw BinaryIStream::storage_underflow {};
+        }
+    };
+
+    class StorageBuilder {
+    public:
+        static void storeFrameHeader (BinaryOStream& buffer, request_id_t requestId, unsigned long long generation,
+                                      int ratingLength, int frameBegin, unsigned int frameSize,
+                                      SnapshotEncoding encoding, unsigned char flags) {
+            buffer << requestId << generation << ratingLength << frameBegin << frameSize << encoding << flags;
+        }
+
+        // the previous entry is the one stored last within the same frame, or zeroes for the first one
+        static void storeFrameEntry (BinaryOStream& buffer, SnapshotEncoding encoding,
+                                     id_t id, monetary_t winnings, id_t previousId, monetary_t previousWinnings
+#ifdef PASS_NAMES_AROUND
+                                     , const buffer_t& name
+#endif
+                                     ) {
+            if (encoding == SnapshotEncoding::DELTA_VARINT) {
+                VarintCoding::store(buffer, static_cast<long long>(id) - previousId);
+                VarintCoding::store(buffer, static_cast<long long>(winnings) - previousWinnings);
+            } else {
+                buffer << id << winnings;
+            }
+
+#ifdef PASS_NAMES_AROUND
+            buffer << name;
+#endif
+        }
+    };
+
+public:
+
+    request_id_t getRequestId () const { return m_requestId; }
+    unsigned long long getGeneration () const { return m_generation; }
+    int getRatingLength () const { return m_ratingLength; }
+    int getFrameBegin () const { return m_frameBegin; }
+    bool isLast () const { return m_flags & ProtocolConstants::SnapshotFrameFlags::lastFrame; }
+    bool isRejected () const { return m_flags & ProtocolConstants::SnapshotFrameFlags::streamRejected; }
+    const rating_pack_t& getRatings () const { return m_ratings; }
+
+public:
+
+    void init (BinaryIStream& buffer) {
+        unsigned int frameSize {0};
+        SnapshotEncoding encoding {SnapshotEncoding::PLAIN};
+        id_t previousId {0};
+        monetary_t previousWinnings {0};
+
+        buffer >> m_requestId >> m_generation >> m_ratingLength >> m_frameBegin >> frameSize >> encoding >> m_flags;
+
+        if (frameSize > ProtocolConstants::SnapshotStreamLimits::maxPositionsPerFrame) {
+            throw BinaryIStream::storage_underflow {};
+        }
+
+        m_ratings.resize(frameSize);
+
+        for (auto& entry : m_ratings) {
+            if (encoding == SnapshotEncoding::DELTA_VARINT) {
+                entry.id = static_cast<id_t>(previousId + VarintCoding::load(buffer));
+                entry.winnings = static_cast<monetary_t>(previousWinnings + VarintCoding::load(buffer));
+            } else {
+                buffer >> entry.id >> entry.winnings;
+            }
+
+#ifdef PASS_NAMES_AROUND
+            buffer >> entry.name;
+#endif
+            previousId = entry.id;
+            previousWinnings = entry.winnings;
+        }
+    }
+
+private:
+
+    request_id_t m_requestId {0};
+    unsigned long long m_generation {0};
+    int m_ratingLength {0};
+    int m_frameBegin {0};
+    unsigned char m_flags {0};
+    rating_pack_t m_ratings;
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  Top rating diff message
+ *
+ *  the changes of the top positions between two consecutive generations the subscriber has seen.
+ *  A user who has left comes with the old position, all the others with the new one. The amount
+ *  goes along with every change, the name only with the entries and renames. The baseline diff
+ *  has all the top users entering an empty top. Comes with the extended size, like the snapshot frames
+ */
+
+class TopRatingDiff {
+public:
+
+    struct TopChange {
+        unsigned char flags {0};
+        id_t id {ProtocolConstants::invalidUserId};
+        int position {0};
+        monetary_t winnings {0};
+#ifdef PASS_NAMES_AROUND
+        buffer_t name;
+#endif
+    };
+
+    using changes_t = std::vector<TopChange>;
+
+    class StorageBuilder {
+    public:
+        static void storeDiffHeader (BinaryOStream& buffer, request_id_t subscriptionId, unsigned long long generation,
+                                     int ratingLength, rating_dimension_t topPositions, bool baseline, unsigned int changeCount) {
+            buffer << subscriptionId << generation << ratingLength << topPositions << static_cast<unsigned char>(baseline) << changeCount;
+        }
+
+        static void storeChange (BinaryOStream& buffer, unsigned char flags, id_t id, int position, monetary_t winnings
+#ifdef PASS_NAMES_AROUND
+                                 , const buffer_t& name
+#endif
+                                 ) {
+            buffer << flags << id << position << winnings;
+
+#ifdef PASS_NAMES_AROUND
+            if (flags & (ProtocolConstants::TopChangeFlags::entered | ProtocolConstants::TopChangeFlags::renamed)) {
+                buffer << name;
+            }
+#endif
+        }
+    };
+
+public:
+
+    request_id_t getSubscriptionId () const { return m_subscriptionId; }
+    unsigned long long getGeneration () const { return m_generation; }
+    int getRatingLength () const { return m_ratingLength; }
+    rating_dimension_t getTopPositions () const { return m_topPositions; }
+    bool isBaseline () const { return m_baseline; }
+    const changes_t& getChanges () const { return m_changes; }
+
+public:
+
+    void init (BinaryIStream& buffer) {
+        unsigned char baseline {0};
+        unsigned int changeCount {0};
+
+        buffer >> m_subscriptionId >> m_generation >> m_ratingLength >> m_topPositions >> baseline >> changeCount;
+
+        // nobody can enter and leave at the same time
+        if (changeCount > 2u * ProtocolConstants::TopFeedLimits::maxTopPositions) {
+            throw BinaryIStream::storage_underflow {};
+        }
+
+        m_baseline = baseline != 0;
+        m_changes.resize(changeCount);
+
+        for (auto& change : m_changes) {
+            buffer >> change.flags >> change.id >> change.position >> change.winnings;
+
+#ifdef PASS_NAMES_AROUND
+            if (change.flags & (ProtocolConstants::TopChangeFlags::entered | ProtocolConstants::TopChangeFlags::renamed)) {
+                buffer >> change.name;
+            } else {
+                change.name.clear();
+            }
+#endif
+        }
+    }
+
+private:
+
+    request_id_t m_subscriptionId {0};
+    unsigned long long m_generation {0};
+    int m_ratingLength {0};
+    rating_dimension_t m_topPositions {0};
+    bool m_baseline {false};
+    changes_t m_changes;
+};
+
 } // namespace IpcProto
 
 #endif //IQOPTIONTESTTASK_PROTOCOL_H
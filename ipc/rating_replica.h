@@ -0,0 +1,269 @@
+#ifndef IQOPTIONTESTTASK_RATING_REPLICA_H
+#define IQOPTIONTESTTASK_RATING_REPLICA_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IQOPTIONTESTTASK_HAS_SHM 1
+#endif
+
+#include "protocol.h"
+
+namespace IpcProto {
+
+// --------------------------------------------------------------------- //
+/*
+ *  Rating replica layout
+ *
+ *  the service publishes every rating generation into a POSIX shared memory segment,
+ *  so that the processes on the same host can look the positions up without asking the service.
+ *  The segment has two slots: the service fills the one the readers are not directed to
+ *  and then flips the active slot index. Every slot is guarded by a sequence counter which is
+ *  odd while the slot is being written, so a reader that has raced with the writer just retries
+ */
+// --------------------------------------------------------------------- //
+
+struct ReplicaConstants {
+    static constexpr uint64_t magic {0x4143494c50455251}; // "QREPLICA"
+    static constexpr uint32_t version {1};
+    static constexpr int slotCount {2};
+};
+
+struct ReplicaIndexEntry {
+    id_t id;
+    uint32_t position;
+};
+
+struct ReplicaSlotHeader {
+    std::atomic<uint64_t> sequence;
+    uint64_t generation;
+    uint32_t size; // the users published, never more than the capacity
+    uint32_t ratingSize; // the users actually rated, might be more than the capacity
+};
+
+/*
+ *  A slot is its header followed by three arrays of the segment capacity: the ids in the rating order,
+ *  the amounts in the same order, and the (id, position) pairs sorted by the id
+ */
+
+struct ReplicaHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    std::atomic<uint32_t> activeSlot;
+    uint32_t reserved;
+    uint64_t slotStride;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "the replica atomics are shared between processes");
+
+struct ReplicaLayout {
+    static constexpr size_t alignUp (size_t offset) {
+        return (offset + 7) / 8 * 8;
+    }
+
+    static constexpr size_t idsOffset () {
+        return alignUp(sizeof(ReplicaSlotHeader));
+    }
+
+    static constexpr size_t amountsOffset (uint32_t capacity) {
+        return alignUp(idsOffset() + capacity * sizeof(id_t));
+    }
+
+    static constexpr size_t indexOffset (uint32_t capacity) {
+        return alignUp(amountsOffset(capacity) + capacity * sizeof(monetary_t));
+    }
+
+    static constexpr size_t slotStride (uint32_t capacity) {
+        return alignUp(indexOffset(capacity) + capacity * sizeof(ReplicaIndexEntry));
+    }
+
+    static constexpr size_t segmentSize (uint32_t capacity) {
+        return alignUp(sizeof(ReplicaHeader)) + ReplicaConstants::slotCount * slotStride(capacity);
+    }
+
+    static constexpr size_t slotOffset (uint32_t capacity, uint32_t slot) {
+        return alignUp(sizeof(ReplicaHeader)) + slot * slotStride(capacity);
+    }
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  RatingReplicaReader class
+ *
+ *  a read-only view of the replica for the co-located processes. All the lookups are
+ *  lock-free and never block the service; the results are always taken from a single
+ *  generation. Header-only on purpose, the readers only need this file and protocol.h
+ */
+// --------------------------------------------------------------------- //
+
+class RatingReplicaReader {
+public:
+
+    struct UserPosition {
+        unsigned long long generation {0};
+        int position {-1};
+        int ratingSize {0};
+        monetary_t amount {0};
+    };
+
+    struct WindowEntry {
+        id_t id;
+        monetary_t amount;
+    };
+
+public:
+
+    explicit RatingReplicaReader (const std::string& name) {
+#ifdef IQOPTIONTESTTASK_HAS_SHM
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat segmentStat {};
+
+        if (fstat(fd, &segmentStat) == 0 && static_cast<size_t>(segmentStat.st_size) >= sizeof(ReplicaHeader)) {
+            void* mapping = mmap(nullptr, static_cast<size_t>(segmentStat.st_size), PROT_READ, MAP_SHARED, fd, 0);
+
+            if (mapping != MAP_FAILED) {
+                m_segment = static_cast<const unsigned char*>(mapping);
+                m_segmentSize = static_cast<size_t>(segmentStat.st_size);
+            }
+        }
+
+        close(fd);
+
+        if (m_segment && (header().magic != ReplicaConstants::magic || header().version != ReplicaConstants::version ||
+                          ReplicaLayout::segmentSize(header().capacity) > m_segmentSize)) {
+            unmap();
+        }
+#endif
+    }
+
+    ~RatingReplicaReader () {
+        unmap();
+    }
+
+    RatingReplicaReader (const RatingReplicaReader&) = delete;
+    RatingReplicaReader& operator= (const RatingReplicaReader&) = delete;
+
+    bool valid () const {
+        return m_segment != nullptr;
+    }
+
+    // false if the user is not within the published part of the rating
+    bool findUser (id_t userId, UserPosition& result) const {
+        return readConsistent([this, userId, &result](const unsigned char* slot, const ReplicaSlotHeader& slotHeader) {
+            auto index = reinterpret_cast<const ReplicaIndexEntry*>(slot + ReplicaLayout::indexOffset(capacity()));
+            auto indexEnd = index + std::min(slotHeader.size, capacity());
+            auto entry = std::lower_bound(index, indexEnd, userId, [](const ReplicaIndexEntry& e, id_t id) { return e.id < id; });
+
+            result.generation = slotHeader.generation;
+            result.ratingSize = static_cast<int>(slotHeader.ratingSize);
+            result.position = -1;
+
+            if (entry == indexEnd || entry->id != userId || entry->position >= capacity()) {
+                return false;
+            }
+
+            result.position = static_cast<int>(entry->position);
+            result.amount = amounts(slot)[entry->position];
+
+            return true;
+        });
+    }
+
+    // copies the users at positions [from, from + count) and returns how many there were
+    size_t window (int from, size_t count, WindowEntry* entries, unsigned long long& generation) const {
+        size_t copied {0};
+
+        readConsistent([this, from, count, entries, &generation, &copied](const unsigned char* slot, const ReplicaSlotHeader& slotHeader) {
+            auto size = static_cast<size_t>(std::min(slotHeader.size, capacity()));
+            auto begin = std::min(static_cast<size_t>(std::max(from, 0)), size);
+            auto ids = reinterpret_cast<const id_t*>(slot + ReplicaLayout::idsOffset());
+
+            copied = std::min(count, size - begin);
+            generation = slotHeader.generation;
+
+            for (size_t i = 0; i < copied; ++i) {
+                entries[i].id = ids[begin + i];
+                entries[i].amount = amounts(slot)[begin + i];
+            }
+
+            return true;
+        });
+
+        return copied;
+    }
+
+private:
+
+    const ReplicaHeader& header () const {
+        return *reinterpret_cast<const ReplicaHeader*>(m_segment);
+    }
+
+    uint32_t capacity () const {
+        return header().capacity;
+    }
+
+    const monetary_t* amounts (const unsigned char* slot) const {
+        return reinterpret_cast<const monetary_t*>(slot + ReplicaLayout::amountsOffset(capacity()));
+    }
+
+    template <typename Read>
+    bool readConsistent (Read&& read) const {
+        if (!m_segment) {
+            return false;
+        }
+
+        for (;;) {
+            auto slotIndex = header().activeSlot.load(std::memory_order_acquire) % ReplicaConstants::slotCount;
+            const unsigned char* slot = m_segment + ReplicaLayout::slotOffset(capacity(), slotIndex);
+            const auto& slotHeader = *reinterpret_cast<const ReplicaSlotHeader*>(slot);
+            auto sequence = slotHeader.sequence.load(std::memory_order_acquire);
+
+            if (sequence % 2 != 0) {
+                continue;
+            }
+
+            auto found = read(slot, slotHeader);
+
+            // whatever has been read is only trusted if the slot hasn't been touched meanwhile
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (slotHeader.sequence.load(std::memory_order_relaxed) == sequence) {
+                return found;
+            }
+        }
+    }
+
+    void unmap () {
+#ifdef IQOPTIONTESTTASK_HAS_SHM
+        if (m_segment) {
+            munmap(const_cast<unsigned char*>(m_segment), m_segmentSize);
+        }
+#endif
+        m_segment = nullptr;
+        m_segmentSize = 0;
+    }
+
+private:
+
+    const unsigned char* m_segment {nullptr};
+    size_t m_segmentSize {0};
+};
+
+}
+
+#endif //IQOPTIONTESTTASK_RATING_REPLICA_H
@@ -1,12 +1,15 @@
 #ifndef IQOPTIONTESTTASK_TRANSPORT_H
 #define IQOPTIONTESTTASK_TRANSPORT_H
 
+#include <iostream>
 #include <memory>
+#include <future>
 #include <asio.hpp>
 
 #include "../utils/binary_storage.h"
 #include "../utils/spinlock.h"
 #include "protocol.h"
+#include "outbound_queue.h"
 
 
 class TCPGenericSocketTransport {
@@ -16,10 +19,17 @@ public:
     ~TCPGenericSocketTransport () {
         asio::error_code ec;
 
-        sock.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+        shutdown();
         sock.close(ec);
     }
 
+    // the blocked sends and receives of the other threads fail right away, the socket stays open
+    void shutdown () {
+        asio::error_code ec;
+
+        sock.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+    }
+
     bool send (const void* buf, size_t size) {
         asio::error_code ec;
         asio::write(sock, asio::buffer(buf, size), ec);
@@ -34,6 +44,14 @@ public:
         return !static_cast<bool>(ec);
     }
 
+    // a gathering write, the buffers go out one after another without being copied together
+    bool send (const std::vector<asio::const_buffer>& bufs) {
+        asio::error_code ec;
+        asio::write(sock, bufs, ec);
+
+        return !static_cast<bool>(ec);
+    }
+
     bool receive (void* buf, int size) {
         asio::error_code ec;
         asio::read(sock, asio::buffer(buf, size), ec);
@@ -48,6 +66,13 @@ public:
         return !static_cast<bool>(ec);
     }
 
+    size_t available () {
+        asio::error_code ec;
+        auto bytesAvailable = sock.available(ec);
+
+        return ec ? 0 : bytesAvailable;
+    }
+
 protected:
 
     asio::io_service ios;
@@ -86,6 +111,17 @@ public:
 
 // --------------------------------------------------------------------- //
 
+// the acceptor is shared by all the connections accepted on the same port
+class TCPAcceptedSocketTransport : public TCPGenericSocketTransport {
+public:
+
+    void init (asio::ip::tcp::acceptor& acceptor) {
+        acceptor.accept(sock);
+    }
+};
+
+// --------------------------------------------------------------------- //
+
 class transport_error_recoverable {};
 
 template <class Transport>
@@ -99,19 +135,44 @@ protected:
 public:
 
     void send (const BinaryOStream& buffer) {
-        if (!m_transport.send(buffer.storage())) {
+        send(buffer.storage());
+    }
+
+    // the messages in the storage must be complete, size prefixes included
+    void send (const buffer_t& storage) {
+        if (!m_transport.send(storage)) {
             throw transport_error_recoverable {};
         }
     }
 
     BinaryIStream receive (buffer_t& storage) {
         IpcProto::message_size_t ms;
+        size_t messageSize {0};
+        size_t prefixSize {sizeof(ms)};
 
         if (!m_transport.receive(&ms, sizeof(ms))) {
             throw transport_error_recoverable {};
         }
 
-        storage.resize(ms - sizeof(ms));
+        messageSize = ms;
+
+        if (ms == IpcProto::ProtocolConstants::extendedSizeMarker && m_extendedSizesAccepted) {
+            IpcProto::extended_message_size_t ems;
+
+            if (!m_transport.receive(&ems, sizeof(ems))) {
+                throw transport_error_recoverable {};
+            }
+
+            messageSize = ems;
+            prefixSize += sizeof(ems);
+        }
+
+        if (messageSize < prefixSize) {
+            // the stream is out of sync, there's no telling where the next message starts
+            throw transport_error_recoverable {};
+        }
+
+        storage.resize(messageSize - prefixSize);
 
         if (!m_transport.receive(storage)) {
             throw transport_error_recoverable {};
@@ -120,9 +181,20 @@ public:
         return BinaryIStream{storage};
     }
 
+    bool dataPending () {
+        return m_transport.available() != 0;
+    }
+
+    void disconnect () {
+        m_transport.shutdown();
+    }
+
 protected:
 
     Transport m_transport;
+
+    // only the service sends the extended size messages, it never has to accept them
+    bool m_extendedSizesAccepted {false};
 };
 
 // --------------------------------------------------------------------- //
@@ -133,16 +205,37 @@ template <class Transport>
 class ServerSideTransport : public GenericMessageLayer<Transport> {
 public:
 
-    ServerSideTransport (SpinlockPtr&& writerLock) : m_writerLock {std::move(writerLock)} {
+    ServerSideTransport (SpinlockPtr&& writerLock, const OutboundPolicy& outboundPolicy = OutboundPolicy {})
+    : m_writerLock {std::move(writerLock)}, m_outbound {*m_writerLock, outboundPolicy} {
         assert(m_writerLock);
     }
 
+    ~ServerSideTransport () {
+        disconnect();
+
+        if (m_writerHandle.valid()) {
+            m_writerHandle.wait();
+        }
+    }
+
+    // once the handshake is done, a thread of its own writes out the queued messages
     template <class... Args>
     void launch (Args&&... args) {
-        using IpcProto::message_code_t;
+        connect(std::forward<Args>(args)...);
+        handshake();
+
+        m_writerHandle = std::async(std::launch::async, &ServerSideTransport::writeQueued, this);
+    }
 
+    // the connection may be accepted by one thread and handshaken by another
+    template <class... Args>
+    void connect (Args&&... args) {
         // won't compile without the "this->" prefix
         this->m_transport.init(std::forward<Args>(args)...);
+    }
+
+    void handshake () {
+        using IpcProto::message_code_t;
 
         buffer_t handshakeStorage;
         BinaryIStream buffer = this->receive(handshakeStorage);
@@ -194,6 +287,33 @@ public:
         return buffer;
     }
 
+    BinaryOStream createAdaptedQueryResultBuffer () const {
+        BinaryOStream buffer;
+
+        buffer << IpcProto::message_size_t {0}
+               << static_cast<IpcProto::message_code_t>(IpcProto::ProtocolConstants::ServiceMessageCode::RATING_QUERY_RESULT);
+        return buffer;
+    }
+
+    // goes with blockedWriteExtendedMessage
+    BinaryOStream createAdaptedSnapshotFrameBuffer () const {
+        BinaryOStream buffer;
+
+        buffer << IpcProto::ProtocolConstants::extendedSizeMarker << IpcProto::extended_message_size_t {0}
+               << static_cast<IpcProto::message_code_t>(IpcProto::ProtocolConstants::ServiceMessageCode::RATING_SNAPSHOT_FRAME);
+        return buffer;
+    }
+
+    // goes with blockedWriteExtendedMessage as well
+    BinaryOStream createAdaptedTopDiffBuffer () const {
+        BinaryOStream buffer;
+
+        buffer << IpcProto::ProtocolConstants::extendedSizeMarker << IpcProto::extended_message_size_t {0}
+               << static_cast<IpcProto::message_code_t>(IpcProto::ProtocolConstants::ServiceMessageCode::TOP_RATING_DIFF);
+        return buffer;
+    }
+
+    // writes right away, only meant for the handshake replies, before the writer thread starts
     void writeMessage (BinaryOStream& buffer) {
         buffer.setPos(0);
         buffer << static_cast<IpcProto::message_size_t>(buffer.storage().size());
@@ -201,15 +321,87 @@ public:
         this->send(buffer);
     }
 
-    void blockedWriteMessage (BinaryOStream& buffer) {
-        std::lock_guard(*m_writerLock.get());
+    // the blocked writes queue the message under the writer lock, waiting for room if the client is slow
+    // to read; the user id and the periodic flag are only given for the rating packs. The regular messages
+    // come from the workers, which hold the data pin, so they wait for the room briefly
 
-        writeMessage(buffer);
+    void blockedWriteMessage (BinaryOStream& buffer, IpcProto::id_t userId = IpcProto::ProtocolConstants::invalidUserId,
+                              bool periodic = false) {
+        buffer.setPos(0);
+        buffer << static_cast<IpcProto::message_size_t>(buffer.storage().size());
+
+        queueOrDisconnect(buffer.storage(), userId, periodic, true);
+    }
+
+    void blockedWriteExtendedMessage (BinaryOStream& buffer) {
+        assert(buffer.storage().size() <= UINT_MAX);
+
+        buffer.setPos(0);
+        buffer << IpcProto::ProtocolConstants::extendedSizeMarker
+               << static_cast<IpcProto::extended_message_size_t>(buffer.storage().size());
+
+        queueOrDisconnect(buffer.storage(), IpcProto::ProtocolConstants::invalidUserId, false, false);
+    }
+
+    // same, but the message must be complete already, and a closed connection is left to the caller
+    bool queueMessage (const buffer_t& message, IpcProto::id_t userId, bool periodic) {
+        return m_outbound.push(message, userId, periodic);
+    }
+
+    // runs until the connection is closed, either in the thread started by launch or in the caller's own
+    void writeQueued () {
+        std::vector<buffer_t> batch;
+        std::vector<asio::const_buffer> batchBuffers;
+
+        while (m_outbound.pop(batch)) {
+            batchBuffers.clear();
+
+            for (const auto& message : batch) {
+                if (!message.empty()) {
+                    batchBuffers.push_back(asio::buffer(message));
+                }
+            }
+
+            if (!this->m_transport.send(batchBuffers)) {
+                disconnect();
+
+                return;
+            }
+        }
+    }
+
+    // the messages still queued are dropped, the blocked sends and receives fail
+    void disconnect () {
+        m_outbound.close();
+
+        GenericMessageLayer<Transport>::disconnect();
+    }
+
+    Spinlock::Statistics writerLockStatistics () const {
+        return m_writerLock->statistics();
+    }
+
+    OutboundQueue::Statistics outboundStatistics () const {
+        return m_outbound.statistics();
+    }
+
+private:
+
+    void queueOrDisconnect (const buffer_t& message, IpcProto::id_t userId, bool periodic, bool dataPinned) {
+        if (!m_outbound.push(message, userId, periodic, dataPinned)) {
+            // the client has stopped reading or is gone, either way the listener must notice as well
+            disconnect();
+
+            throw transport_error_recoverable {};
+        }
     }
 
 private:
 
     SpinlockPtr m_writerLock;
+    OutboundQueue m_outbound;
+
+    std::future<void> m_writerHandle;
 };
 
 // --------------------------------------------------------------------- //
@@ -218,6 +410,10 @@ template <class Transport>
 class ClientSideTransport : public GenericMessageLayer<Transport> {
 public:
 
+    ClientSideTransport () {
+        this->m_extendedSizesAccepted = true;
+    }
+
     template <class... Args>
     void launch (Args&&... args) {
         this->m_transport.init(std::forward<Args>(args)...);
@@ -250,5 +446,6 @@ public:
 
 using ServerIpcTransport = ServerSideTransport<TCPServerSocketTransport>;
 using ClientIpcTransport = ClientSideTransport<TCPClientSocketTransport>;
+using SubscriberIpcTransport = ServerSideTransport<TCPAcceptedSocketTransport>;
 
 #endif //IQOPTIONTESTTASK_TRANSPORT_H
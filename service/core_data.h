@@ -7,9 +7,10 @@
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
-#include <unordered_set>
 #include <map>
 #include <set>
+#include <string>
+#include <algorithm>
 
 #include "../ipc/protocol.h"
 
@@ -21,14 +22,103 @@
 
 using id_t = IpcProto::id_t;
 using monetary_t = IpcProto::monetary_t;
-using connect_time_t = unsigned char;
+using connect_time_t = unsigned short; // index of the announcement slot the user connected at
+using sequence_t = unsigned long long; // number of a message within the event log, starting from 1
 
 struct UserDataConstants {
-    static constexpr connect_time_t invalidSecond {60};
+    static constexpr connect_time_t invalidSlot {USHRT_MAX};
     static constexpr id_t invalidId {IpcProto::ProtocolConstants::invalidUserId};
     static constexpr int invalidRating {-1};
 };
 
+/*
+ *  Every connected user gets the rating once per period, at the slot of the period
+ *  the user connected at. The period must consist of a whole number of slots
+ */
+
+struct AnnouncementSchedule {
+    std::chrono::milliseconds period {60000};
+    std::chrono::milliseconds slot {1000};
+
+    unsigned int slotCount () const {
+        return static_cast<unsigned int>(period / slot);
+    }
+};
+
+/*
+ *  The rating is always recalculated at the start of every announcement period. Besides that, it may be
+ *  recalculated once the interval passes, or once the ingest shards have buffered enough messages.
+ *  Both conditions are checked at the slot starts, zero values disable them
+ */
+
+struct RecalculationPolicy {
+    std::chrono::milliseconds interval {0};
+    unsigned int pendingMessageThreshold {0};
+};
+
+/*
+ *  The incoming messages may be logged to a file to survive the service restarts. The log is synced
+ *  to the disk once per commit interval, so a crash loses at most the messages of the last interval.
+ *  An empty path disables the log
+ */
+
+struct EventLogConfig {
+    std::string path;
+    std::chrono::milliseconds commitInterval {10};
+};
+
+/*
+ *  The rating may be saved to a snapshot file at the start of every few periods. On restart the service
+ *  loads the latest snapshot and only replays the part of the event log that came after it
+ */
+
+struct SnapshotPolicy {
+    std::string path;
+    unsigned int periodsBetween {10};
+};
+
+/*
+ *  A full dump of the rating may be exported for the analytics every interval, in the background.
+ *  An empty path disables the export
+ */
+
+struct ExportPolicy {
+    std::string path;
+    std::chrono::milliseconds interval {600000};
+};
+
+/*
+ *  Every new rating may be mirrored into a shared memory segment (a POSIX name like "/iqrating"),
+ *  so the processes on the same host can read the positions directly. Only the top capacity users
+ *  are mirrored. An empty name disables the replica
+ */
+
+struct ReplicaPolicy {
+    std::string name;
+    unsigned int capacity {1 << 20};
+};
+
+/*
+ *  The rating packs may be fanned out to the subscriber connections (e.g. the gateway processes)
+ *  accepted on a port of their own. Every subscriber gets the packs of the users matching its filter
+ *  through an outbound buffer of its own, a subscriber falling behind by more than the buffer size
+ *  even with its stale packs dropped is disconnected. A zero port disables the subscribers
+ */
+
+struct SubscriberPolicy {
+    unsigned short port {0};
+    size_t bufferSize {4 << 20}; // bytes per subscriber
+};
+
+/*
+ *  The transport and the job queue figures may be printed every interval while the service runs,
+ *  they are printed once the connection is over anyway. A zero interval disables the periodic ones
+ */
+
+struct StatisticsPolicy {
+    std::chrono::milliseconds interval {0};
+};
+
 // --------------------------------------------------------------------- //
 /*
  *  Rating-related types
@@ -42,7 +132,7 @@ struct BasicUserData {
     BasicUserData (const BasicUserData&) = delete;
     BasicUserData (BasicUserData&&) = default;
 
-    connect_time_t secondConnected { UserDataConstants::invalidSecond };
+    connect_time_t slotConnected { UserDataConstants::invalidSlot };
 
 #ifdef PASS_NAMES_AROUND
     buffer_t name;
@@ -58,10 +148,146 @@ struct FullUserData : public BasicUserData {
     id_t id { UserDataConstants::invalidId };
     monetary_t amountWon { 0 };
     int rating { UserDataConstants::invalidRating };
+
+    // position within the ChronoSet of the slot the user is connected at
+    unsigned int chronoSetIndex { 0 };
+};
+
+/*
+ *  The names replaced by the renames, kept for the readers of the generations captured before them.
+ *  Such a reader looks the names up by the ids long after the capture, a chunk at a time, and must still
+ *  get them as they were at the capture. A replaced name is only kept while a generation it belongs to is held
+ */
+
+class NameHistory {
+public:
+
+    // releases the generation on destruction
+    class Hold {
+    public:
+
+        Hold () = default;
+        Hold (const NameHistory* history, unsigned long long generation) : m_history {history}, m_generation {generation} {}
+        Hold (const Hold&) = delete;
+        Hold& operator= (const Hold&) = delete;
+
+        Hold (Hold&& right) noexcept : m_history {right.m_history}, m_generation {right.m_generation} {
+            right.m_history = nullptr;
+        }
+
+        Hold& operator= (Hold&& right) noexcept {
+            std::swap(m_history, right.m_history);
+            std::swap(m_generation, right.m_generation);
+
+            return *this;
+        }
+
+        ~Hold () {
+            if (m_history) {
+                m_history->releaseGeneration(m_generation);
+            }
+        }
+
+    private:
+
+        const NameHistory* m_history {nullptr};
+        unsigned long long m_generation {0};
+    };
+
+public:
+
+    // any thread, the generation must be held before the data is unpinned after the capture
+    Hold holdGeneration (unsigned long long generation) const {
+        std::lock_guard lg(m_lock);
+
+        m_heldGenerations.insert(generation);
+
+        return Hold {this, generation};
+    }
+
+    // the recalculation thread only, while nobody has the data pinned;
+    // the generation is the first one the new name belongs to
+    void recordRename (id_t userId, unsigned long long generation, buffer_t&& oldName) {
+        {
+            std::lock_guard lg(m_lock);
+
+            if (m_heldGenerations.empty()) {
+                return;
+            }
+        }
+
+        auto& names = m_replacedNames[userId];
+
+        // a name both given and replaced within the same recalculation has never been seen by anyone
+        if (names.empty() || names.back().until != generation) {
+            names.push_back(ReplacedName {generation, std::move(oldName)});
+        }
+    }
+
+    // same, drops the names none of the generations held may ask for
+    void prune () {
+        std::lock_guard lg(m_lock);
+
+        if (m_heldGenerations.empty()) {
+            m_replacedNames.clear();
+
+            return;
+        }
+
+        auto oldestHeld = *m_heldGenerations.begin();
+
+        for (auto userNames = m_replacedNames.begin(); userNames != m_replacedNames.end();) {
+            auto& names = userNames->second;
+
+            names.erase(names.begin(), std::find_if(names.begin(), names.end(), [oldestHeld](const ReplacedName& n) {
+                return n.until > oldestHeld;
+            }));
+
+            userNames = names.empty() ? m_replacedNames.erase(userNames) : std::next(userNames);
+        }
+    }
+
+    // the readers, while the data is pinned; null if the user hasn't been renamed since the generation
+    const buffer_t* nameAt (id_t userId, unsigned long long generation) const {
+        auto userNames = m_replacedNames.find(userId);
+
+        if (userNames == m_replacedNames.end()) {
+            return nullptr;
+        }
+
+        for (const auto& replacedName : userNames->second) {
+            if (replacedName.until > generation) {
+                return &replacedName.name;
+            }
+        }
+
+        return nullptr;
+    }
+
+private:
+
+    void releaseGeneration (unsigned long long generation) const {
+        std::lock_guard lg(m_lock);
+
+        m_heldGenerations.erase(m_heldGenerations.find(generation));
+    }
+
+private:
+
+    struct ReplacedName {
+        unsigned long long until {0}; // the first generation with the next name
+        buffer_t name;
+    };
+
+    // oldest first
+    std::unordered_map<id_t, std::vector<ReplacedName>> m_replacedNames;
+
+    mutable std::mutex m_lock;
+    mutable std::multiset<unsigned long long> m_heldGenerations;
 };
 
 using SilentUsersMap = std::unordered_map<id_t, BasicUserData>;
-using ActiveUsersMap = std::unordered_map<id_t, std::unique_ptr<FullUserData>>;
+using ActiveUsersMap = std::unordered_map<id_t, FullUserData>; // the rating points right into the nodes
 using RatingVector = std::vector<FullUserData*>;
 
 struct CoreRatingData {
@@ -70,6 +296,14 @@ struct CoreRatingData {
     RatingVector rating;
 
     chrono_t expirationDate;
+
+    // the number of recalculations done, tells the versions of the rating apart
+    unsigned long long generation {0};
+
+    // per ingest shard, the sequence of the last logged message the data reflects
+    std::vector<sequence_t> appliedSequences;
+
+    NameHistory nameHistory;
 };
 
 struct SystemStopSignals {
@@ -90,8 +324,32 @@ struct SystemStopSignals {
 };
 
 struct CoreDataSyncBlock {
+    // the occasional readers pin the data to keep the next recalculation from starting while they read,
+    // a recalculation in progress is waited out
+    void pinData () {
+        std::unique_lock<std::mutex> lock(dataLock);
+
+        dataRefreshedTrigger.wait(lock, [this]()->bool{
+            return !refreshInProgress.load(std::memory_order_relaxed);
+        });
+
+        dataReaderCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void unpinData () {
+        {
+            // the counter is changed under the lock so that the recalculator can't miss the notification
+            std::lock_guard lg(dataLock);
+
+            dataReaderCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        readersGoneTrigger.notify_one();
+    }
+
     std::mutex dataLock;
     std::condition_variable dataRefreshedTrigger;
+    std::condition_variable readersGoneTrigger;
     std::atomic_bool refreshInProgress {false};
     std::atomic_int dataReaderCount {0};
 
@@ -104,10 +362,51 @@ struct CoreDataSyncBlock {
  */
 // --------------------------------------------------------------------- //
 
-using ChronoSet = std::unordered_set<const FullUserData*>;
+/*
+ *  Users connected at a particular slot, kept densely packed so that the announcer
+ *  walks a plain array. Every user remembers its position, so removal swaps the last
+ *  element into the gap and never searches or allocates
+ */
+
+class ChronoSet {
+public:
+
+    void insert (FullUserData* userData) {
+        userData->chronoSetIndex = static_cast<unsigned int>(m_users.size());
+        m_users.push_back(userData);
+    }
+
+    void erase (FullUserData* userData) {
+        assert(userData->chronoSetIndex < m_users.size() && m_users[userData->chronoSetIndex] == userData);
+
+        FullUserData* lastUser = m_users.back();
+
+        lastUser->chronoSetIndex = userData->chronoSetIndex;
+        m_users[lastUser->chronoSetIndex] = lastUser;
+        m_users.pop_back();
+    }
+
+    void clear () {
+        m_users.clear();
+    }
+
+    const FullUserData* const* data () const {
+        return m_users.data();
+    }
+
+    size_t size () const {
+        return m_users.size();
+    }
+
+private:
+
+    std::vector<FullUserData*> m_users;
+};
 
 struct IterationData {
-    std::array<ChronoSet, 60> usersOnline;
+    explicit IterationData (unsigned int slotCount) : usersOnline(slotCount) {}
+
+    std::vector<ChronoSet> usersOnline;
 };
 
 // --------------------------------------------------------------------- //
@@ -138,13 +437,36 @@ struct IncomingDataBuffer {
     ConnectionsMap connectionChanges;
     DealsMap dealsWon;
 
-    std::atomic_int bufferWriterCount { 0 };
+    sequence_t lastSequence {0};
 };
 
-struct IncomingDataDoubleBuffer {
-    IncomingDataBuffer buffers[2];
-    int currentBufferIndex { 0 };
-    std::atomic<IncomingDataBuffer*> currentBuffer { &buffers[0] };
+/*
+ *  The buffers are handed over between the ingest shard thread (the writer) and the recalculator
+ *  by epochs. The recalculator publishes a new epoch, the writer switches to the epoch's buffer
+ *  as soon as it notices and acknowledges it, and every buffer of the epochs before the acknowledged
+ *  one is free for the recalculator to drain. Nobody spins: both sides sleep on the condition variables,
+ *  and a writer too slow to acknowledge in time simply has its buffer drained by the next recalculation
+ */
+
+struct IncomingDataRing {
+    static constexpr unsigned int size {4};
+
+    IncomingDataBuffer buffers[size];
+
+    // guarded by the lock
+    unsigned int publishedEpoch {0}; // the epoch the writer must switch to
+    unsigned int writerEpoch {0}; // the epoch the writer is actually in
+    unsigned int drainedEpoch {0}; // all the buffers of the epochs before this one have been drained
+
+    std::mutex lock;
+    std::condition_variable writerTrigger;
+    std::condition_variable epochAcknowledged;
+
+    // messages dispatched since the last epoch publication, a hint for the adaptive recalculation
+    std::atomic_uint messagesBuffered {0};
 };
 
+// one ring per ingest shard, every user id belongs to exactly one shard
+using IncomingDataShards = std::vector<IncomingDataRing>;
+
 #endif //IQOPTIONTESTTASK_CORE_DATA_H
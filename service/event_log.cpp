@@ -0,0 +1,557 @@
+#include <iostream>
+#include <cstring>
+#include <stdexcept>
+#include <filesystem>
+#include <algorithm>
+
+#include "event_log.h"
+#include "message_builder.h"
+#include "registered_ids.h"
+#include "../utils/date_time.h"
+#include "../utils/file_sync.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr buffer_t::size_type logBatchThreshold {64 * 1024};
+static constexpr uint32_t logBlockMagic {0x474f4c45}; // "ELOG"
+static constexpr size_t blockPositionLimit {1 << 16}; // about an hour of the blocks at the default commit interval
+static constexpr size_t compactionChunkSize {1 << 20};
+
+/*
+ *  The log is a sequence of blocks, each one holding the messages of a batch in the same format
+ *  the ingest shards get them in: every message prefixed with its size. The timestamp is the time
+ *  the block was committed at, which is within a commit interval of the time the messages came in.
+ *  The messages of a block are numbered in a row from its first sequence on; the numbers aren't
+ *  derived from the position in the log, which has a gap wherever a crash has lost the blocks
+ *  a snapshot already reflects.
+ *  A block failing the checksum means the service has crashed in the middle of writing it,
+ *  so the replay stops there and the torn tail is cut off.
+ *  As the blocks go in the sequence order, a block whose first sequence is no further than the first
+ *  message a snapshot hasn't applied has nothing but the applied messages before it. That's what makes
+ *  an offset the snapshot has got safe to start the replay at, whatever has been cut off the log since
+ */
+
+using FilePtr = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+
+struct LogBlockHeader {
+    uint32_t magic {logBlockMagic};
+    uint32_t length {0};
+    int64_t timestamp {0}; // milliseconds since the epoch
+    uint64_t firstSequence {0};
+    uint32_t checksum {0};
+    uint32_t reserved {0};
+};
+
+static_assert(std::is_trivially_copyable<LogBlockHeader>::value && sizeof(LogBlockHeader) == 32,
+              "log block header is written as is");
+
+static uint32_t blockChecksum (const buffer_t& payload) {
+    // FNV-1a, the point is to notice a torn write, not to resist tampering
+    uint32_t hash {2166136261u};
+
+    for (auto byte : payload) {
+        hash = (hash ^ byte) * 16777619u;
+    }
+
+    return hash;
+}
+
+static bool readBlock (std::FILE* file, LogBlockHeader& header, buffer_t& payload) {
+    if (std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != logBlockMagic) {
+        return false;
+    }
+
+    payload.resize(header.length);
+
+    return std::fread(payload.data(), 1, payload.size(), file) == payload.size() && blockChecksum(payload) == header.checksum;
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  EventLog methods
+ */
+// --------------------------------------------------------------------- //
+
+EventLog::EventLog (const EventLogConfig& config, SystemStopSignals& stopSignals)
+: m_config {config}, m_stopSignals {stopSignals} {}
+
+// --------------------------------------------------------------------- //
+
+EventLog::~EventLog () {
+    // the listener is gone by now, so its last batch is ours to hand over
+    flush();
+
+    {
+        std::lock_guard lg(m_lock);
+
+        m_stopping = true;
+    }
+
+    m_stopTrigger.notify_one();
+
+    try {
+        if (m_writerHandle.valid()) {
+            m_writerHandle.get();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Event log exception: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "Event log exception: unknown exception" << std::endl;
+    }
+
+    if (m_file) {
+        std::fclose(m_file);
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+EventLog::ReplayStatistics EventLog::replay (IncomingDataShards& incomingData, RegisteredIdSet& registeredIds,
+                                             const std::vector<sequence_t>& appliedSequences, uint64_t startOffset) {
+    using ClientMessageCode = IpcProto::ProtocolConstants::ClientMessageCode;
+
+    assert(appliedSequences.size() == incomingData.size());
+
+    ReplayStatistics stats;
+    std::FILE* file = std::fopen(m_config.path.c_str(), "rb");
+
+    if (!file) {
+        // nothing has been logged yet, or the log has been removed since the snapshot was taken
+        m_lastSequence = *std::max_element(appliedSequences.begin(), appliedSequences.end());
+
+        return stats;
+    }
+
+    // the deals only count within the week they came in
+    auto weekStart = DateTime::currentWeekStart();
+
+    MessageBattery b;
+    MessageBuilder messageBuilder {b};
+    LogBlockHeader header;
+    buffer_t payload;
+    auto fileLength = std::filesystem::file_size(m_config.path);
+    auto firstUnapplied = *std::min_element(appliedSequences.begin(), appliedSequences.end()) + 1;
+
+    // no block where the snapshot points, or one with a message the snapshot doesn't reflect before it,
+    // means the log has been replaced or cut since, so it's replayed in full; the applied messages are skipped anyway
+    if (startOffset >= fileLength || seekFile(file, startOffset) != 0 ||
+        !readBlock(file, header, payload) || header.firstSequence > firstUnapplied) {
+        startOffset = 0;
+    }
+
+    if (seekFile(file, startOffset) != 0) {
+        std::fclose(file);
+
+        throw std::runtime_error {"can't seek the event log " + m_config.path};
+    }
+
+    uint64_t validLength {startOffset};
+
+    while (readBlock(file, header, payload)) {
+        auto outdated = chrono_t {std::chrono::duration_cast<chrono_t::duration>(std::chrono::milliseconds {header.timestamp})} < weekStart;
+        auto nextSequence = header.firstSequence;
+        BinaryIStream blockData {payload};
+
+        while (blockData.getPos() < payload.size()) {
+            IpcProto::message_size_t messageSize {0};
+
+            blockData >> messageSize;
+
+            // every message has got its sequence number when it was logged, the garbage ones included
+            auto sequence = nextSequence++;
+            auto messageEnd = blockData.getPos() + messageSize;
+            ClientMessageCode c {};
+
+            try {
+                c = messageBuilder.build(blockData);
+            } catch (const MessageBuilder::message_code_unrecognized&) {
+                // the client sent garbage back then, it has been answered already
+                blockData.setPos(messageEnd);
+
+                continue;
+            } catch (const BinaryIStream::storage_underflow&) {
+                blockData.setPos(messageEnd);
+
+                continue;
+            }
+
+            blockData.setPos(messageEnd);
+
+            /*
+             *  Only the registrations, renames and deals are replayed, the way the dispatcher would have buffered them.
+             *  The connections belong to the client session which is gone, and the messages about unknown users
+             *  have been answered with errors at the time. Neither are the messages the snapshot already reflects
+             */
+
+            id_t userId {UserDataConstants::invalidId};
+
+            switch (c) {
+            case ClientMessageCode::USER_REGISTERED: userId = b.userRegisteredMsg.id(); break;
+            case ClientMessageCode::USER_RENAMED: userId = b.userRenamedMsg.id(); break;
+            case ClientMessageCode::USER_DEAL_WON: userId = b.userDealWonMsg.id(); break;
+            default: continue;
+            }
+
+            auto shardIndex = static_cast<unsigned int>(userId) % incomingData.size();
+
+            if (sequence <= appliedSequences[shardIndex]) {
+                continue;
+            }
+
+            IncomingDataRing& ring = incomingData[shardIndex];
+            IncomingDataBuffer& buffer = ring.buffers[ring.writerEpoch % IncomingDataRing::size];
+
+            buffer.lastSequence = sequence;
+            ++stats.messages;
+
+            switch (c) {
+            case ClientMessageCode::USER_REGISTERED:
+                registeredIds.insert(userId);
+#ifdef PASS_NAMES_AROUND
+                buffer.usersRegistered.emplace(userId, b.userRegisteredMsg.name());
+#else
+                buffer.usersRegistered.insert(userId);
+#endif
+                break;
+            case ClientMessageCode::USER_RENAMED:
+#ifdef PASS_NAMES_AROUND
+                if (registeredIds.contains(userId)) {
+                    buffer.usersRenamed[userId] = b.userRenamedMsg.name();
+                }
+#endif
+                break;
+            case ClientMessageCode::USER_DEAL_WON:
+                if (!registeredIds.contains(userId)) {
+                    break;
+                }
+
+                if (outdated) {
+                    ++stats.outdatedDeals;
+                } else {
+                    buffer.dealsWon[userId] += b.userDealWonMsg.amount();
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        m_lastSequence = nextSequence - 1;
+
+        addBlockPosition(BlockPosition {header.firstSequence, validLength});
+
+        ++stats.blocks;
+        validLength += sizeof(header) + header.length;
+    }
+
+    std::fclose(file);
+
+    // the snapshot might be ahead of the log, if the service has crashed before the latest blocks were committed
+    m_lastSequence = std::max(m_lastSequence, *std::max_element(appliedSequences.begin(), appliedSequences.end()));
+    m_committedLength = validLength;
+    stats.bytesSkipped = startOffset;
+
+    if (fileLength > validLength) {
+        // whatever follows the last good block can't be trusted, the new blocks must not go after it
+        std::filesystem::resize_file(m_config.path, validLength);
+
+        stats.bytesDiscarded = fileLength - validLength;
+    }
+
+    return stats;
+}
+
+// --------------------------------------------------------------------- //
+
+void EventLog::start () {
+    m_file = std::fopen(m_config.path.c_str(), "ab");
+
+    if (!m_file) {
+        throw std::runtime_error {"can't open the event log " + m_config.path};
+    }
+
+    m_writerHandle = std::async(std::launch::async, &EventLog::doWork, this);
+}
+
+// --------------------------------------------------------------------- //
+
+uint64_t EventLog::resumeOffset (sequence_t appliedSequence) {
+    std::lock_guard lg(m_lock);
+
+    // a block is only skipped once the next one starts no further than the first message not applied
+    while (m_blockPositions.size() > 1 && m_blockPositions[1].firstSequence <= appliedSequence + 1) {
+        m_blockPositions.pop_front();
+    }
+
+    // with no blocks committed since, the replay starts with the one to come
+    return m_blockPositions.empty() ? m_committedLength : m_blockPositions.front().offset;
+}
+
+// --------------------------------------------------------------------- //
+
+void EventLog::discardApplied (sequence_t appliedSequence) {
+    std::lock_guard lg(m_lock);
+
+    // the writer takes it along with the batches, at the next commit interval
+    m_discardSequence = appliedSequence;
+    m_discardPending = true;
+}
+
+// --------------------------------------------------------------------- //
+
+sequence_t EventLog::append (const buffer_t& messageData) {
+    auto messageSize = static_cast<IpcProto::message_size_t>(messageData.size());
+    auto batchPos = m_batch.size();
+    auto sequence = ++m_lastSequence;
+
+    if (m_batch.empty()) {
+        m_batchFirstSequence = sequence;
+    }
+
+    m_batch.resize(batchPos + sizeof(messageSize) + messageData.size());
+    memcpy(m_batch.data() + batchPos, &messageSize, sizeof(messageSize));
+    memcpy(m_batch.data() + batchPos + sizeof(messageSize), messageData.data(), messageData.size());
+
+    if (m_batch.size() >= logBatchThreshold) {
+        flush();
+    }
+
+    return sequence;
+}
+
+// --------------------------------------------------------------------- //
+
+void EventLog::flush () {
+    if (m_batch.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard lg(m_lock);
+
+        m_pendingBatches.push_back(LogBatch {std::move(m_batch), m_batchFirstSequence});
+
+        if (!m_spareBatches.empty()) {
+            m_batch = std::move(m_spareBatches.back());
+            m_spareBatches.pop_back();
+        }
+    }
+
+    // the writer isn't notified: it takes whatever has piled up once per commit interval
+    m_batch.clear();
+}
+
+// --------------------------------------------------------------------- //
+
+void EventLog::doWork () {
+    std::vector<LogBatch> batches;
+
+    try {
+        std::unique_lock<std::mutex> lock(m_lock);
+        auto nextCommit = std::chrono::steady_clock::now() + m_config.commitInterval;
+
+        for (;;) {
+            auto stopping = m_stopTrigger.wait_until(lock, nextCommit, [this]()->bool{ return m_stopping; });
+
+            batches.swap(m_pendingBatches);
+            lock.unlock();
+
+            if (!batches.empty()) {
+                commit(batches);
+            }
+
+            for (auto& batch : batches) {
+                batch.data.clear();
+            }
+
+            lock.lock();
+
+            for (auto& batch : batches) {
+                m_spareBatches.push_back(std::move(batch.data));
+            }
+
+            batches.clear();
+
+            if (stopping) {
+                break;
+            }
+
+            if (m_discardPending) {
+                auto appliedSequence = m_discardSequence;
+
+                m_discardPending = false;
+                lock.unlock();
+
+                compact(appliedSequence);
+
+                lock.lock();
+            }
+
+            nextCommit = std::chrono::steady_clock::now() + m_config.commitInterval;
+        }
+    } catch (...) {
+        // the service can't keep its durability promise anymore
+        m_stopSignals.signalError();
+
+        throw;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void EventLog::commit (const std::vector<LogBatch>& batches) {
+    auto timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(DateTime::now().time_since_epoch());
+    auto offset = m_committedLength; // only this thread changes it once started
+
+    for (const auto& batch : batches) {
+        LogBlockHeader header;
+
+        header.length = static_cast<uint32_t>(batch.data.size());
+        header.timestamp = timestamp.count();
+        header.firstSequence = batch.firstSequence;
+        header.checksum = blockChecksum(batch.data);
+
+        if (std::fwrite(&header, sizeof(header), 1, m_file) != 1 ||
+            std::fwrite(batch.data.data(), 1, batch.data.size(), m_file) != batch.data.size()) {
+            throw std::runtime_error {"event log write failed"};
+        }
+    }
+
+    // a single sync for all the blocks of the interval
+    if (syncFile(m_file) != 0) {
+        throw std::runtime_error {"event log sync failed"};
+    }
+
+    // a snapshot may only point at the blocks already on the disk
+    std::lock_guard lg(m_lock);
+
+    for (const auto& batch : batches) {
+        addBlockPosition(BlockPosition {batch.firstSequence, offset});
+
+        offset += sizeof(LogBlockHeader) + batch.data.size();
+    }
+
+    m_committedLength = offset;
+}
+
+// --------------------------------------------------------------------- //
+
+bool EventLog::compact (sequence_t appliedSequence) {
+    uint64_t cutOffset {0};
+    auto committedLength = m_committedLength; // only this thread changes it
+
+    {
+        std::lock_guard lg(m_lock);
+
+        // the last block starting no further than the first message not applied; the positions before it may
+        // have been forgotten for a later snapshot already, and then it's not known where to cut
+        if (m_blockPositions.empty()) {
+            cutOffset = committedLength;
+        } else if (m_blockPositions.front().firstSequence <= appliedSequence + 1) {
+            for (const auto& position : m_blockPositions) {
+                if (position.firstSequence > appliedSequence + 1) {
+                    break;
+                }
+
+                cutOffset = position.offset;
+            }
+        }
+    }
+
+    if (!cutOffset) {
+        return false;
+    }
+
+    // the blocks to keep are copied into a new file which then replaces the log, so a crash leaves either one whole
+    auto tempPath = m_config.path + ".tmp";
+
+    if (!copyTail(cutOffset, committedLength, tempPath)) {
+        // the log is still whole, it just stays longer than it has to
+        std::cerr << "Event log compaction failed: can't copy the log to " << tempPath << std::endl;
+
+        return false;
+    }
+
+    // the log can't be replaced while it's open on some platforms
+    std::fclose(m_file);
+
+    std::error_code renameError;
+
+    std::filesystem::rename(tempPath, m_config.path, renameError);
+
+    m_file = std::fopen(m_config.path.c_str(), "ab");
+
+    // the blocks to come are only durable if they go to the file the log is going to be found in
+    if (!m_file) {
+        throw std::runtime_error {"can't reopen the event log " + m_config.path};
+    }
+
+    if (renameError) {
+        std::cerr << "Event log compaction failed: " << renameError.message() << std::endl;
+
+        return false;
+    }
+
+    if (syncDirectory(m_config.path) != 0) {
+        throw std::runtime_error {"event log sync failed"};
+    }
+
+    std::lock_guard lg(m_lock);
+
+    while (!m_blockPositions.empty() && m_blockPositions.front().offset < cutOffset) {
+        m_blockPositions.pop_front();
+    }
+
+    for (auto& position : m_blockPositions) {
+        position.offset -= cutOffset;
+    }
+
+    m_committedLength = committedLength - cutOffset;
+
+    return true;
+}
+
+// --------------------------------------------------------------------- //
+
+bool EventLog::copyTail (uint64_t fromOffset, uint64_t toOffset, const std::string& path) const {
+    FilePtr source {std::fopen(m_config.path.c_str(), "rb"), &std::fclose};
+    FilePtr target {std::fopen(path.c_str(), "wb"), &std::fclose};
+    buffer_t chunk(compactionChunkSize);
+
+    if (!source || !target || seekFile(source.get(), fromOffset) != 0) {
+        return false;
+    }
+
+    for (auto bytesLeft = toOffset - fromOffset; bytesLeft; ) {
+        auto chunkSize = static_cast<size_t>(std::min<uint64_t>(bytesLeft, chunk.size()));
+
+        if (std::fread(chunk.data(), 1, chunkSize, source.get()) != chunkSize ||
+            std::fwrite(chunk.data(), 1, chunkSize, target.get()) != chunkSize) {
+            return false;
+        }
+
+        bytesLeft -= chunkSize;
+    }
+
+    return syncFile(target.get()) == 0;
+}
+
+// --------------------------------------------------------------------- //
+
+void EventLog::addBlockPosition (const BlockPosition& position) {
+    if (m_blockPositions.size() == blockPositionLimit) {
+        // nobody takes the snapshots, or they fail: every other block is forgotten, so the offsets
+        // the snapshots get are only less precise, never past a message they don't reflect
+        for (size_t i = 1; 2 * i < m_blockPositions.size(); ++i) {
+            m_blockPositions[i] = m_blockPositions[2 * i];
+        }
+
+        m_blockPositions.resize((m_blockPositions.size() + 1) / 2);
+    }
+
+    m_blockPositions.push_back(position);
+}
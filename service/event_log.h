@@ -0,0 +1,131 @@
+#ifndef IQOPTIONTESTTASK_EVENT_LOG_H
+#define IQOPTIONTESTTASK_EVENT_LOG_H
+
+#include <cstdio>
+#include <future>
+#include <vector>
+#include <deque>
+
+#include "core_data.h"
+
+class RegisteredIdSet;
+
+// --------------------------------------------------------------------- //
+/*
+ *  EventLog class
+ *
+ *  a file of all the messages the listener has received, appended to in blocks
+ *  by a dedicated thread. The listener only copies the messages into its batch,
+ *  the writer thread takes the batches once per commit interval and syncs them to the disk
+ *  all together, so the durability costs the hot path nothing but a memcpy.
+ *
+ *  On start the log is replayed into the ingest shard buffers, and the first recalculation
+ *  rebuilds the whole rating out of them in one go. The log keeps track of where its blocks are,
+ *  so a snapshot can tell the replay which part of the file it may skip without reading.
+ *  Once a snapshot is on the disk, the writer thread cuts off the blocks it reflects,
+ *  so the log only ever holds what came after the latest snapshot
+ */
+// --------------------------------------------------------------------- //
+
+class EventLog {
+public:
+
+    struct ReplayStatistics {
+        unsigned long long blocks {0};
+        unsigned long long messages {0};
+        unsigned long long outdatedDeals {0};
+        unsigned long long bytesDiscarded {0};
+        unsigned long long bytesSkipped {0}; // the part of the log the snapshot already reflects
+    };
+
+public:
+
+    EventLog (const EventLogConfig& config, SystemStopSignals& stopSignals);
+    ~EventLog ();
+
+    EventLog (const EventLog&) = delete;
+    EventLog& operator= (const EventLog&) = delete;
+
+    // must be done before the start, while nobody writes into the shard buffers yet;
+    // the messages each shard has already applied according to the snapshot are skipped,
+    // and the replay starts at the offset the snapshot has got from resumeOffset
+    ReplayStatistics replay (IncomingDataShards& incomingData, RegisteredIdSet& registeredIds,
+                             const std::vector<sequence_t>& appliedSequences, uint64_t startOffset);
+
+    void start ();
+
+    // the offset of the first committed block that may hold a message past the sequence;
+    // the sequences asked for must never go down, the blocks before the offset are forgotten
+    uint64_t resumeOffset (sequence_t appliedSequence);
+
+    // a snapshot reflecting all the messages up to the sequence is on the disk, so the blocks before
+    // the first one that may hold a message past it are no longer needed; they are cut off in the background
+    void discardApplied (sequence_t appliedSequence);
+
+    // listener thread methods
+
+    // returns the sequence number the message is logged under
+    sequence_t append (const buffer_t& messageData);
+    void flush ();
+
+private:
+
+    // the messages of a batch are numbered in a row
+    struct LogBatch {
+        buffer_t data;
+        sequence_t firstSequence {0};
+    };
+
+    struct BlockPosition {
+        sequence_t firstSequence {0};
+        uint64_t offset {0};
+    };
+
+private:
+
+    void doWork ();
+
+    void commit (const std::vector<LogBatch>& batches);
+
+    // rewrites the log without the blocks the sequence makes unnecessary, false if it's left as it was;
+    // throws only if the log can't be written to anymore
+    bool compact (sequence_t appliedSequence);
+
+    // copies the committed part of the log from the offset on into a new file, which gets synced
+    bool copyTail (uint64_t fromOffset, uint64_t toOffset, const std::string& path) const;
+
+    void addBlockPosition (const BlockPosition& position);
+
+private:
+
+    const EventLogConfig m_config;
+    SystemStopSignals& m_stopSignals;
+
+    std::FILE* m_file {nullptr};
+
+    sequence_t m_lastSequence {0}; // only touched by the listener, once the replay is over
+
+    // the batch being filled by the listener thread
+    buffer_t m_batch;
+    sequence_t m_batchFirstSequence {0};
+
+    // listener thread -> writer thread handoff, guarded by the lock
+    std::vector<LogBatch> m_pendingBatches;
+    std::vector<buffer_t> m_spareBatches;
+    bool m_stopping {false};
+
+    // snapshot -> writer thread handoff, guarded by the lock too
+    sequence_t m_discardSequence {0};
+    bool m_discardPending {false};
+
+    // writer thread -> snapshot handoff, guarded by the lock as well
+    std::deque<BlockPosition> m_blockPositions;
+    uint64_t m_committedLength {0};
+
+    std::mutex m_lock;
+    std::condition_variable m_stopTrigger;
+
+    std::future<void> m_writerHandle;
+};
+
+#endif //IQOPTIONTESTTASK_EVENT_LOG_H
@@ -0,0 +1,262 @@
+#include <iostream>
+#include <cstring>
+
+#include "ingest_pool.h"
+#include "job_queue.h"
+#include "message_builder.h"
+#include "message_dispatcher.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr buffer_t::size_type batchFlushThreshold {64 * 1024};
+static constexpr std::chrono::milliseconds shardIdleTimeout {100}; // only matters for noticing the stop signals
+
+/*
+ *  Batches are the raw messages as they came from the transport, each one prefixed
+ *  with its size. The listener fills them and hands them over to the shard thread,
+ *  which sends the spent ones back for reuse, so no allocations happen in the long run.
+ *
+ *  The handoff is guarded by the lock of the shard's incoming data ring, so the shard thread
+ *  sleeps on a single condition variable and wakes up both for new batches and for new epochs
+ */
+
+struct IngestShard {
+    IngestShard (IncomingDataRing& data, JobQueue& queue, const CoarseClock& clock,
+                 RegisteredIdSet& registeredIds, RatingStampTable& ratingStamps, RatingStreamer& streamer, TopRatingFeed& topFeed)
+    : incomingData {data}
+    , messageBuilder {messageBattery}
+    , messageDispatcher {queue, data.buffers[data.writerEpoch % IncomingDataRing::size], clock, registeredIds, ratingStamps,
+                         streamer, topFeed} {}
+
+    IncomingDataRing& incomingData;
+
+    MessageBattery messageBattery;
+    MessageBuilder messageBuilder;
+    MessageDispatcher messageDispatcher;
+
+    // the batch being filled by the listener thread
+    buffer_t batch;
+    sequence_t batchLastSequence {0};
+
+    // listener thread -> shard thread handoff, guarded by the ring lock
+    std::vector<buffer_t> pendingBatches;
+    std::vector<buffer_t> spareBatches;
+    sequence_t pendingLastSequence {0};
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  IngestPool methods
+ */
+// --------------------------------------------------------------------- //
+
+IngestPool::IngestPool (IncomingDataShards& incomingData, JobQueue& queue, const CoarseClock& clock,
+                        RegisteredIdSet& registeredIds, RatingStampTable& ratingStamps, RatingStreamer& streamer,
+                        TopRatingFeed& topFeed, SystemStopSignals& stopSignals)
+: m_stopSignals {stopSignals} {
+    m_shards.reserve(incomingData.size());
+
+    for (auto& shardData : incomingData) {
+        m_shards.push_back(std::make_unique<IngestShard>(shardData, queue, clock, registeredIds, ratingStamps, streamer, topFeed));
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+IngestPool::~IngestPool () {
+    for (auto& shardHandle : m_shardHandles) {
+        try {
+            if (shardHandle.valid()) {
+                shardHandle.get();
+            }
+        } catch (const MessageBuilder::message_code_unrecognized& e) {
+            std::cerr << "Ingest pool exception: unrecognized message code " << static_cast<int>(e.code()) << std::endl;
+        } catch (const BinaryIStream::storage_underflow&) {
+            std::cerr << "Ingest pool exception: malformed message" << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "Ingest pool exception: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Ingest pool exception: unknown exception" << std::endl;
+        }
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void IngestPool::start () {
+    m_shardHandles.reserve(m_shards.size());
+
+    for (auto& shard : m_shards) {
+        m_shardHandles.push_back(std::async(std::launch::async, &IngestPool::doWork, this, std::ref(*shard)));
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void IngestPool::route (BinaryIStream& message, sequence_t sequence) {
+    IpcProto::message_code_t messageCode {IpcProto::ProtocolConstants::invalidMessageCode};
+    id_t userId {UserDataConstants::invalidId};
+
+    // every client message carries the user id right after the message code (the snapshot streams and the top subscriptions have their own ids there)
+    message >> messageCode >> userId;
+
+    IngestShard& shard = *m_shards[static_cast<unsigned int>(userId) % m_shards.size()];
+    const buffer_t& messageData = message.storage();
+    auto messageSize = static_cast<IpcProto::message_size_t>(messageData.size());
+    auto batchPos = shard.batch.size();
+
+    shard.batch.resize(batchPos + sizeof(messageSize) + messageData.size());
+    memcpy(shard.batch.data() + batchPos, &messageSize, sizeof(messageSize));
+    memcpy(shard.batch.data() + batchPos + sizeof(messageSize), messageData.data(), messageData.size());
+    shard.batchLastSequence = sequence;
+
+    if (shard.batch.size() >= batchFlushThreshold) {
+        flushShard(shard);
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void IngestPool::flush () {
+    for (auto& shard : m_shards) {
+        flushShard(*shard);
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void IngestPool::flushShard (IngestShard& shard) {
+    if (shard.batch.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard lg(shard.incomingData.lock);
+
+        shard.pendingBatches.push_back(std::move(shard.batch));
+        shard.pendingLastSequence = shard.batchLastSequence;
+
+        if (!shard.spareBatches.empty()) {
+            shard.batch = std::move(shard.spareBatches.back());
+            shard.spareBatches.pop_back();
+        }
+    }
+
+    shard.batch.clear();
+    shard.incomingData.writerTrigger.notify_one();
+}
+
+// --------------------------------------------------------------------- //
+
+void IngestPool::doWork (IngestShard& shard) {
+    IncomingDataRing& ring = shard.incomingData;
+    std::vector<buffer_t> batches;
+    sequence_t lastSequence {0};
+
+    try {
+        while (!m_stopSignals.badFlag.load(std::memory_order_relaxed)) {
+            auto epochSwitched {false};
+
+            {
+                std::unique_lock<std::mutex> lock(ring.lock);
+
+                ring.writerTrigger.wait_for(lock, shardIdleTimeout, [&shard, &ring]()->bool{
+                    return !shard.pendingBatches.empty() || ring.publishedEpoch != ring.writerEpoch;
+                });
+
+                batches.swap(shard.pendingBatches);
+                lastSequence = shard.pendingLastSequence;
+
+                if (ring.publishedEpoch != ring.writerEpoch) {
+                    // everything written into the old buffer is visible to the recalculator once it takes the lock
+                    ring.writerEpoch = ring.publishedEpoch;
+                    shard.messageDispatcher.setBuffer(ring.buffers[ring.writerEpoch % IncomingDataRing::size]);
+
+                    epochSwitched = true;
+                }
+            }
+
+            if (epochSwitched) {
+                ring.epochAcknowledged.notify_one();
+            }
+
+            if (batches.empty()) {
+                continue;
+            }
+
+            auto messageCount {0u};
+
+            for (auto& batch : batches) {
+                messageCount += dispatchBatch(shard, batch);
+                batch.clear();
+            }
+
+            ring.messagesBuffered.fetch_add(messageCount, std::memory_order_relaxed);
+
+            // the recalculator reads it under the lock once the epoch is over, along with the rest of the buffer
+            ring.buffers[ring.writerEpoch % IncomingDataRing::size].lastSequence = lastSequence;
+
+            {
+                std::lock_guard lg(ring.lock);
+
+                for (auto& batch : batches) {
+                    shard.spareBatches.push_back(std::move(batch));
+                }
+            }
+
+            batches.clear();
+        }
+    } catch (...) {
+        m_stopSignals.signalError();
+
+        throw;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+unsigned int IngestPool::dispatchBatch (IngestShard& shard, buffer_t& batch) {
+    using ClientMessageCode = IpcProto::ProtocolConstants::ClientMessageCode;
+
+    MessageBattery& b = shard.messageBattery;
+    MessageDispatcher& md = shard.messageDispatcher;
+    BinaryIStream batchData {batch};
+    auto messageCount {0u};
+
+    while (batchData.getPos() < batch.size()) {
+        IpcProto::message_size_t messageSize {0};
+
+        batchData >> messageSize;
+
+        auto messageEnd = batchData.getPos() + messageSize;
+        ClientMessageCode c = shard.messageBuilder.build(batchData);
+
+        if (batchData.getPos() > messageEnd) {
+            // the message turned out to be shorter than its fields
+            throw BinaryIStream::storage_underflow {};
+        }
+
+        batchData.setPos(messageEnd);
+
+        switch (c) {
+        case ClientMessageCode::USER_REGISTERED: md.dispatch(b.userRegisteredMsg); break;
+        case ClientMessageCode::USER_RENAMED: md.dispatch(b.userRenamedMsg); break;
+        case ClientMessageCode::USER_CONNECTED: md.dispatch(b.userConnectedMsg); break;
+        case ClientMessageCode::USER_DISCONNECTED: md.dispatch(b.userDisconnectedMsg); break;
+        case ClientMessageCode::USER_DEAL_WON: md.dispatch(b.userDealWonMsg); break;
+        case ClientMessageCode::GET_RATING: md.dispatch(b.getRatingMsg); break;
+        case ClientMessageCode::GET_RATING_SNAPSHOT: md.dispatch(b.getRatingSnapshotMsg); break;
+        case ClientMessageCode::RATING_SNAPSHOT_CREDIT: md.dispatch(b.ratingSnapshotCreditMsg); break;
+        case ClientMessageCode::SUBSCRIBE_TOP: md.dispatch(b.subscribeTopMsg); break;
+        default: assert(false);
+        }
+
+        ++messageCount;
+    }
+
+    return messageCount;
+}
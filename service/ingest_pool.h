@@ -0,0 +1,59 @@
+#ifndef IQOPTIONTESTTASK_INGEST_POOL_H
+#define IQOPTIONTESTTASK_INGEST_POOL_H
+
+#include <future>
+#include <vector>
+#include <memory>
+
+#include "core_data.h"
+
+class JobQueue;
+class CoarseClock;
+class RegisteredIdSet;
+class RatingStampTable;
+class RatingStreamer;
+class TopRatingFeed;
+struct IngestShard;
+
+// --------------------------------------------------------------------- //
+/*
+ *  IngestPool class
+ *
+ *  spreads the decoding and buffering of the incoming messages over several shard threads.
+ *  The listener thread only routes the raw messages by their user id, so all the messages
+ *  concerning a particular user are handled by the same shard in the order they came in,
+ *  and every shard fills its own incoming data double buffer
+ */
+// --------------------------------------------------------------------- //
+
+class IngestPool {
+public:
+
+    IngestPool (IncomingDataShards& incomingData, JobQueue& queue, const CoarseClock& clock,
+                RegisteredIdSet& registeredIds, RatingStampTable& ratingStamps, RatingStreamer& streamer,
+                TopRatingFeed& topFeed, SystemStopSignals& stopSignals);
+    ~IngestPool ();
+
+    void start ();
+
+    // listener thread methods
+
+    void route (BinaryIStream& message, sequence_t sequence);
+    void flush ();
+
+private:
+
+    void doWork (IngestShard& shard);
+
+    unsigned int dispatchBatch (IngestShard& shard, buffer_t& batch);
+    void flushShard (IngestShard& shard);
+
+private:
+
+    SystemStopSignals& m_stopSignals;
+
+    std::vector<std::unique_ptr<IngestShard>> m_shards;
+    std::vector<std::future<void>> m_shardHandles;
+};
+
+#endif //IQOPTIONTESTTASK_INGEST_POOL_H
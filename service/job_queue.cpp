@@ -1,67 +1,195 @@
 #include <atomic>
 #include <memory>
 #include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
 #include "job_queue.h"
 #include "core_data.h"
 
 // --------------------------------------------------------------------- //
 /*
- *  MPSCQueue class
+ *  BoundedQueue class
  *
- *  Non-intrusive MPSC queue based on DV-MPSC algorithm, as per https://int08h.com/post/ode-to-a-vyukov-queue/
+ *  Preallocated bounded MPMC queue based on D. Vyukov's array-based algorithm,
+ *  as per http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *
+ *  Each cell carries a sequence number telling whether it's ready to be written or read,
+ *  so producers and consumers only contend on their own position counters (which live on separate
+ *  cache lines) and no allocations take place after construction. A full queue rejects the push
+ *  instead of growing, it's up to the calling party to decide what to do about that
  */
 // --------------------------------------------------------------------- //
 
-template <typename T>
-class MPSCQueue {
+static constexpr size_t cacheLineSize {64};
 
-    struct Node {
-        Node () = default;
-        Node (T&& v) : value{std::move(v)} {}
+template <typename T>
+class BoundedQueue {
 
-        std::atomic<Node*> next;
+    struct Cell {
+        std::atomic<size_t> sequence;
         T value;
     };
 
 public:
 
-    MPSCQueue () : stub{new Node()}, head{stub}, tail{stub} {
-        stub->next.store(nullptr);
+    BoundedQueue (size_t capacity) : m_mask{roundUpCapacity(capacity) - 1}, m_cells{new Cell[m_mask + 1]} {
+        for (size_t i = 0; i <= m_mask; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
     }
-    ~MPSCQueue () {
-        T dummy;
 
-        while (tryPop(dummy));
-    }
+    bool tryPush (T&& newVal) {
+        Cell* cell {nullptr};
+        size_t pos {m_enqueuePos.load(std::memory_order_relaxed)};
+
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+
+            auto seq = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // the cell still holds the value from the previous lap, the queue is full
+                return false;
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
 
-    void push (T&& newVal) {
-        Node* newNode {new Node{std::move(newVal)}};
+        cell->value = std::move(newVal);
+        cell->sequence.store(pos + 1, std::memory_order_release);
 
-        newNode->next.store(nullptr, std::memory_order_relaxed);
-        Node* prev = tail.exchange(newNode, std::memory_order_acq_rel);
-        prev->next.store(newNode, std::memory_order_release);
+        return true;
     }
 
     bool tryPop (T& val) {
-        Node* head_copy {head.load(std::memory_order_relaxed)};
-        Node* next = head_copy->next.load(std::memory_order_acquire);
+        Cell* cell {nullptr};
+        size_t pos {m_dequeuePos.load(std::memory_order_relaxed)};
+
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+
+            auto seq = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+            if (diff == 0) {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // the cell hasn't been written yet, the queue is empty
+                return false;
+            } else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        val = std::move(cell->value);
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
 
-        if (next != nullptr) {
-            head.store(next, std::memory_order_relaxed);
-            val = std::move(next->value);
-            delete head_copy;
+        return true;
+    }
+
+    bool empty () const {
+        auto pos = m_dequeuePos.load(std::memory_order_relaxed);
+        auto seq = m_cells[pos & m_mask].sequence.load(std::memory_order_acquire);
+
+        return static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0;
+    }
 
-            return true;
+private:
+
+    static size_t roundUpCapacity (size_t capacity) {
+        size_t roundedCapacity {2};
+
+        while (roundedCapacity < capacity) {
+            roundedCapacity <<= 1;
         }
 
-        return false;
+        return roundedCapacity;
     }
 
 private:
 
-    Node* stub;
-    std::atomic<Node*> head;
-    std::atomic<Node*> tail;
+    alignas(cacheLineSize) std::atomic<size_t> m_enqueuePos {0};
+    alignas(cacheLineSize) std::atomic<size_t> m_dequeuePos {0};
+    alignas(cacheLineSize) const size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  EventCount class
+ *
+ *  lets a consumer sleep while its queues are empty. Producers only touch the mutex
+ *  when somebody is actually waiting, so the common enqueue path stays lock-free.
+ *
+ *  The consumer announces itself with 'prepareWait', re-checks its queues and either
+ *  cancels or commits to the wait; any notification in between makes the wait a no-op
+ */
+// --------------------------------------------------------------------- //
+
+class EventCount {
+public:
+
+    using key_t = unsigned int;
+
+public:
+
+    key_t prepareWait () {
+        m_waiters.fetch_add(1, std::memory_order_relaxed);
+
+        // the waiter registration must be visible before the consumer re-checks its queues
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        return m_epoch.load(std::memory_order_relaxed);
+    }
+
+    void cancelWait () {
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void wait (key_t key, std::chrono::milliseconds timeout) {
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+
+            m_trigger.wait_for(lock, timeout, [this, key]()->bool{
+                return m_epoch.load(std::memory_order_relaxed) != key;
+            });
+        }
+
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void notify () {
+        // the freshly pushed job must be visible before we check for the waiters
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!m_waiters.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        {
+            std::lock_guard lg(m_lock);
+
+            m_epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        m_trigger.notify_all();
+    }
+
+private:
+
+    std::atomic<key_t> m_epoch {0};
+    std::atomic_int m_waiters {0};
+
+    std::mutex m_lock;
+    std::condition_variable m_trigger;
 };
 
 // --------------------------------------------------------------------- //
@@ -73,51 +201,174 @@ private:
 // --------------------------------------------------------------------- //
 
 struct QueuePack {
-    MPSCQueue<ErrorPtr> errorQueue;
-    MPSCQueue<UserIdPromise> userIdPromiseQueue;
-    MPSCQueue<const FullUserData*> userDataQueue;
+    QueuePack (size_t capacity)
+    : errorQueue {capacity}, ratingRequestQueue {capacity}, ratingChunkQueue {capacity} {}
+
+    bool empty () const {
+        return errorQueue.empty() && ratingRequestQueue.empty() && ratingChunkQueue.empty();
+    }
+
+    BoundedQueue<ProtocolErrorRecord> errorQueue;
+    BoundedQueue<RatingRequest> ratingRequestQueue;
+    BoundedQueue<RatingChunk> ratingChunkQueue;
+
+    EventCount jobsAvailable;
 };
 
 class JobQueue::Impl {
 public:
 
-    Impl (size_t concurrencyFactor)
-    : m_queues(concurrencyFactor){
+    Impl (size_t concurrencyFactor, size_t queueCapacity) {
+        m_queues.reserve(concurrencyFactor);
+
+        for (size_t i = 0; i < concurrencyFactor; ++i) {
+            m_queues.push_back(std::make_unique<QueuePack>(queueCapacity));
+        }
+    }
+
+    bool enqueueErrorJob (ProtocolErrorRecord error) {
+        static thread_local size_t currentQueueIndex {0};
+
+        return enqueue(currentQueueIndex, &QueuePack::errorQueue, std::move(error));
     }
 
-    void enqueueErrorJob (ErrorPtr&& error) {
-        static thread_local int currentQueueIndex {0};
+    bool enqueueRatingJob (RatingRequest request) {
+        static thread_local size_t currentQueueIndex {0};
 
-        m_queues[currentQueueIndex++].errorQueue.push(std::move(error));
+        request.enqueuedAt = std::chrono::steady_clock::now();
 
-        if (currentQueueIndex == m_queues.size()) { currentQueueIndex = 0; }
+        return enqueue(currentQueueIndex, &QueuePack::ratingRequestQueue, std::move(request));
     }
 
-    void enqueueRatingJob (UserIdPromise userIdPromise) {
-        static thread_local int currentQueueIndex {0};
+    /*
+     *  The whole range goes into a single pack, keeping it together for one worker to process,
+     *  while the idle workers are woken up to steal chunks from it. If the pack fills up, the rest
+     *  of the range spills over to the next packs
+     */
 
-        m_queues[currentQueueIndex++].userIdPromiseQueue.push(std::move(userIdPromise));
+    size_t enqueueRatingChunks (const FullUserData* const* users, size_t count) {
+        static thread_local size_t currentQueueIndex {0};
 
-        if (currentQueueIndex == m_queues.size()) { currentQueueIndex = 0; }
+        size_t enqueuedCount {0};
+        auto enqueuedAt = std::chrono::steady_clock::now();
+
+        for (size_t attempt = 0; attempt < m_queues.size() && enqueuedCount < count; ++attempt) {
+            // the index belongs to the thread rather than to this queue, so it may be out of its range
+            QueuePack& pack = *m_queues[currentQueueIndex++ % m_queues.size()];
+
+            if (currentQueueIndex >= m_queues.size()) { currentQueueIndex = 0; }
+
+            while (enqueuedCount < count) {
+                RatingChunk chunk {users + enqueuedCount,
+                                   static_cast<unsigned int>(std::min<size_t>(JobQueue::ratingChunkSize, count - enqueuedCount)),
+                                   enqueuedAt};
+                auto chunkSize = chunk.count;
+
+                if (!pack.ratingChunkQueue.tryPush(std::move(chunk))) {
+                    break;
+                }
+
+                enqueuedCount += chunkSize;
+            }
+        }
+
+        if (enqueuedCount) {
+            wakeConsumers();
+        }
+
+        if (enqueuedCount < count) {
+            // not lost, the caller hands the rest over again once the workers have made room
+            auto deferredChunks = (count - enqueuedCount + JobQueue::ratingChunkSize - 1) / JobQueue::ratingChunkSize;
+
+            m_deferredJobs.fetch_add(deferredChunks, std::memory_order_relaxed);
+        }
+
+        return enqueuedCount;
     }
 
-    void enqueueRatingJob (const FullUserData* userData) {
-        static thread_local int currentQueueIndex {0};
+    RatingChunk stealRatingChunk (int thiefIndex) {
+        RatingChunk chunk {};
 
-        m_queues[currentQueueIndex++].userDataQueue.push(std::move(userData));
+        for (size_t offset = 1; offset < m_queues.size(); ++offset) {
+            QueuePack& victim = *m_queues[(thiefIndex + offset) % m_queues.size()];
 
-        if (currentQueueIndex == m_queues.size()) { currentQueueIndex = 0; }
+            if (victim.ratingChunkQueue.tryPop(chunk)) {
+                break;
+            }
+        }
+
+        return chunk;
+    }
+
+    bool stealableJobsPending (int thiefIndex) const {
+        for (size_t offset = 1; offset < m_queues.size(); ++offset) {
+            if (!m_queues[(thiefIndex + offset) % m_queues.size()]->ratingChunkQueue.empty()) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    size_t rejectedJobCount () const {
+        return m_rejectedJobs.load(std::memory_order_relaxed);
+    }
+
+    size_t deferredJobCount () const {
+        return m_deferredJobs.load(std::memory_order_relaxed);
+    }
+
+    LaneMetrics& laneMetrics (JobLane lane) {
+        return m_laneMetrics[static_cast<int>(lane)];
+    }
+
+    void wakeConsumers () {
+        for (auto& pack : m_queues) {
+            pack->jobsAvailable.notify();
+        }
     }
 
     QueuePack& getQueuePack (int packIndex) {
         assert(packIndex >= 0 && packIndex < m_queues.size());
 
-        return m_queues[packIndex];
+        return *m_queues[packIndex];
     }
 
 private:
 
-    std::vector<QueuePack> m_queues;
+    /*
+     *  The jobs are spread round robin, and if the chosen pack's queue happens to be full,
+     *  the other packs are tried before giving up. A rejected job is counted and left
+     *  for the calling party to deal with
+     */
+
+    template <typename T>
+    bool enqueue (size_t& currentQueueIndex, BoundedQueue<T> QueuePack::* queue, T&& job) {
+        for (size_t attempt = 0; attempt < m_queues.size(); ++attempt) {
+            // the index belongs to the thread rather than to this queue, so it may be out of its range
+            QueuePack& pack = *m_queues[currentQueueIndex++ % m_queues.size()];
+
+            if (currentQueueIndex >= m_queues.size()) { currentQueueIndex = 0; }
+
+            if ((pack.*queue).tryPush(std::move(job))) {
+                pack.jobsAvailable.notify();
+
+                return true;
+            }
+        }
+
+        m_rejectedJobs.fetch_add(1, std::memory_order_relaxed);
+
+        return false;
+    }
+
+private:
+
+    std::vector<std::unique_ptr<QueuePack>> m_queues;
+    std::atomic<size_t> m_rejectedJobs {0};
+    std::atomic<size_t> m_deferredJobs {0};
+
+    std::array<LaneMetrics, static_cast<int>(JobLane::Count)> m_laneMetrics;
 };
 
 // --------------------------------------------------------------------- //
@@ -126,31 +377,55 @@ private:
  */
 // --------------------------------------------------------------------- //
 
-JobQueue::QueueConsumer::QueueConsumer (QueuePack& queuePack)
-    : m_queuePack{queuePack} {}
+JobQueue::QueueConsumer::QueueConsumer (JobQueue::Impl& queueImpl, int packIndex)
+    : m_queueImpl{queueImpl}, m_packIndex{packIndex}, m_queuePack{queueImpl.getQueuePack(packIndex)} {}
 
-ErrorPtr JobQueue::QueueConsumer::dequeueError () {
-    ErrorPtr errorJob {};
+ProtocolErrorRecord JobQueue::QueueConsumer::dequeueError () {
+    ProtocolErrorRecord errorJob {};
 
     m_queuePack.errorQueue.tryPop(errorJob);
 
     return errorJob;
 }
 
-UserIdPromise JobQueue::QueueConsumer::dequeueUserIdPromise () {
-    UserIdPromise userId {UserDataConstants::invalidRating, false};
+RatingRequest JobQueue::QueueConsumer::dequeueRatingRequest () {
+    RatingRequest request {};
+
+    m_queuePack.ratingRequestQueue.tryPop(request);
+
+    return request;
+}
+
+RatingChunk JobQueue::QueueConsumer::dequeueRatingChunk () {
+    RatingChunk chunk {};
+
+    m_queuePack.ratingChunkQueue.tryPop(chunk);
+
+    return chunk;
+}
+
+RatingChunk JobQueue::QueueConsumer::stealRatingChunk () {
+    return m_queueImpl.stealRatingChunk(m_packIndex);
+}
 
-    m_queuePack.userIdPromiseQueue.tryPop(userId);
+void JobQueue::QueueConsumer::recordWait (JobLane lane, steady_t enqueuedAt) {
+    m_queueImpl.laneMetrics(lane).record(enqueuedAt);
+}
 
-    return userId;
+bool JobQueue::QueueConsumer::jobsPending () const {
+    return !m_queuePack.empty() || m_queueImpl.stealableJobsPending(m_packIndex);
 }
 
-const FullUserData* JobQueue::QueueConsumer::dequeueUserData () {
-    const FullUserData* userData {nullptr};
+JobQueue::QueueConsumer::wait_key_t JobQueue::QueueConsumer::prepareWait () {
+    return m_queuePack.jobsAvailable.prepareWait();
+}
 
-    m_queuePack.userDataQueue.tryPop(userData);
+void JobQueue::QueueConsumer::cancelWait () {
+    m_queuePack.jobsAvailable.cancelWait();
+}
 
-    return userData;
+void JobQueue::QueueConsumer::wait (wait_key_t key, std::chrono::milliseconds timeout) {
+    m_queuePack.jobsAvailable.wait(key, timeout);
 }
 
 // --------------------------------------------------------------------- //
@@ -159,27 +434,43 @@ const FullUserData* JobQueue::QueueConsumer::dequeueUserData () {
  */
 // --------------------------------------------------------------------- //
 
-JobQueue::JobQueue (int concurrencyFactor)
-    : m_concurrencyFactor{concurrencyFactor}, m_impl{std::make_unique<JobQueue::Impl>(concurrencyFactor)} {}
+JobQueue::JobQueue (int concurrencyFactor, size_t queueCapacity)
+    : m_concurrencyFactor{concurrencyFactor}, m_impl{std::make_unique<JobQueue::Impl>(concurrencyFactor, queueCapacity)} {}
 
 JobQueue::~JobQueue () {
     // this is required to compile JobQueue with a member of incomplete type
 }
 
-void JobQueue::enqueueErrorJob (ErrorPtr &&error) {
-    m_impl->enqueueErrorJob(std::move(error));
+bool JobQueue::enqueueErrorJob (ProtocolErrorRecord error) {
+    return m_impl->enqueueErrorJob(error);
+}
+
+bool JobQueue::enqueueRatingJob (RatingRequest request) {
+    return m_impl->enqueueRatingJob(request);
+}
+
+size_t JobQueue::enqueueRatingChunks (const FullUserData* const* users, size_t count) {
+    return m_impl->enqueueRatingChunks(users, count);
+}
+
+size_t JobQueue::rejectedJobCount () const {
+    return m_impl->rejectedJobCount();
+}
+
+size_t JobQueue::deferredJobCount () const {
+    return m_impl->deferredJobCount();
 }
 
-void JobQueue::enqueueRatingJob (UserIdPromise userIdPromise) {
-    m_impl->enqueueRatingJob(userIdPromise);
+LaneMetrics::Statistics JobQueue::laneStatistics (JobLane lane) const {
+    return m_impl->laneMetrics(lane).statistics();
 }
 
-void JobQueue::enqueueRatingJob (const FullUserData *userData) {
-    m_impl->enqueueRatingJob(userData);
+void JobQueue::wakeConsumers () {
+    m_impl->wakeConsumers();
 }
 
 JobQueue::QueueConsumer JobQueue::getConsumer (int concurrencyIndex) {
     assert(concurrencyIndex >= 0 && concurrencyIndex < m_concurrencyFactor);
 
-    return QueueConsumer(m_impl->getQueuePack(concurrencyIndex));
+    return QueueConsumer(*m_impl, concurrencyIndex);
 }
\ No newline at end of file
@@ -4,10 +4,13 @@
 #include <memory>
 #include <variant>
 #include <cassert>
+#include <chrono>
+#include <array>
 
 #include "core_data.h"
+#include "../utils/clock_source.h"
 
-using ErrorPtr = std::unique_ptr<IpcProto::GenericProtocolError>;
+using IpcProto::ProtocolErrorRecord;
 
 // --------------------------------------------------------------------- //
 /*
@@ -16,7 +19,83 @@ using ErrorPtr = std::unique_ptr<IpcProto::GenericProtocolError>;
 // --------------------------------------------------------------------- //
 
 struct QueuePack;
-using UserIdPromise = std::pair<id_t, bool>;
+
+// the dimensions a rating query has asked for, already clamped to the protocol limits
+struct RatingQueryDimensions {
+    IpcProto::request_id_t requestId {0};
+    IpcProto::rating_dimension_t topPositions {0};
+    IpcProto::rating_dimension_t positionsBefore {0};
+    IpcProto::rating_dimension_t positionsAfter {0};
+};
+
+// a connect-triggered rating job or an explicit rating query, the user might have registered too recently to make it into the rating yet
+struct RatingRequest {
+    id_t userId {UserDataConstants::invalidId};
+    bool registeredLately {false};
+    bool isQuery {false};
+    RatingQueryDimensions query {};
+    steady_t enqueuedAt {};
+};
+
+// a slice of a contiguous array of users to announce the rating to, the array must outlive the job
+struct RatingChunk {
+    const FullUserData* const* users {nullptr};
+    unsigned int count {0};
+    steady_t enqueuedAt {};
+};
+
+/*
+ *  The rating jobs go in two lanes: the interactive one for the connect-triggered jobs and the periodic one
+ *  for the announcements. The consumers serve the interactive lane first, but never more than a bounded
+ *  number of its jobs in a row, so neither lane may starve the other
+ */
+
+enum class JobLane : int {
+    Interactive = 0,
+    Periodic,
+
+    Count
+};
+
+// the time the jobs of a lane spend waiting in the queues
+class LaneMetrics {
+public:
+
+    struct Statistics {
+        unsigned long long jobs {0};
+        std::chrono::nanoseconds totalWait {0};
+        std::chrono::nanoseconds maxWait {0};
+    };
+
+public:
+
+    void record (steady_t enqueuedAt) {
+        auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - enqueuedAt);
+        auto waitCount = wait.count();
+        auto maxWait = m_maxWait.load(std::memory_order_relaxed);
+
+        m_jobs.fetch_add(1, std::memory_order_relaxed);
+        m_totalWait.fetch_add(waitCount, std::memory_order_relaxed);
+
+        while (waitCount > maxWait && !m_maxWait.compare_exchange_weak(maxWait, waitCount, std::memory_order_relaxed)) {}
+    }
+
+    Statistics statistics () const {
+        Statistics stats;
+
+        stats.jobs = m_jobs.load(std::memory_order_relaxed);
+        stats.totalWait = std::chrono::nanoseconds {m_totalWait.load(std::memory_order_relaxed)};
+        stats.maxWait = std::chrono::nanoseconds {m_maxWait.load(std::memory_order_relaxed)};
+
+        return stats;
+    }
+
+private:
+
+    std::atomic<unsigned long long> m_jobs {0};
+    std::atomic<long long> m_totalWait {0};
+    std::atomic<long long> m_maxWait {0};
+};
 
 class JobQueue {
 
@@ -28,36 +107,70 @@ public:
 
         friend class JobQueue;
 
+    public:
+
+        using wait_key_t = unsigned int;
+
     public:
 
         QueueConsumer (const QueueConsumer&) = delete;
         QueueConsumer (QueueConsumer&&) = default;
 
-        ErrorPtr dequeueError ();
-        UserIdPromise dequeueUserIdPromise ();
-        const FullUserData* dequeueUserData ();
+        ProtocolErrorRecord dequeueError ();
+        RatingRequest dequeueRatingRequest ();
+        RatingChunk dequeueRatingChunk ();
+
+        // takes a rating chunk from some other consumer's queue
+        RatingChunk stealRatingChunk ();
+
+        void recordWait (JobLane lane, steady_t enqueuedAt);
+
+        // parking: announce the wait, re-check everything that might need attention, then cancel or commit
+
+        bool jobsPending () const;
+        wait_key_t prepareWait ();
+        void cancelWait ();
+        void wait (wait_key_t key, std::chrono::milliseconds timeout);
 
     private:
 
-        QueueConsumer (QueuePack& queuePack);
+        QueueConsumer (Impl& queueImpl, int packIndex);
 
     private:
 
+        Impl& m_queueImpl;
+        int m_packIndex;
         QueuePack& m_queuePack;
     };
 
 public:
 
-    JobQueue (int concurrencyFactor);
+    static constexpr unsigned int ratingChunkSize {256};
+
+public:
+
+    JobQueue (int concurrencyFactor, size_t queueCapacity);
     ~JobQueue ();
 
     int concurrencyFactor () const { return m_concurrencyFactor; }
 
     // push methods
+    // the queues are bounded, a job is rejected (and 'false' returned) when every queue of its kind is full
+
+    bool enqueueErrorJob (ProtocolErrorRecord error);
+    bool enqueueRatingJob (RatingRequest request);
+
+    // hands over a contiguous range of users split into chunks, returns how many users were accepted;
+    // the chunks left over are counted as deferred rather than rejected, the caller is to retry them
+    size_t enqueueRatingChunks (const FullUserData* const* users, size_t count);
+
+    // the jobs dropped for good, and the rating chunks that had to wait for room
+    size_t rejectedJobCount () const;
+    size_t deferredJobCount () const;
+    LaneMetrics::Statistics laneStatistics (JobLane lane) const;
 
-    void enqueueErrorJob (ErrorPtr&& error);
-    void enqueueRatingJob (UserIdPromise userIdPromise);
-    void enqueueRatingJob (const FullUserData* userData);
+    // wakes up all the parked consumers, e.g. to let them notice a data refresh
+    void wakeConsumers ();
 
     // pop methods
 
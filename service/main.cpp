@@ -1,11 +1,25 @@
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <memory>
 
 #include "overseer.h"
+#include "../utils/date_time.h"
+
+static constexpr const char* usage {"Usage: <program name> <port number to listen> [--period <ms>] [--slot <ms>] "
+                                    "[--recalc-interval <ms>] [--recalc-threshold <messages>] "
+                                    "[--sim-speedup <factor>] [--sim-start <unix time>] "
+                                    "[--event-log <file>] [--commit-interval <ms>] "
+                                    "[--snapshot <file>] [--snapshot-every <periods>] "
+                                    "[--export <file>] [--export-interval <ms>] "
+                                    "[--replica <shm name>] [--replica-capacity <users>] "
+                                    "[--subscriber-port <port>] [--subscriber-buffer <bytes>] "
+                                    "[--outbound-buffer <bytes>] [--outbound-timeout <ms>] "
+                                    "[--stats-interval <ms>]"};
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cout << "Usage: <program name> <port number to listen>" << std::endl;
+    if (argc < 2 || argc % 2 != 0) {
+        std::cout << usage << std::endl;
 
         return 0;
     }
@@ -14,21 +28,123 @@ int main(int argc, char *argv[]) {
     std::istringstream iss {argv[1]};
 
     if (!(iss >> portNumber)) {
-        std::cout << "Usage: <program name> <port number to listen>" << std::endl << "port must be numeric" << std::endl;
+        std::cout << usage << std::endl << "port must be numeric" << std::endl;
 
         return 0;
     }
 
     if (portNumber < 0 || portNumber > USHRT_MAX) {
-        std::cout << "Usage: <program name> <port number to listen>" << std::endl
+        std::cout << usage << std::endl
                   << "port must be between 0 and " << USHRT_MAX << std::endl;
 
         return 0;
     }
 
-    Overseer os;
+    // one minute of one-second slots and a recalculation per minute by default
+    Overseer::OverseerConfig config;
+    AnnouncementSchedule& schedule = config.schedule;
+
+    // simulated time, for running through the weekly cycles faster than they really pass
+    long long simulationSpeedup = 0;
+    chrono_t simulationStart = std::chrono::system_clock::now();
+
+    for (int i = 2; i < argc; i += 2) {
+        std::string option {argv[i]};
+
+        if (option == "--event-log") {
+            config.eventLog.path = argv[i + 1];
+
+            continue;
+        }
+
+        if (option == "--snapshot") {
+            config.snapshot.path = argv[i + 1];
+
+            continue;
+        }
+
+        if (option == "--export") {
+            config.exporting.path = argv[i + 1];
+
+            continue;
+        }
+
+        if (option == "--replica") {
+            config.replica.name = argv[i + 1];
+
+            continue;
+        }
+
+        std::istringstream valueStream {argv[i + 1]};
+        long long value = 0;
+
+        if (!(valueStream >> value) || value <= 0 || value > UINT_MAX) {
+            std::cout << usage << std::endl << option << " must be a positive number" << std::endl;
+
+            return 0;
+        }
+
+        if (option == "--period") {
+            schedule.period = std::chrono::milliseconds {value};
+        } else if (option == "--slot") {
+            schedule.slot = std::chrono::milliseconds {value};
+        } else if (option == "--recalc-interval") {
+            config.recalculation.interval = std::chrono::milliseconds {value};
+        } else if (option == "--recalc-threshold") {
+            config.recalculation.pendingMessageThreshold = static_cast<unsigned int>(value);
+        } else if (option == "--sim-speedup") {
+            simulationSpeedup = value;
+        } else if (option == "--sim-start") {
+            simulationStart = chrono_t {std::chrono::duration_cast<chrono_t::duration>(std::chrono::seconds {value})};
+        } else if (option == "--commit-interval") {
+            config.eventLog.commitInterval = std::chrono::milliseconds {value};
+        } else if (option == "--snapshot-every") {
+            config.snapshot.periodsBetween = static_cast<unsigned int>(value);
+        } else if (option == "--export-interval") {
+            config.exporting.interval = std::chrono::milliseconds {value};
+        } else if (option == "--replica-capacity") {
+            config.replica.capacity = static_cast<unsigned int>(value);
+        } else if (option == "--subscriber-port" && value <= USHRT_MAX) {
+            config.subscribers.port = static_cast<unsigned short>(value);
+        } else if (option == "--subscriber-port") {
+            std::cout << usage << std::endl
+                      << "port must be between 0 and " << USHRT_MAX << std::endl;
+
+            return 0;
+        } else if (option == "--subscriber-buffer") {
+            config.subscribers.bufferSize = static_cast<size_t>(value);
+        } else if (option == "--outbound-buffer") {
+            config.outbound.bufferSize = static_cast<size_t>(value);
+        } else if (option == "--outbound-timeout") {
+            config.outbound.maxBlockTime = std::chrono::milliseconds {value};
+        } else if (option == "--stats-interval") {
+            config.statistics.interval = std::chrono::milliseconds {value};
+        } else {
+            std::cout << usage << std::endl << "unknown option " << option << std::endl;
+
+            return 0;
+        }
+    }
+
+    if (schedule.period % schedule.slot != std::chrono::milliseconds::zero()
+        || schedule.period / schedule.slot >= UserDataConstants::invalidSlot) {
+        std::cout << usage << std::endl
+                  << "period must be a multiple of the slot and consist of less than "
+                  << UserDataConstants::invalidSlot << " slots" << std::endl;
+
+        return 0;
+    }
+
+    std::unique_ptr<SimulatedClockSource> simulatedClock;
+
+    if (simulationSpeedup) {
+        simulatedClock = std::make_unique<SimulatedClockSource>(simulationStart, static_cast<double>(simulationSpeedup));
+        DateTime::setClockSource(simulatedClock.get());
+    }
+
+    Overseer os {config};
 
     os.run(static_cast<unsigned short>(portNumber));
 
     return 0;
-}
\ No newline at end of file
+}
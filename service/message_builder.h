@@ -2,7 +2,7 @@
 #define IQOPTIONTESTTASK_MESSAGE_BUILDER_H
 
 #include "../ipc/protocol.h"
-#include "../ipc/transport.h"
+#include "../utils/binary_storage.h"
 
 struct MessageBattery {
     IpcProto::UserRegisteredMsg userRegisteredMsg;
@@ -10,13 +10,17 @@ struct MessageBattery {
     IpcProto::UserConnectedMsg userConnectedMsg;
     IpcProto::UserDisconnectedMsg userDisconnectedMsg;
     IpcProto::UserDealWonMsg userDealWonMsg;
+    IpcProto::GetRatingMsg getRatingMsg;
+    IpcProto::GetRatingSnapshotMsg getRatingSnapshotMsg;
+    IpcProto::RatingSnapshotCreditMsg ratingSnapshotCreditMsg;
+    IpcProto::SubscribeTopMsg subscribeTopMsg;
 };
 
 // --------------------------------------------------------------------- //
 /*
  *  MessageBuilder class
  *
- *  reads the data as it comes from the transport layer, interprets it and initializes
+ *  interprets a single message read from the transport layer and initializes
  *  the corresponding message object in the battery provided during construction
  *
  *  reason behind such approach is to reuse the message objects and minimize allocations
@@ -45,11 +49,9 @@ public:
 
 public:
 
-    MessageBuilder (MessageBattery& battery, ServerIpcTransport& transport)
-    : m_battery {battery}, m_transport {transport} {}
+    MessageBuilder (MessageBattery& battery) : m_battery {battery} {}
 
-    ClientMessageCode build () {
-        BinaryIStream messageData = m_transport.receive(m_bufferStorage);
+    ClientMessageCode build (BinaryIStream& messageData) {
         IpcProto::message_code_t messageCode {IpcProto::ProtocolConstants::invalidMessageCode};
 
         messageData >> messageCode;
@@ -62,6 +64,10 @@ public:
         case ClientMessageCode::USER_CONNECTED : m_battery.userConnectedMsg.init(messageData); break;
         case ClientMessageCode::USER_DISCONNECTED : m_battery.userDisconnectedMsg.init(messageData); break;
         case ClientMessageCode::USER_DEAL_WON : m_battery.userDealWonMsg.init(messageData); break;
+        case ClientMessageCode::GET_RATING : m_battery.getRatingMsg.init(messageData); break;
+        case ClientMessageCode::GET_RATING_SNAPSHOT : m_battery.getRatingSnapshotMsg.init(messageData); break;
+        case ClientMessageCode::RATING_SNAPSHOT_CREDIT : m_battery.ratingSnapshotCreditMsg.init(messageData); break;
+        case ClientMessageCode::SUBSCRIBE_TOP : m_battery.subscribeTopMsg.init(messageData); break;
         default: throw message_code_unrecognized{messageCode};
         }
 
@@ -71,8 +77,6 @@ public:
 private:
 
     MessageBattery& m_battery;
-    ServerIpcTransport& m_transport;
-    buffer_t m_bufferStorage;
 };
 
 
@@ -1,14 +1,35 @@
 #include "message_dispatcher.h"
 #include "core_data.h"
 #include "job_queue.h"
+#include "registered_ids.h"
+#include "rating_streamer.h"
+#include "top_rating_feed.h"
 
-#include "../utils/date_time.h"
+#include "../utils/coarse_clock.h"
 
-MessageDispatcher::MessageDispatcher (JobQueue& queue, IncomingDataBuffer& buffer): m_queue(queue), m_buffer(&buffer) {}
+MessageDispatcher::MessageDispatcher (JobQueue& queue, IncomingDataBuffer& buffer, const CoarseClock& clock,
+                                      RegisteredIdSet& registeredIds, RatingStampTable& ratingStamps, RatingStreamer& streamer,
+                                      TopRatingFeed& topFeed)
+: m_queue(queue), m_buffer(&buffer), m_clock(clock), m_registeredIds(registeredIds), m_ratingStamps(ratingStamps)
+, m_streamer(streamer), m_topFeed(topFeed) {}
 
 void MessageDispatcher::setBuffer (IncomingDataBuffer& buffer) { m_buffer = &buffer; }
 
+bool MessageDispatcher::acceptUser (id_t userId) {
+    if (m_registeredIds.contains(userId)) {
+        return true;
+    }
+
+    // the messages about unknown users never reach the buffers, the error report is best effort as usual
+    m_queue.enqueueErrorJob(ProtocolErrorRecord::userUnrecognized(userId));
+
+    return false;
+}
+
 void MessageDispatcher::dispatch (const IpcProto::UserRegisteredMsg &msg) {
+    // all the messages of a user are dispatched by the same shard, so they see the id right away
+    m_registeredIds.insert(msg.id());
+
 #ifdef PASS_NAMES_AROUND
     m_buffer->usersRegistered.emplace(msg.id(), msg.name());
 #else
@@ -18,19 +39,88 @@ void MessageDispatcher::dispatch (const IpcProto::UserRegisteredMsg &msg) {
 
 void MessageDispatcher::dispatch (const IpcProto::UserRenamedMsg &msg) {
 #ifdef PASS_NAMES_AROUND
-    m_buffer->usersRenamed.emplace(msg.id(), msg.name());
+    if (acceptUser(msg.id())) {
+        m_buffer->usersRenamed.emplace(msg.id(), msg.name());
+    }
 #endif
 }
 
 void MessageDispatcher::dispatch (const IpcProto::UserConnectedMsg &msg) {
-    m_buffer->connectionChanges[msg.id()] = DateTime::currentSecondIndex();
-    m_queue.enqueueRatingJob(std::make_pair(msg.id(), (m_buffer->usersRegistered.find(msg.id()) != m_buffer->usersRegistered.end())));
+    if (!acceptUser(msg.id())) {
+        return;
+    }
+
+    m_buffer->connectionChanges[msg.id()] = static_cast<connect_time_t>(m_clock.slotIndex());
+
+    auto tick = m_clock.tickCount();
+
+    // a user reconnecting over and over within a tick only gets the rating once
+    if (!m_ratingStamps.claim(msg.id(), tick)) {
+        return;
+    }
+
+    // if the queues are overloaded the job is rejected, which is fine: the user gets the periodic rating anyway,
+    // as long as the claim doesn't hold it back
+    if (!m_queue.enqueueRatingJob({msg.id(), m_buffer->usersRegistered.find(msg.id()) != m_buffer->usersRegistered.end()})) {
+        m_ratingStamps.release(msg.id(), tick);
+    }
 }
 
 void MessageDispatcher::dispatch (const IpcProto::UserDisconnectedMsg &msg) {
-    m_buffer->connectionChanges[msg.id()] = UserDataConstants::invalidSecond;
+    if (!acceptUser(msg.id())) {
+        return;
+    }
+
+    m_buffer->connectionChanges[msg.id()] = UserDataConstants::invalidSlot;
 }
 
 void MessageDispatcher::dispatch (const IpcProto::UserDealWonMsg &msg) {
+    if (!acceptUser(msg.id())) {
+        return;
+    }
+
     m_buffer->dealsWon[msg.id()] += msg.amount();
+}
+
+void MessageDispatcher::dispatch (const IpcProto::GetRatingMsg &msg) {
+    using Limits = IpcProto::ProtocolConstants::RatingQueryLimits;
+
+    // a query leaves the user alone: no connection change, no rating stamp, and even the unknown users get an answer
+    RatingRequest request {msg.id(), m_registeredIds.contains(msg.id())};
+
+    request.query.requestId = msg.requestId();
+    request.query.topPositions = std::min<IpcProto::rating_dimension_t>(msg.topPositions(), Limits::maxTopPositions);
+    request.query.positionsBefore = std::min<IpcProto::rating_dimension_t>(msg.positionsBefore(), Limits::maxCompetitionDistance);
+    request.query.positionsAfter = std::min<IpcProto::rating_dimension_t>(msg.positionsAfter(), Limits::maxCompetitionDistance);
+    request.isQuery = true;
+
+    // the queries share the interactive lane with the connects, and get rejected the same way when it's overloaded;
+    // nothing else would ever answer a query though, so the client is told to retry it
+    if (!m_queue.enqueueRatingJob(request)) {
+        m_queue.enqueueErrorJob(ProtocolErrorRecord::ratingQueryRejected(msg.id(), msg.requestId()));
+    }
+}
+
+void MessageDispatcher::dispatch (const IpcProto::GetRatingSnapshotMsg &msg) {
+    using Limits = IpcProto::ProtocolConstants::SnapshotStreamLimits;
+
+    RatingStreamer::StreamRequest request;
+
+    request.requestId = msg.requestId();
+    request.positionsPerFrame = std::clamp(msg.positionsPerFrame(), 1u, Limits::maxPositionsPerFrame);
+    request.credits = std::min(static_cast<unsigned int>(msg.credits()), Limits::maxCredits);
+    request.encoding = msg.encoding() == IpcProto::ProtocolConstants::SnapshotEncoding::DELTA_VARINT
+                       ? msg.encoding() : IpcProto::ProtocolConstants::SnapshotEncoding::PLAIN;
+
+    m_streamer.requestStream(request);
+}
+
+void MessageDispatcher::dispatch (const IpcProto::RatingSnapshotCreditMsg &msg) {
+    m_streamer.grantCredits(msg.requestId(), msg.credits());
+}
+
+void MessageDispatcher::dispatch (const IpcProto::SubscribeTopMsg &msg) {
+    using Limits = IpcProto::ProtocolConstants::TopFeedLimits;
+
+    m_topFeed.subscribe(msg.subscriptionId(), std::min(msg.topPositions(), Limits::maxTopPositions));
 }
\ No newline at end of file
@@ -1,21 +1,34 @@
 #ifndef IQOPTIONTESTTASK_MESSAGE_DISPATCHER_H
 #define IQOPTIONTESTTASK_MESSAGE_DISPATCHER_H
 
+#include "core_data.h"
+
 namespace IpcProto {
     class UserRegisteredMsg;
     class UserRenamedMsg;
     class UserConnectedMsg;
     class UserDisconnectedMsg;
     class UserDealWonMsg;
+    class GetRatingMsg;
+    class GetRatingSnapshotMsg;
+    class RatingSnapshotCreditMsg;
+    class SubscribeTopMsg;
 }
 
 struct IncomingDataBuffer;
 struct JobQueue;
+class CoarseClock;
+class RegisteredIdSet;
+class RatingStampTable;
+class RatingStreamer;
+class TopRatingFeed;
 
 class MessageDispatcher {
 public:
 
-    MessageDispatcher (JobQueue& queue, IncomingDataBuffer& buffer);
+    MessageDispatcher (JobQueue& queue, IncomingDataBuffer& buffer, const CoarseClock& clock,
+                       RegisteredIdSet& registeredIds, RatingStampTable& ratingStamps, RatingStreamer& streamer,
+                       TopRatingFeed& topFeed);
 
     void setBuffer (IncomingDataBuffer& buffer);
 
@@ -24,11 +37,24 @@ public:
     void dispatch (const IpcProto::UserConnectedMsg& msg);
     void dispatch (const IpcProto::UserDisconnectedMsg& msg);
     void dispatch (const IpcProto::UserDealWonMsg& msg);
+    void dispatch (const IpcProto::GetRatingMsg& msg);
+    void dispatch (const IpcProto::GetRatingSnapshotMsg& msg);
+    void dispatch (const IpcProto::RatingSnapshotCreditMsg& msg);
+    void dispatch (const IpcProto::SubscribeTopMsg& msg);
+
+private:
+
+    bool acceptUser (id_t userId);
 
 private:
 
     JobQueue& m_queue;
     IncomingDataBuffer* m_buffer;
+    const CoarseClock& m_clock;
+    RegisteredIdSet& m_registeredIds;
+    RatingStampTable& m_ratingStamps;
+    RatingStreamer& m_streamer;
+    TopRatingFeed& m_topFeed;
 };
 
 #endif //IQOPTIONTESTTASK_MESSAGE_DISPATCHER_H
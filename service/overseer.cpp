@@ -2,11 +2,20 @@
 #include "overseer.h"
 
 #include "../ipc/transport.h"
-#include "message_builder.h"
+#include "../utils/coarse_clock.h"
 #include "job_queue.h"
-#include "message_dispatcher.h"
+#include "event_log.h"
+#include "ingest_pool.h"
 #include "rating_announcer.h"
 #include "rating_calculator.h"
+#include "rating_snapshot.h"
+#include "snapshot_writer.h"
+#include "rating_exporter.h"
+#include "rating_streamer.h"
+#include "top_rating_feed.h"
+#include "replica_publisher.h"
+#include "subscriber_hub.h"
+#include "statistics_reporter.h"
 #include "worker_pool.h"
 
 // --------------------------------------------------------------------- //
@@ -16,34 +25,53 @@
 // --------------------------------------------------------------------- //
 
 static constexpr int workerPoolConcurrency {2};
+static constexpr int ingestShardCount {2};
+static constexpr size_t jobQueueCapacity {1 << 16}; // per queue of every worker
 
 struct PluggableInfrastructure {
-    PluggableInfrastructure (CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, IterationData& iterationData);
+    PluggableInfrastructure (CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, IterationData& iterationData,
+                             RegisteredIdSet& registeredIds, SubscriberHub& subscriberHub, EventLog* eventLog,
+                             const Overseer::OverseerConfig& config);
 
     // order of fields matters, the ones below often depend on the ones above
 
     ServerIpcTransport transport;
     JobQueue jobQueue;
+    CoarseClock clock;
+    RatingStampTable ratingStamps;
 
-    MessageBattery messageBattery;
-    MessageBuilder messageBuilder;
-    IncomingDataDoubleBuffer incomingData;
-    MessageDispatcher messageDispatcher;
+    IncomingDataShards incomingData;
 
+    SnapshotWriter snapshotWriter; // must go before the announcer, which hands the snapshots over to it
     RatingAnnouncer ratingAnnouncer;
+    RatingStreamer ratingStreamer; // must go before the ingest pool, the shards hand the stream requests over to it
+    TopRatingFeed topRatingFeed; // same as the streamer
+    IngestPool ingestPool; // must go after the announcer, it has to stop writing before the recalculator stops
     WorkerPool workerPool;
+    RatingExporter ratingExporter;
+    ReplicaPublisher replicaPublisher;
+    StatisticsReporter statisticsReporter;
 };
 
 PluggableInfrastructure::PluggableInfrastructure (CoreRatingData& coreData, CoreDataSyncBlock& syncBlock,
-                                                  IterationData& iterationData)
-: transport(std::make_unique<Spinlock>())
-, jobQueue {workerPoolConcurrency}
-, messageBuilder {messageBattery, transport}
-, messageDispatcher {jobQueue, incomingData.buffers[incomingData.currentBufferIndex]}
-, ratingAnnouncer {iterationData, jobQueue,
-                   std::make_unique<RatingCalculator>(coreData, syncBlock, iterationData, incomingData, jobQueue),
+                                                  IterationData& iterationData, RegisteredIdSet& registeredIds,
+                                                  SubscriberHub& subscriberHub, EventLog* eventLog,
+                                                  const Overseer::OverseerConfig& config)
+: transport(std::make_unique<Spinlock>(), config.outbound)
+, jobQueue {workerPoolConcurrency, jobQueueCapacity}
+, clock {config.schedule.period, config.schedule.slot}
+, incomingData(ingestShardCount)
+, snapshotWriter {coreData, syncBlock, config.snapshot, eventLog}
+, ratingAnnouncer {iterationData, config.schedule, config.recalculation, config.snapshot, snapshotWriter, clock, jobQueue,
+                   std::make_unique<RatingCalculator>(coreData, syncBlock, iterationData, incomingData, jobQueue, eventLog),
                    syncBlock.stopSignals, coreData.expirationDate}
-, workerPool {coreData, syncBlock, transport} {
+, ratingStreamer {coreData, syncBlock, transport}
+, topRatingFeed {coreData, syncBlock, transport}
+, ingestPool {incomingData, jobQueue, clock, registeredIds, ratingStamps, ratingStreamer, topRatingFeed, syncBlock.stopSignals}
+, workerPool {coreData, syncBlock, clock, ratingStamps, transport, subscriberHub}
+, ratingExporter {coreData, syncBlock, config.exporting}
+, replicaPublisher {coreData, syncBlock, config.replica}
+, statisticsReporter {transport, jobQueue, subscriberHub, config.statistics} {
     // whew, that was a long initialization list...
     // the complexity is to ensure that each object has access only to the data it actually requires - and nothing more
 }
@@ -54,77 +82,89 @@ PluggableInfrastructure::PluggableInfrastructure (CoreRatingData& coreData, Core
  */
 // --------------------------------------------------------------------- //
 
-Overseer::Overseer () {}
+Overseer::Overseer (const OverseerConfig& config)
+: m_config {config}, m_iterationData {config.schedule.slotCount()}
+, m_subscriberHub {std::make_unique<SubscriberHub>(config.subscribers)} {
+    if (!m_config.eventLog.path.empty()) {
+        m_eventLog = std::make_unique<EventLog>(m_config.eventLog, m_syncBlock.stopSignals);
+    }
+}
+
 Overseer::~Overseer () {}
 
 void Overseer::run (unsigned short portNumberToBindTo) {
-    using ClientMessageCode = IpcProto::ProtocolConstants::ClientMessageCode;
+    auto historyRestored {false};
 
-    for (;;) {
-        IncomingDataBuffer* inData {nullptr};
+    // the subscribers may connect before the ingest client does, they just get nothing meanwhile
+    m_subscriberHub->start();
 
+    for (;;) {
         try {
             // initializing the service internal modules
-            m_pluggable = std::make_unique<PluggableInfrastructure>(m_coreData, m_syncBlock, m_iterationData);
+            m_pluggable = std::make_unique<PluggableInfrastructure>(m_coreData, m_syncBlock, m_iterationData,
+                                                                     m_registeredIds, *m_subscriberHub, m_eventLog.get(), m_config);
+
+            if (!historyRestored) {
+                // the history goes into the fresh shard buffers, so the very first recalculation picks it up
+                restoreHistory();
+
+                historyRestored = true;
+            }
 
             // launching the transport system
             // if that succeeds, we're having a working protocol-level connection to (some) client
             m_pluggable->transport.launch(portNumberToBindTo);
 
-            // claiming the current incoming data buffer as in use
-            inData = m_pluggable->incomingData.currentBuffer.load(std::memory_order_relaxed);
-            inData->bufferWriterCount.fetch_add(1, std::memory_order_relaxed);
-
             // launching the async processing
+            // ingest shards go first since they claim their incoming data buffers on start
+            m_pluggable->ingestPool.start();
+            m_pluggable->snapshotWriter.start();
             m_pluggable->ratingAnnouncer.start();
+            m_pluggable->ratingStreamer.start();
+            m_pluggable->topRatingFeed.start();
             m_pluggable->workerPool.start(m_pluggable->jobQueue);
+            m_pluggable->ratingExporter.start();
+            m_pluggable->replicaPublisher.start();
+            m_pluggable->statisticsReporter.start();
 
-            MessageBattery& b = m_pluggable->messageBattery;
-            MessageDispatcher& md = m_pluggable->messageDispatcher;
+            ServerIpcTransport& transport = m_pluggable->transport;
+            IngestPool& ingest = m_pluggable->ingestPool;
+            buffer_t messageStorage;
 
             while (!m_syncBlock.stopSignals.badFlag.load(std::memory_order_relaxed)) {
-                ClientMessageCode c = m_pluggable->messageBuilder.build();
+                BinaryIStream message = transport.receive(messageStorage);
 
-                {
-                    // release sequence end: recalculator thread -> message dispatcher thread
-                    IncomingDataBuffer* newBuffer = m_pluggable->incomingData.currentBuffer.load(std::memory_order_acquire);
+                auto sequence = m_eventLog ? m_eventLog->append(message.storage()) : sequence_t {0};
 
-                    if (newBuffer != inData) {
-                        // release sequence start: message dispatcher thread -> recalculator thread
-                        inData->bufferWriterCount.fetch_sub(1, std::memory_order_release);
-                        inData = newBuffer;
-                        inData->bufferWriterCount.fetch_add(1, std::memory_order_relaxed);
+                ingest.route(message, sequence);
 
-                        m_pluggable->messageDispatcher.setBuffer(*inData);
-                    }
-                }
+                if (!transport.dataPending()) {
+                    // the client has nothing more for us at the moment, no reason to hold the batches back
+                    ingest.flush();
 
-                switch (c) {
-                case ClientMessageCode::USER_REGISTERED: md.dispatch(b.userRegisteredMsg); break;
-                case ClientMessageCode::USER_RENAMED: md.dispatch(b.userRenamedMsg); break;
-                case ClientMessageCode::USER_CONNECTED: md.dispatch(b.userConnectedMsg); break;
-                case ClientMessageCode::USER_DISCONNECTED: md.dispatch(b.userDisconnectedMsg); break;
-                case ClientMessageCode::USER_DEAL_WON: md.dispatch(b.userDealWonMsg); break;
-                default: assert(false);
+                    if (m_eventLog) {
+                        m_eventLog->flush();
+                    }
                 }
             }
         } catch (const transport_error_recoverable& e) {
             std::cerr << "Overseer exception: recoverable transport error" << std::endl;
 
-            inData->bufferWriterCount.fetch_sub(1, std::memory_order_release);
             m_syncBlock.stopSignals.signalError(false);
         } catch (const std::exception& e) {
             std::cerr << "Overseer exception: " << e.what() << std::endl;
 
-            inData->bufferWriterCount.fetch_sub(1, std::memory_order_release);
             m_syncBlock.stopSignals.signalError();
         } catch (...) {
             std::cerr << "Unknown overseer exception" << std::endl;
 
-            inData->bufferWriterCount.fetch_sub(1, std::memory_order_release);
             m_syncBlock.stopSignals.signalError();
         }
 
+        if (m_pluggable) {
+            m_pluggable->statisticsReporter.report();
+        }
+
         // cleanup and waiting on the async tasks to stop
         m_pluggable.reset(nullptr);
 
@@ -138,3 +178,35 @@ void Overseer::run (unsigned short portNumberToBindTo) {
         m_syncBlock.stopSignals.reset();
     }
 }
+
+// --------------------------------------------------------------------- //
+
+void Overseer::restoreHistory () {
+    uint64_t logOffset {0};
+
+    if (!m_config.snapshot.path.empty()) {
+        RatingSnapshot::LoadStatistics loadStats;
+        auto loadStart = std::chrono::steady_clock::now();
+
+        if (RatingSnapshot::load(m_coreData, m_registeredIds, m_config.snapshot.path, logOffset, loadStats)) {
+            auto loadTime = std::chrono::steady_clock::now() - loadStart;
+
+            std::cerr << "Snapshot loaded: " << loadStats.users << " users, " << loadStats.ratedUsers << " rated, in "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(loadTime).count() << " ms" << std::endl;
+        } else {
+            std::cerr << "No usable snapshot found" << std::endl;
+        }
+    }
+
+    if (!m_eventLog) {
+        return;
+    }
+
+    auto replayStats = m_eventLog->replay(m_pluggable->incomingData, m_registeredIds, m_coreData.appliedSequences, logOffset);
+
+    std::cerr << "Event log replayed: " << replayStats.messages << " messages past the snapshot in " << replayStats.blocks << " blocks, "
+              << replayStats.bytesSkipped << " bytes skipped, " << replayStats.outdatedDeals << " outdated deals skipped, "
+              << replayStats.bytesDiscarded << " bytes of a torn tail discarded" << std::endl;
+
+    m_eventLog->start();
+}
@@ -2,6 +2,8 @@
 #define IQOPTIONTESTTASK_OVERSEER_H
 
 #include "core_data.h"
+#include "../ipc/outbound_queue.h"
+#include "registered_ids.h"
 
 // --------------------------------------------------------------------- //
 /*
@@ -15,21 +17,47 @@
 // --------------------------------------------------------------------- //
 
 struct PluggableInfrastructure;
+class EventLog;
+class SubscriberHub;
 
 class Overseer {
+public:
+
+    struct OverseerConfig {
+        AnnouncementSchedule schedule;
+        RecalculationPolicy recalculation;
+        EventLogConfig eventLog;
+        SnapshotPolicy snapshot;
+        ExportPolicy exporting;
+        ReplicaPolicy replica;
+        SubscriberPolicy subscribers;
+        OutboundPolicy outbound;
+        StatisticsPolicy statistics;
+    };
+
 public:
 
     // this is done to allow m_pluggable to compile with an incomplete type
-    Overseer ();
+    explicit Overseer (const OverseerConfig& config);
     ~Overseer ();
 
     void run (unsigned short portNumberToBindTo);
 
 private:
 
+    void restoreHistory ();
+
+private:
+
+    const OverseerConfig m_config;
+
     CoreRatingData m_coreData;
     CoreDataSyncBlock m_syncBlock;
     IterationData m_iterationData;
+    RegisteredIdSet m_registeredIds;
+
+    std::unique_ptr<EventLog> m_eventLog; // outlives the infrastructure restarts, the file stays the same
+    std::unique_ptr<SubscriberHub> m_subscriberHub; // same, the subscribers stay connected
 
     //std::unique_ptr<IncomingDataDoubleBuffer> m_incomingData;
 
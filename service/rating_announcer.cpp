@@ -1,15 +1,23 @@
 #include <iostream>
 #include "rating_announcer.h"
 #include "rating_calculator.h"
+#include "snapshot_writer.h"
 #include "job_queue.h"
-#include "../utils/date_time.h"
+#include "../utils/coarse_clock.h"
+
+static constexpr std::chrono::milliseconds queueBackoffInterval {1};
 
 RatingAnnouncer::RatingAnnouncer (const IterationData& userDistribution,
+                                  const AnnouncementSchedule& schedule,
+                                  const RecalculationPolicy& recalculation,
+                                  const SnapshotPolicy& snapshot,
+                                  SnapshotWriter& snapshotWriter,
+                                  const CoarseClock& clock,
                                   JobQueue& queue,
                                   RatingCalculatorPtr&& calculator,
                                   SystemStopSignals& stopSignals,
                                   chrono_t& ratingExpirationDate)
-: m_userDistribution {userDistribution} , m_queue {queue}, m_calculator {std::move(calculator)}
+: m_userDistribution {userDistribution}, m_schedule {schedule}, m_recalculation {recalculation}, m_snapshot {snapshot}, m_snapshotWriter {snapshotWriter}, m_clock {clock}, m_queue {queue}, m_calculator {std::move(calculator)}
 , m_stopSignals {stopSignals}, m_ratingExpirationDate(ratingExpirationDate) {
     assert(m_calculator);
 }
@@ -32,8 +40,10 @@ void RatingAnnouncer::start () {
 
 void RatingAnnouncer::doWork () {
     try {
+        const auto slotCount = m_schedule.slotCount();
+
         auto dropOldRating {false};
-        auto chronoSetIndex {0};
+        unsigned int slotIndex {0};
 
         {
             auto currentWeekStart = DateTime::currentWeekStart();
@@ -45,45 +55,66 @@ void RatingAnnouncer::doWork () {
                 dropOldRating = true;
             }
 
-            std::this_thread::sleep_until(DateTime::nextFullSecond());
+            DateTime::sleepUntil(DateTime::nextSlotStart(m_schedule.slot));
 
-            chronoSetIndex = DateTime::currentSecondIndex();
+            slotIndex = DateTime::currentSlotIndex(m_schedule.period, m_schedule.slot);
         }
 
         auto weekJustTurned {false};
-        auto steadyIntervalStart = std::chrono::steady_clock::now();
+        auto steadyIntervalStart = DateTime::steadyNow();
+        auto periodsSinceSnapshot {0u};
 
         for (;;) {
             m_calculator->recalculate(dropOldRating);
 
             if (dropOldRating) {
+                // the recalculation is well past the week start, so the coarse clock has caught up with it
                 dropOldRating = false;
-                m_ratingExpirationDate = DateTime::currentWeekStart();
+                m_ratingExpirationDate = m_clock.weekStart();
             }
 
-            for (; chronoSetIndex < 60 && !m_stopSignals.badFlag.load(std::memory_order_relaxed); ++chronoSetIndex) {
-                announce(m_userDistribution.usersOnline[chronoSetIndex]);
+            // a snapshot still being written puts the next one off till it's done
+            if (!m_snapshot.path.empty() && ++periodsSinceSnapshot >= m_snapshot.periodsBetween && m_snapshotWriter.ready()) {
+                // only the capture delays the first slot of the period, the file is written in the background
+                storeSnapshot();
+
+                periodsSinceSnapshot = 0;
+            }
 
-                steadyIntervalStart += std::chrono::seconds{1};
+            auto periodStartSlot = slotIndex;
+            auto nextRecalculation = steadyIntervalStart + m_recalculation.interval;
+
+            for (; slotIndex < slotCount && !m_stopSignals.badFlag.load(std::memory_order_relaxed); ++slotIndex) {
+                // the in-period recalculations never drop the rating, the week turnover is handled at the period start.
+                // While the old rating is still served, the new week deals stay pending till it's dropped
+                if (!weekJustTurned && slotIndex != periodStartSlot && recalculationDue(steadyIntervalStart, nextRecalculation)) {
+                    m_calculator->recalculate(false);
+
+                    nextRecalculation = steadyIntervalStart + m_recalculation.interval;
+                }
 
-                auto now = std::chrono::steady_clock::now();
+                announce(m_userDistribution.usersOnline[slotIndex]);
+
+                steadyIntervalStart += m_schedule.slot;
+
+                auto now = DateTime::steadyNow();
 
                 if (now < steadyIntervalStart) {
-                    std::this_thread::sleep_until(steadyIntervalStart);
+                    DateTime::sleepUntil(steadyIntervalStart);
                 }
             }
 
-            if (chronoSetIndex != 60) {
+            if (slotIndex != slotCount) {
                 // bad flag signaled
                 break;
             }
 
             /*
-             *  When week has turned, we work another minute serving old rating - because the rating we serve is always
-             *  one minute behind. Then we drop it and start anew.
+             *  When week has turned, we work another period serving old rating - because the rating we serve is always
+             *  one period behind. Then we drop it and start anew.
              *
-             *  Sleeping till next full second allows us to sync our steady ticker with the system clock, so that
-             *  we serve ratings at proper time moments. The downside is that during the first minute of the week only
+             *  Sleeping till next slot start allows us to sync our steady ticker with the system clock, so that
+             *  we serve ratings at proper time moments. The downside is that during the first period of the week only
              *  a part of the ratings might be served (but that's not a big deal since the ratings are fresh anyway)
              */
 
@@ -91,8 +122,8 @@ void RatingAnnouncer::doWork () {
                 dropOldRating = true;
                 weekJustTurned = false;
 
-                std::this_thread::sleep_until(DateTime::nextFullSecond());
-                chronoSetIndex = DateTime::currentSecondIndex();
+                DateTime::sleepUntil(DateTime::nextSlotStart(m_schedule.slot));
+                slotIndex = DateTime::currentSlotIndex(m_schedule.period, m_schedule.slot);
 
                 continue;
             }
@@ -101,7 +132,7 @@ void RatingAnnouncer::doWork () {
                 weekJustTurned = true;
             }
 
-            chronoSetIndex = 0;
+            slotIndex = 0;
         }
     } catch (...) {
         m_stopSignals.signalError();
@@ -109,7 +140,48 @@ void RatingAnnouncer::doWork () {
 }
 
 void RatingAnnouncer::announce (const ChronoSet& userBundle) {
-    for (const auto userData : userBundle) {
-        m_queue.enqueueRatingJob(userData);
+    /*
+     *  The bundle is handed over as a whole in chunks, one worker gets them and the idle ones steal from it.
+     *  The chunks point right into the bundle, which is only modified by the next recalculation,
+     *  and that one waits for all the rating jobs to be processed
+     */
+
+    const FullUserData* const* pendingJobs = userBundle.data();
+    size_t pendingCount = userBundle.size();
+
+    while (pendingCount) {
+        auto enqueuedCount = m_queue.enqueueRatingChunks(pendingJobs, pendingCount);
+
+        pendingJobs += enqueuedCount;
+        pendingCount -= enqueuedCount;
+
+        if (!pendingCount) {
+            break;
+        }
+
+        // periodic ratings are not to be lost, so when the queues are full we wait for the workers to catch up
+        if (m_stopSignals.badFlag.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        std::this_thread::sleep_for(queueBackoffInterval);
+    }
+}
+
+bool RatingAnnouncer::recalculationDue (steady_t slotStart, steady_t nextRecalculation) const {
+    if (m_recalculation.interval.count() && slotStart >= nextRecalculation) {
+        return true;
+    }
+
+    return m_recalculation.pendingMessageThreshold &&
+           m_calculator->pendingMessageCount() >= m_recalculation.pendingMessageThreshold;
+}
+
+void RatingAnnouncer::storeSnapshot () {
+    try {
+        m_snapshotWriter.submit(m_calculator->captureSnapshot());
+    } catch (const std::exception& e) {
+        // the service keeps working, the next snapshot may well succeed
+        std::cerr << "Rating snapshot failed: " << e.what() << std::endl;
     }
 }
\ No newline at end of file
@@ -6,9 +6,12 @@
 #include <future>
 
 #include "core_data.h"
+#include "../utils/clock_source.h"
 
 struct JobQueue;
 class RatingCalculator;
+class SnapshotWriter;
+class CoarseClock;
 
 using RatingCalculatorPtr = std::unique_ptr<RatingCalculator>;
 
@@ -16,6 +19,11 @@ class RatingAnnouncer {
 public:
 
     RatingAnnouncer (const IterationData& userDistribution,
+                     const AnnouncementSchedule& schedule,
+                     const RecalculationPolicy& recalculation,
+                     const SnapshotPolicy& snapshot,
+                     SnapshotWriter& snapshotWriter,
+                     const CoarseClock& clock,
                      JobQueue& queue,
                      RatingCalculatorPtr&& calculator,
                      SystemStopSignals& stopSignals,
@@ -30,9 +38,18 @@ private:
 
     void announce (const ChronoSet& userBundle);
 
+    bool recalculationDue (steady_t slotStart, steady_t nextRecalculation) const;
+
+    void storeSnapshot ();
+
 private:
 
     const IterationData& m_userDistribution;
+    const AnnouncementSchedule& m_schedule;
+    const RecalculationPolicy& m_recalculation;
+    const SnapshotPolicy& m_snapshot;
+    SnapshotWriter& m_snapshotWriter;
+    const CoarseClock& m_clock;
     JobQueue& m_queue;
     RatingCalculatorPtr m_calculator;
     SystemStopSignals& m_stopSignals;
@@ -5,6 +5,8 @@
 #include "rating_calculator.h"
 #include "core_data.h"
 #include "job_queue.h"
+#include "rating_snapshot.h"
+#include "event_log.h"
 
 // --------------------------------------------------------------------- //
 /*
@@ -37,6 +39,29 @@ struct RatingPatchEntry {
 };
 
 using RatingPatchSet = std::multiset<RatingPatchEntry>;
+using IncomingBufferList = std::vector<IncomingDataBuffer*>;
+
+static constexpr std::chrono::milliseconds ingestHandoffTimeout {50};
+
+/*
+ *  A shard writer late for a handoff leaves several buffers to be drained at once. The patches of a user
+ *  must be computed once per recalculation, so the deals and the connection changes of the later buffers
+ *  are folded into the earliest one: the deals add up, the latest connection change wins. The registrations
+ *  and the renames are applied buffer by buffer in order, which is correct as it is
+ */
+
+static void foldIncomingBuffer (IncomingDataBuffer& into, IncomingDataBuffer& from) {
+    for (const auto& connChange : from.connectionChanges) {
+        into.connectionChanges[connChange.first] = connChange.second;
+    }
+
+    for (const auto& newDeal : from.dealsWon) {
+        into.dealsWon[newDeal.first] += newDeal.second;
+    }
+
+    from.connectionChanges.clear();
+    from.dealsWon.clear();
+}
 
 // --------------------------------------------------------------------- //
 /*
@@ -47,8 +72,8 @@ using RatingPatchSet = std::multiset<RatingPatchEntry>;
 class RatingCalculatorImpl {
 public:
 
-    RatingCalculatorImpl (CoreRatingData& ud, IterationData& id, IncomingDataBuffer& ib, JobQueue& jq)
-    : m_userData(ud), m_iterationData(id), m_incomingBuffer(ib), m_jobQueue(jq) {}
+    RatingCalculatorImpl (CoreRatingData& ud, IterationData& id, const IncomingBufferList& ib, JobQueue& jq)
+    : m_userData(ud), m_iterationData(id), m_incomingBuffers(ib), m_jobQueue(jq) {}
 
     void recalculate (bool dropOldRating);
 
@@ -61,6 +86,11 @@ private:
     void processConnectionChanges ();
     void processDeals ();
 
+    void processRegistrations (IncomingDataBuffer& incomingBuffer);
+    void processRenames (IncomingDataBuffer& incomingBuffer);
+    void processConnectionChanges (IncomingDataBuffer& incomingBuffer);
+    void processDeals (IncomingDataBuffer& incomingBuffer);
+
 private:
 
     bool userExists (id_t userId) {
@@ -99,8 +129,8 @@ private:
         m_userData.rating[pos] = value;
     }
 
-    void ratingRefreshPositions () {
-        for (int pos = 0; pos < m_userData.rating.size(); ++pos) {
+    void ratingRefreshPositions (int fromPos) {
+        for (int pos = fromPos; pos < m_userData.rating.size(); ++pos) {
             m_userData.rating[pos]->rating = pos;
         }
     }
@@ -109,7 +139,7 @@ private:
 
     CoreRatingData& m_userData;
     IterationData& m_iterationData;
-    IncomingDataBuffer& m_incomingBuffer;
+    const IncomingBufferList& m_incomingBuffers; // the later buffers of a shard are folded into its earliest one
     JobQueue& m_jobQueue;
 
     RatingPatchSet m_ratingPatches;
@@ -131,6 +161,14 @@ void RatingCalculatorImpl::recalculate (bool dropOldRating) {
     int oldRatingVectorSize = static_cast<int>(m_userData.rating.size());
     auto offset = m_freshRatings;
 
+    // the patches only ever move elements towards the end, so everything above the topmost patch
+    // (and the old position of its user, if it's an old position one) stays where it was;
+    // everything below it is still moved and renumbered, so this is a pass over the tail of the rating
+    // with a small constant, not one proportional to the number of patches
+    auto refreshFrom = m_ratingPatches.empty()
+                       ? oldRatingVectorSize
+                       : std::max(0, oldRatingVectorSize - m_ratingPatches.rbegin()->elementsAfter - 1);
+
     m_userData.rating.resize(static_cast<RatingVector::size_type>(oldRatingVectorSize + offset));
 
     auto oldPositions = 0;
@@ -162,14 +200,14 @@ void RatingCalculatorImpl::recalculate (bool dropOldRating) {
         }
     }
 
-    ratingRefreshPositions();
+    ratingRefreshPositions(refreshFrom);
 }
 
 // --------------------------------------------------------------------- //
 
 void RatingCalculatorImpl::dropRating () {
-    for (const auto& activeUser : m_userData.activeUsers) {
-        m_userData.silentUsers.emplace(activeUser.first, BasicUserData(std::move(*activeUser.second.get())));
+    for (auto& activeUser : m_userData.activeUsers) {
+        m_userData.silentUsers.emplace(activeUser.first, BasicUserData(std::move(activeUser.second)));
     }
 
     m_userData.activeUsers.clear();
@@ -184,7 +222,13 @@ void RatingCalculatorImpl::dropRating () {
 // --------------------------------------------------------------------- //
 
 void RatingCalculatorImpl::processRegistrations () {
-    for (auto newReg : m_incomingBuffer.usersRegistered) {
+    for (auto incomingBuffer : m_incomingBuffers) {
+        processRegistrations(*incomingBuffer);
+    }
+}
+
+void RatingCalculatorImpl::processRegistrations (IncomingDataBuffer& incomingBuffer) {
+    for (auto newReg : incomingBuffer.usersRegistered) {
         BasicUserData newSilentUser;
         id_t userId = UserDataConstants::invalidId;
 
@@ -195,8 +239,8 @@ void RatingCalculatorImpl::processRegistrations () {
 #endif
         if (userExists(userId)) {
             // protocol error, trying to register a user already registered
-            ErrorPtr error {new IpcProto::MultipleRegistrationError {userId}};
-            m_jobQueue.enqueueErrorJob(std::move(error));
+            // error reports are best effort, if the queues are overloaded the job is simply rejected
+            m_jobQueue.enqueueErrorJob(ProtocolErrorRecord::multipleRegistration(userId));
 
             continue;
         }
@@ -207,18 +251,26 @@ void RatingCalculatorImpl::processRegistrations () {
         m_userData.silentUsers.emplace(userId, std::move(newSilentUser));
     }
 
-    m_incomingBuffer.usersRegistered.clear();
+    incomingBuffer.usersRegistered.clear();
 }
 
 // --------------------------------------------------------------------- //
 
 void RatingCalculatorImpl::processRenames () {
+    for (auto incomingBuffer : m_incomingBuffers) {
+        processRenames(*incomingBuffer);
+    }
+}
+
+void RatingCalculatorImpl::processRenames (IncomingDataBuffer& incomingBuffer) {
 #ifdef PASS_NAMES_AROUND
-    for (auto& newName : m_incomingBuffer.usersRenamed) {
+    for (auto& newName : incomingBuffer.usersRenamed) {
         auto activeUser = m_userData.activeUsers.find(newName.first);
 
+        // the generation being built is the first one with the new name
         if (activeUser != m_userData.activeUsers.end()) {
-            activeUser->second->name = std::move(newName.second);
+            m_userData.nameHistory.recordRename(newName.first, m_userData.generation + 1, std::move(activeUser->second.name));
+            activeUser->second.name = std::move(newName.second);
 
             continue;
         }
@@ -226,42 +278,48 @@ void RatingCalculatorImpl::processRenames () {
         auto silentUser = m_userData.silentUsers.find(newName.first);
 
         if (silentUser != m_userData.silentUsers.end()) {
+            m_userData.nameHistory.recordRename(newName.first, m_userData.generation + 1, std::move(silentUser->second.name));
             silentUser->second.name = std::move(newName.second);
 
             continue;
         }
 
         // protocol error, trying to rename a user not previously registered
-        ErrorPtr error {new IpcProto::UserUnrecognizedError {newName.first}};
-        m_jobQueue.enqueueErrorJob(std::move(error));
+        m_jobQueue.enqueueErrorJob(ProtocolErrorRecord::userUnrecognized(newName.first));
     }
 
-    m_incomingBuffer.usersRenamed.clear();
+    incomingBuffer.usersRenamed.clear();
 #endif
 }
 
 // --------------------------------------------------------------------- //
 
 void RatingCalculatorImpl::processConnectionChanges () {
-    for (auto& connChange : m_incomingBuffer.connectionChanges) {
-        assert(connChange.second < 60 || connChange.second == UserDataConstants::invalidSecond);
+    for (auto incomingBuffer : m_incomingBuffers) {
+        processConnectionChanges(*incomingBuffer);
+    }
+}
+
+void RatingCalculatorImpl::processConnectionChanges (IncomingDataBuffer& incomingBuffer) {
+    for (auto& connChange : incomingBuffer.connectionChanges) {
+        assert(connChange.second < m_iterationData.usersOnline.size() || connChange.second == UserDataConstants::invalidSlot);
 
         auto activeUser = m_userData.activeUsers.find(connChange.first);
 
         if (activeUser != m_userData.activeUsers.end()) {
-            auto& second = activeUser->second->secondConnected;
+            auto& slot = activeUser->second.slotConnected;
 
-            if (second < 60) {
+            if (slot != UserDataConstants::invalidSlot) {
                 // user was connected before, removing old record
-                m_iterationData.usersOnline[second].erase(activeUser->second.get());
+                m_iterationData.usersOnline[slot].erase(&activeUser->second);
             }
 
             // modifying the user's connection status
-            second = connChange.second;
+            slot = connChange.second;
 
-            if (second < 60) {
+            if (slot != UserDataConstants::invalidSlot) {
                 // user reconnected back, putting him where he belongs
-                m_iterationData.usersOnline[second].emplace(activeUser->second.get());
+                m_iterationData.usersOnline[slot].insert(&activeUser->second);
             }
 
             continue;
@@ -270,29 +328,34 @@ void RatingCalculatorImpl::processConnectionChanges () {
         auto silentUser = m_userData.silentUsers.find(connChange.first);
 
         if (silentUser != m_userData.silentUsers.end()) {
-            silentUser->second.secondConnected = connChange.second;
+            silentUser->second.slotConnected = connChange.second;
 
             continue;
         }
 
         // protocol error, trying to (dis)connect a user not previously registered
-        ErrorPtr error {new IpcProto::UserUnrecognizedError {connChange.first}};
-        m_jobQueue.enqueueErrorJob(std::move(error));
+        m_jobQueue.enqueueErrorJob(ProtocolErrorRecord::userUnrecognized(connChange.first));
     }
 
-    m_incomingBuffer.connectionChanges.clear();
+    incomingBuffer.connectionChanges.clear();
 }
 
 // --------------------------------------------------------------------- //
 
 void RatingCalculatorImpl::processDeals () {
-    for (auto& newDeal : m_incomingBuffer.dealsWon) {
+    for (auto incomingBuffer : m_incomingBuffers) {
+        processDeals(*incomingBuffer);
+    }
+}
+
+void RatingCalculatorImpl::processDeals (IncomingDataBuffer& incomingBuffer) {
+    for (auto& newDeal : incomingBuffer.dealsWon) {
         auto activeUser = m_userData.activeUsers.find(newDeal.first);
 
         if (activeUser != m_userData.activeUsers.end()) {
             // user had rating before
 
-            auto userProfile = activeUser->second.get();
+            auto userProfile = &activeUser->second;
 
             m_ratingPatches.emplace(static_cast<int>(m_userData.rating.size()) - userProfile->rating - 1);
             m_ratingPatches.emplace(userProfile,
@@ -307,32 +370,32 @@ void RatingCalculatorImpl::processDeals () {
         if (silentUser != m_userData.silentUsers.end()) {
             // user had no rating previously
 
-            std::unique_ptr<FullUserData> userProfile { new FullUserData(newDeal.first, newDeal.second,
-                                                                         std::move(silentUser->second)) };
+            // the map node holds the profile, it stays where it is for as long as the user is active
+            auto activeUser = m_userData.activeUsers.try_emplace(newDeal.first, newDeal.first, newDeal.second,
+                                                                 std::move(silentUser->second)).first;
+            FullUserData* userProfile = &activeUser->second;
 
-            if (userProfile->secondConnected != UserDataConstants::invalidSecond) {
+            if (userProfile->slotConnected != UserDataConstants::invalidSlot) {
                 // user is connected, should put him onto the announcement list
-                m_iterationData.usersOnline[userProfile->secondConnected].emplace(userProfile.get());
+                m_iterationData.usersOnline[userProfile->slotConnected].insert(userProfile);
             }
 
             ++m_freshRatings;
 
-            m_ratingPatches.emplace(userProfile.get(),
+            m_ratingPatches.emplace(userProfile,
                                     ratingElementsAfter(userProfile->amountWon),
                                     RatingChangeType::NewPosition,
                                     userProfile->amountWon);
-            m_userData.activeUsers.emplace(newDeal.first, std::move(userProfile));
             m_userData.silentUsers.erase(silentUser);
 
             continue;
         }
 
         // protocol error, trying to process a deal on a user not previously registered
-        ErrorPtr error {new IpcProto::UserUnrecognizedError {newDeal.first}};
-        m_jobQueue.enqueueErrorJob(std::move(error));
+        m_jobQueue.enqueueErrorJob(ProtocolErrorRecord::userUnrecognized(newDeal.first));
     }
 
-    m_incomingBuffer.dealsWon.clear();
+    incomingBuffer.dealsWon.clear();
 }
 
 // --------------------------------------------------------------------- //
@@ -342,35 +405,86 @@ void RatingCalculatorImpl::processDeals () {
 // --------------------------------------------------------------------- //
 
 RatingCalculator::RatingCalculator (CoreRatingData& userData, CoreDataSyncBlock& coreSync,
-                                    IterationData& iterationData, IncomingDataDoubleBuffer& incomingData,
-                                    JobQueue& jobQueue)
+                                    IterationData& iterationData, IncomingDataShards& incomingData,
+                                    JobQueue& jobQueue, EventLog* eventLog)
 : m_userData {userData}, m_coreSync {coreSync}
 , m_iterationData {iterationData} , m_incomingData {incomingData}
-, m_jobQueue {jobQueue} {
+, m_jobQueue {jobQueue}, m_eventLog {eventLog} {
+    m_userData.appliedSequences.resize(m_incomingData.size());
 }
 
 void RatingCalculator::recalculate (bool dropOldRating) {
-    // switch incoming data buffers
-    // release sequence start: recalculator thread -> message dispatcher thread
-    IncomingDataBuffer* inData = m_incomingData.currentBuffer.exchange(&(m_incomingData.buffers[1-m_incomingData.currentBufferIndex]),
-                                                                        std::memory_order_release);
-    m_incomingData.currentBufferIndex = 1 - m_incomingData.currentBufferIndex;
+    // switch every ingest shard to the next buffer of its ring
+    for (auto& ring : m_incomingData) {
+        {
+            std::lock_guard lg(ring.lock);
+
+            // a writer lagging behind may leave the ring without a drained buffer to switch to,
+            // in which case it just keeps writing into its current one until the next recalculation
+            if (ring.publishedEpoch + 1 - ring.drainedEpoch < IncomingDataRing::size) {
+                ++ring.publishedEpoch;
+                ring.messagesBuffered.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        ring.writerTrigger.notify_one();
+    }
 
     // put worker threads to sleep
     // no release sequence required: just telling the worker threads to proceed to waiting
     m_coreSync.refreshInProgress.store(true, std::memory_order_relaxed);
+    m_jobQueue.wakeConsumers();
+
+    // collect the buffers the writers have left
+    // a writer busy with a long batch isn't waited for past the deadline, its buffer will be drained next time
+    auto handoffDeadline = std::chrono::steady_clock::now() + ingestHandoffTimeout;
+
+    m_drainedBuffers.clear();
+
+    for (size_t shardIndex = 0; shardIndex < m_incomingData.size(); ++shardIndex) {
+        IncomingDataRing& ring = m_incomingData[shardIndex];
+        std::unique_lock<std::mutex> lock(ring.lock);
+
+        ring.epochAcknowledged.wait_until(lock, handoffDeadline, [&ring]()->bool{
+            return ring.writerEpoch == ring.publishedEpoch;
+        });
+
+        IncomingDataBuffer& earliestBuffer = ring.buffers[ring.drainedEpoch % IncomingDataRing::size];
+
+        for (auto epoch = ring.drainedEpoch; epoch != ring.writerEpoch; ++epoch) {
+            IncomingDataBuffer& buffer = ring.buffers[epoch % IncomingDataRing::size];
+            sequence_t& appliedSequence = m_userData.appliedSequences[shardIndex];
+
+            // an epoch nothing has come in leaves the buffer with the sequence of some older one
+            appliedSequence = std::max(appliedSequence, buffer.lastSequence);
+            m_drainedBuffers.push_back(&buffer);
+
+            if (&buffer != &earliestBuffer) {
+                foldIncomingBuffer(earliestBuffer, buffer);
+            }
+        }
 
-    // wait till the buffer is out of use
-    // release sequence end: message dispatcher thread -> recalculator thread
-    while (inData->bufferWriterCount.load(std::memory_order_acquire));
+        // it's fine to mark the buffers as drained in advance: new epochs are published by this thread only,
+        // and the buffers will have been processed by the time of the next publication
+        ring.drainedEpoch = ring.writerEpoch;
+    }
 
     // wait till the worker threads are asleep
     // no release sequence required: worker threads don't modify any shared data
-    while (m_coreSync.dataReaderCount.load(std::memory_order_relaxed));
+    {
+        std::unique_lock<std::mutex> lock(m_coreSync.dataLock);
+
+        m_coreSync.readersGoneTrigger.wait(lock, [this]()->bool{
+            return !m_coreSync.dataReaderCount.load(std::memory_order_relaxed);
+        });
+    }
 
-    RatingCalculatorImpl impl(m_userData, m_iterationData, *inData, m_jobQueue);
+    RatingCalculatorImpl impl(m_userData, m_iterationData, m_drainedBuffers, m_jobQueue);
 
     impl.recalculate(dropOldRating);
+    ++m_userData.generation;
+
+    m_userData.nameHistory.prune();
 
     {
         std::lock_guard lg(m_coreSync.dataLock);
@@ -382,3 +496,23 @@ void RatingCalculator::recalculate (bool dropOldRating) {
 
     m_coreSync.dataRefreshedTrigger.notify_all();
 }
+
+unsigned int RatingCalculator::pendingMessageCount () const {
+    auto messageCount {0u};
+
+    for (const auto& ring : m_incomingData) {
+        messageCount += ring.messagesBuffered.load(std::memory_order_relaxed);
+    }
+
+    return messageCount;
+}
+
+RatingSnapshot::Content RatingCalculator::captureSnapshot () const {
+    // only the recalculation modifies the data, and it runs on the same thread
+    const auto& sequences = m_userData.appliedSequences;
+
+    // every shard has applied all of its messages up to the lowest sequence, so the log is replayed from there
+    auto logOffset = m_eventLog ? m_eventLog->resumeOffset(*std::min_element(sequences.begin(), sequences.end())) : uint64_t {0};
+
+    return RatingSnapshot::capture(m_userData, logOffset);
+}
\ No newline at end of file
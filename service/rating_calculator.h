@@ -2,29 +2,41 @@
 #define IQOPTIONTESTTASK_RATING_CALCULATOR_H
 
 #include <memory>
+#include <vector>
+
+#include "core_data.h"
+#include "rating_snapshot.h"
 
-struct CoreRatingData;
-struct CoreDataSyncBlock;
-struct IterationData;
-struct IncomingDataDoubleBuffer;
 class JobQueue;
+class EventLog;
 
 class RatingCalculator {
 public:
 
+    // the event log is only there when enabled
     RatingCalculator (CoreRatingData& userData, CoreDataSyncBlock& coreSync,
-                      IterationData& iterationData, IncomingDataDoubleBuffer& incomingData, JobQueue& jobQueue);
+                      IterationData& iterationData, IncomingDataShards& incomingData, JobQueue& jobQueue,
+                      EventLog* eventLog);
 
     void recalculate (bool dropOldRating);
 
+    // messages the ingest shards have buffered since the last recalculation, roughly
+    unsigned int pendingMessageCount () const;
+
+    // must be called between the recalculations, only the ids and the amounts are copied
+    RatingSnapshot::Content captureSnapshot () const;
+
 private:
 
     CoreRatingData& m_userData;
     CoreDataSyncBlock& m_coreSync;
     IterationData& m_iterationData;
-    IncomingDataDoubleBuffer& m_incomingData;
+    IncomingDataShards& m_incomingData;
 
     JobQueue& m_jobQueue;
+    EventLog* m_eventLog;
+
+    std::vector<IncomingDataBuffer*> m_drainedBuffers;
 };
 
 #endif //IQOPTIONTESTTASK_RATING_CALCULATOR_H
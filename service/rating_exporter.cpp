@@ -0,0 +1,172 @@
+#include <iostream>
+#include <cstdio>
+#include <stdexcept>
+#include <filesystem>
+
+#include "rating_exporter.h"
+#include "../utils/date_time.h"
+#include "../utils/file_sync.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr size_t exportBufferSize {1 << 20};
+static constexpr size_t namesPerPin {4096}; // small enough for the recalculation not to notice the wait
+
+using FilePtr = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+
+// --------------------------------------------------------------------- //
+/*
+ *  RatingExporter methods
+ */
+// --------------------------------------------------------------------- //
+
+RatingExporter::RatingExporter (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, const ExportPolicy& policy)
+: m_coreData {coreData}, m_syncBlock {syncBlock}, m_policy {policy} {}
+
+// --------------------------------------------------------------------- //
+
+RatingExporter::~RatingExporter () {
+    {
+        std::lock_guard lg(m_lock);
+
+        m_stopping = true;
+    }
+
+    m_stopTrigger.notify_one();
+
+    try {
+        if (m_taskHandle.valid()) {
+            m_taskHandle.get();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Rating exporter exception: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "Rating exporter exception: unknown exception" << std::endl;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingExporter::start () {
+    if (m_policy.path.empty()) {
+        return;
+    }
+
+    m_taskHandle = std::async(std::launch::async, &RatingExporter::doWork, this);
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingExporter::doWork () {
+    std::unique_lock<std::mutex> lock(m_lock);
+    auto nextExport = std::chrono::steady_clock::now() + m_policy.interval;
+
+    while (!m_stopTrigger.wait_until(lock, nextExport, [this]()->bool{ return m_stopping; })) {
+        lock.unlock();
+
+        try {
+            // the generation is pinned by the pointer alone, the service data is free to change meanwhile
+            RatingGenerationPtr generation = captureGeneration();
+
+            exportGeneration(*generation);
+        } catch (const std::exception& e) {
+            // the export is an optional extra, the service goes on, and so do the next exports
+            std::cerr << "Rating export failed: " << e.what() << std::endl;
+        }
+
+        lock.lock();
+
+        nextExport = std::chrono::steady_clock::now() + m_policy.interval;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+RatingGenerationPtr RatingExporter::captureGeneration () {
+    RatingGenerationPtr generation;
+
+    m_syncBlock.pinData();
+
+    try {
+        // copying the names would take most of the time, they're looked up chunk by chunk as the file is written
+        generation = RatingGeneration::capture(m_coreData, DateTime::now(), SIZE_MAX, false);
+    } catch (...) {
+        m_syncBlock.unpinData();
+
+        throw;
+    }
+
+    m_syncBlock.unpinData();
+
+    return generation;
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingExporter::exportGeneration (const RatingGeneration& generation) {
+    auto tempPath = m_policy.path + ".tmp";
+    FilePtr file {std::fopen(tempPath.c_str(), "wb"), &std::fclose};
+
+    if (!file) {
+        throw std::runtime_error {"can't create the export file " + tempPath};
+    }
+
+    std::setvbuf(file.get(), nullptr, _IOFBF, exportBufferSize);
+
+    auto capturedAt = std::chrono::duration_cast<std::chrono::seconds>(generation.capturedAt.time_since_epoch()).count();
+    auto written = std::fprintf(file.get(), "# generation %llu captured at %lld\nposition,id,name,amount\n",
+                                generation.number, static_cast<long long>(capturedAt)) > 0;
+
+    buffer_t names;
+    std::vector<uint32_t> nameOffsets;
+
+    for (size_t chunkStart = 0; chunkStart < generation.size() && written; chunkStart += namesPerPin) {
+        auto chunkEnd = std::min(generation.size(), chunkStart + namesPerPin);
+
+        resolveNames(generation, chunkStart, chunkEnd, names, nameOffsets);
+
+        for (auto i = chunkStart; i < chunkEnd && written; ++i) {
+            written = std::fprintf(file.get(), "%zu,%d,\"", i, generation.ids[i]) > 0;
+
+            // the names are quoted, with the quotes inside doubled
+            for (auto c = nameOffsets[i - chunkStart]; c < nameOffsets[i - chunkStart + 1] && written; ++c) {
+                auto nameChar = names[c];
+
+                written = std::fputc(nameChar, file.get()) != EOF && (nameChar != '"' || std::fputc('"', file.get()) != EOF);
+            }
+
+            written = written && std::fprintf(file.get(), "\",%ld\n", static_cast<long>(generation.amounts[i])) > 0;
+        }
+    }
+
+    if (!written || syncFile(file.get()) != 0) {
+        throw std::runtime_error {"export write failed"};
+    }
+
+    file.reset();
+
+    // the readers never see a partial export
+    std::filesystem::rename(tempPath, m_policy.path);
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingExporter::resolveNames (const RatingGeneration& generation, size_t from, size_t to,
+                                   buffer_t& names, std::vector<uint32_t>& nameOffsets) {
+    m_syncBlock.pinData();
+
+    try {
+        // the users renamed since the capture get the names they had back then
+        generation.resolveNames(m_coreData, from, to, names, nameOffsets);
+    } catch (...) {
+        m_syncBlock.unpinData();
+
+        throw;
+    }
+
+    m_syncBlock.unpinData();
+}
@@ -0,0 +1,54 @@
+#ifndef IQOPTIONTESTTASK_RATING_EXPORTER_H
+#define IQOPTIONTESTTASK_RATING_EXPORTER_H
+
+#include <future>
+
+#include "core_data.h"
+#include "rating_generation.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  RatingExporter class
+ *
+ *  dumps the whole rating to a file every interval without disturbing the service.
+ *  The exporter pins the data the way the workers do, so the next recalculation can't
+ *  start while it copies the ids and amounts into a generation, and writes the generation out
+ *  once the pin is released. The names are looked up by the ids as the file is written,
+ *  pinning the data again for every chunk of them only, and come out as they were at the capture
+ *  however the users have been renamed since. The announcements go on all the while
+ */
+// --------------------------------------------------------------------- //
+
+class RatingExporter {
+public:
+
+    RatingExporter (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, const ExportPolicy& policy);
+    ~RatingExporter ();
+
+    void start ();
+
+private:
+
+    void doWork ();
+
+    RatingGenerationPtr captureGeneration ();
+    void exportGeneration (const RatingGeneration& generation);
+
+    // the names of the positions [from, to) go one after another, nameOffsets[i] being where the one at from + i starts
+    void resolveNames (const RatingGeneration& generation, size_t from, size_t to,
+                       buffer_t& names, std::vector<uint32_t>& nameOffsets);
+
+private:
+
+    const CoreRatingData& m_coreData;
+    CoreDataSyncBlock& m_syncBlock;
+    const ExportPolicy& m_policy;
+
+    std::mutex m_lock;
+    std::condition_variable m_stopTrigger;
+    bool m_stopping {false};
+
+    std::future<void> m_taskHandle;
+};
+
+#endif //IQOPTIONTESTTASK_RATING_EXPORTER_H
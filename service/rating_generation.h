@@ -0,0 +1,125 @@
+#ifndef IQOPTIONTESTTASK_RATING_GENERATION_H
+#define IQOPTIONTESTTASK_RATING_GENERATION_H
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "core_data.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  RatingGeneration struct
+ *
+ *  an immutable copy of the rating as a particular recalculation has left it, kept
+ *  by columns: the position of a user is the index into them. The copy is meant to be
+ *  taken quickly while the data is pinned, and then read at leisure by whoever holds it.
+ *  A large one leaves the names out, they are looked up later as they were at the capture
+ */
+// --------------------------------------------------------------------- //
+
+struct RatingGeneration {
+    unsigned long long number {0};
+    chrono_t capturedAt;
+    size_t ratingSize {0}; // the whole rating, the columns may only hold the top of it
+
+    std::vector<id_t> ids;
+    std::vector<monetary_t> amounts;
+
+    // the name of the user at position i is [nameOffsets[i], nameOffsets[i + 1]) within the names
+    std::vector<uint32_t> nameOffsets;
+    buffer_t names;
+
+    // keeps the names replaced since the capture around, when the names are left out
+    NameHistory::Hold nameHold;
+
+    size_t size () const {
+        return ids.size();
+    }
+
+    // the data must not change meanwhile; only the top positions are copied if there's a limit,
+    // and the names are left out altogether (along with their offsets) unless asked for
+    static std::shared_ptr<const RatingGeneration> capture (const CoreRatingData& data, chrono_t now,
+                                                            size_t maxPositions = SIZE_MAX, bool withNames = true) {
+        auto generation = std::make_shared<RatingGeneration>();
+        auto positions = std::min(data.rating.size(), maxPositions);
+
+        generation->number = data.generation;
+        generation->capturedAt = now;
+        generation->ratingSize = data.rating.size();
+        generation->ids.reserve(positions);
+        generation->amounts.reserve(positions);
+        generation->nameOffsets.reserve(withNames ? positions + 1 : 0);
+
+        for (size_t i = 0; i < positions; ++i) {
+            const FullUserData* userData = data.rating[i];
+
+            generation->ids.push_back(userData->id);
+            generation->amounts.push_back(userData->amountWon);
+
+            if (withNames) {
+                generation->nameOffsets.push_back(static_cast<uint32_t>(generation->names.size()));
+#ifdef PASS_NAMES_AROUND
+                generation->names.insert(generation->names.end(), userData->name.begin(), userData->name.end());
+#endif
+            }
+        }
+
+        if (withNames) {
+            generation->nameOffsets.push_back(static_cast<uint32_t>(generation->names.size()));
+        } else {
+            generation->nameHold = data.nameHistory.holdGeneration(generation->number);
+        }
+
+        return generation;
+    }
+
+    // for a generation captured without the names: the names of the positions [from, to) as they were at the capture,
+    // one after another, nameOffsets[i] being where the one at from + i starts; the data must be pinned meanwhile
+    void resolveNames (const CoreRatingData& data, size_t from, size_t to, buffer_t& resolvedNames, std::vector<uint32_t>& resolvedOffsets) const {
+        resolvedNames.clear();
+        resolvedOffsets.assign(1, 0);
+
+        for (auto i = from; i < to; ++i) {
+            if (const buffer_t* name = nameOf(data, ids[i])) {
+                resolvedNames.insert(resolvedNames.end(), name->begin(), name->end());
+            }
+
+            resolvedOffsets.push_back(static_cast<uint32_t>(resolvedNames.size()));
+        }
+    }
+
+    // the name the user had at the capture, the user may as well be out of the columns (or the rating);
+    // nullptr for a user unknown by now, the data must be pinned meanwhile
+    const buffer_t* nameOf (const CoreRatingData& data, id_t userId) const {
+#ifdef PASS_NAMES_AROUND
+        const buffer_t* name = data.nameHistory.nameAt(userId, number);
+
+        return name ? name : currentName(data, userId);
+#else
+        return nullptr;
+#endif
+    }
+
+private:
+
+#ifdef PASS_NAMES_AROUND
+    // a user gone from the rating since the capture is still found among the silent ones
+    static const buffer_t* currentName (const CoreRatingData& data, id_t userId) {
+        if (auto activeUser = data.activeUsers.find(userId); activeUser != data.activeUsers.end()) {
+            return &activeUser->second.name;
+        }
+
+        if (auto silentUser = data.silentUsers.find(userId); silentUser != data.silentUsers.end()) {
+            return &silentUser->second.name;
+        }
+
+        return nullptr;
+    }
+#endif
+};
+
+using RatingGenerationPtr = std::shared_ptr<const RatingGeneration>;
+
+#endif //IQOPTIONTESTTASK_RATING_GENERATION_H
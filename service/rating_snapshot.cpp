@@ -0,0 +1,246 @@
+#include <cstring>
+#include <stdexcept>
+#include <filesystem>
+
+#include "rating_snapshot.h"
+#include "registered_ids.h"
+#include "../utils/date_time.h"
+#include "../utils/mapped_file.h"
+#include "../utils/file_sync.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr char snapshotMagic[8] {'I', 'Q', 'R', 'A', 'T', 'I', 'N', 'G'};
+static constexpr uint32_t snapshotVersion {2};
+static constexpr size_t recordsPerWrite {4096};
+
+/*
+ *  All the sections are 8-byte aligned, so the records can be used right where they are mapped.
+ *  The sequences tell which part of the event log the snapshot already reflects, per ingest shard,
+ *  and the log offset where the first block it doesn't wholly reflect starts
+ */
+
+struct SnapshotHeader {
+    char magic[8] {};
+    uint32_t version {snapshotVersion};
+    uint32_t shardCount {0};
+    int64_t expirationDate {0}; // milliseconds since the epoch
+    uint64_t ratingSize {0}; // the rated users go first, in the rating order
+    uint64_t userCount {0};
+    uint64_t sequencesOffset {0};
+    uint64_t recordsOffset {0};
+    uint64_t namesOffset {0};
+    uint64_t namesSize {0};
+    uint64_t logOffset {0};
+};
+
+struct SnapshotUserRecord {
+    int64_t amountWon {0};
+    uint64_t nameOffset {0}; // within the names blob
+    int32_t id {UserDataConstants::invalidId};
+    uint32_t nameSize {0};
+};
+
+static_assert(std::is_trivially_copyable<SnapshotHeader>::value && sizeof(SnapshotHeader) % 8 == 0,
+              "snapshot header is written as is");
+static_assert(std::is_trivially_copyable<SnapshotUserRecord>::value && sizeof(SnapshotUserRecord) % 8 == 0,
+              "snapshot records are written as is");
+
+using FilePtr = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+
+static void writeOrThrow (std::FILE* file, const void* data, size_t size) {
+    if (size && std::fwrite(data, 1, size, file) != size) {
+        throw std::runtime_error {"snapshot write failed"};
+    }
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  RatingSnapshot methods
+ */
+// --------------------------------------------------------------------- //
+
+RatingSnapshot::Content RatingSnapshot::capture (const CoreRatingData& data, uint64_t logOffset) {
+    Content content;
+
+    content.rating = RatingGeneration::capture(data, DateTime::now(), SIZE_MAX, false);
+    content.unratedIds.reserve(data.silentUsers.size());
+
+    for (const auto& silentUser : data.silentUsers) {
+        content.unratedIds.push_back(silentUser.first);
+    }
+
+    content.appliedSequences = data.appliedSequences;
+    content.expirationDate = data.expirationDate;
+    content.logOffset = logOffset;
+
+    return content;
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingSnapshot::store (const Content& content, const NameResolver& resolveNames, const std::string& path) {
+    auto tempPath = path + ".tmp";
+    FilePtr file {std::fopen(tempPath.c_str(), "wb"), &std::fclose};
+
+    if (!file) {
+        throw std::runtime_error {"can't create the snapshot " + tempPath};
+    }
+
+    const RatingGeneration& rating = *content.rating;
+    SnapshotHeader header;
+
+    memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.shardCount = static_cast<uint32_t>(content.appliedSequences.size());
+    header.expirationDate = std::chrono::duration_cast<std::chrono::milliseconds>(content.expirationDate.time_since_epoch()).count();
+    header.ratingSize = rating.size();
+    header.userCount = rating.size() + content.unratedIds.size();
+    header.sequencesOffset = sizeof(SnapshotHeader);
+    header.recordsOffset = header.sequencesOffset + header.shardCount * sizeof(sequence_t);
+    header.namesOffset = header.recordsOffset + header.userCount * sizeof(SnapshotUserRecord);
+    header.logOffset = content.logOffset;
+
+    writeOrThrow(file.get(), &header, sizeof(header));
+    writeOrThrow(file.get(), content.appliedSequences.data(), content.appliedSequences.size() * sizeof(sequence_t));
+
+    // the records and the names are written a chunk at a time, each into its own section
+    std::vector<SnapshotUserRecord> records;
+    buffer_t names;
+    std::vector<uint32_t> nameOffsets;
+    uint64_t namesSize {0};
+
+    records.reserve(recordsPerWrite);
+
+    for (uint64_t chunkStart = 0; chunkStart < header.userCount; chunkStart += recordsPerWrite) {
+        auto chunkEnd = std::min<uint64_t>(header.userCount, chunkStart + recordsPerWrite);
+
+        resolveNames(chunkStart, chunkEnd, names, nameOffsets);
+        records.clear();
+
+        for (auto i = chunkStart; i < chunkEnd; ++i) {
+            SnapshotUserRecord record;
+            auto nameIndex = i - chunkStart;
+
+            if (i < header.ratingSize) {
+                record.id = rating.ids[i];
+                record.amountWon = rating.amounts[i];
+            } else {
+                record.id = content.unratedIds[i - header.ratingSize];
+            }
+
+            record.nameOffset = namesSize + nameOffsets[nameIndex];
+            record.nameSize = nameOffsets[nameIndex + 1] - nameOffsets[nameIndex];
+            records.push_back(record);
+        }
+
+        if (seekFile(file.get(), header.recordsOffset + chunkStart * sizeof(SnapshotUserRecord)) != 0) {
+            throw std::runtime_error {"snapshot write failed"};
+        }
+
+        writeOrThrow(file.get(), records.data(), records.size() * sizeof(SnapshotUserRecord));
+
+        if (seekFile(file.get(), header.namesOffset + namesSize) != 0) {
+            throw std::runtime_error {"snapshot write failed"};
+        }
+
+        writeOrThrow(file.get(), names.data(), names.size());
+        namesSize += names.size();
+    }
+
+    // the names size is only known by now
+    header.namesSize = namesSize;
+
+    if (seekFile(file.get(), 0) != 0) {
+        throw std::runtime_error {"snapshot write failed"};
+    }
+
+    writeOrThrow(file.get(), &header, sizeof(header));
+
+    if (syncFile(file.get()) != 0) {
+        throw std::runtime_error {"snapshot sync failed"};
+    }
+
+    file.reset();
+
+    std::filesystem::rename(tempPath, path);
+
+    // the event log gets cut once the snapshot is stored, so the rename has to reach the disk first
+    if (syncDirectory(path) != 0) {
+        throw std::runtime_error {"snapshot sync failed"};
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+bool RatingSnapshot::load (CoreRatingData& data, RegisteredIdSet& registeredIds, const std::string& path,
+                           uint64_t& logOffset, LoadStatistics& stats) {
+    assert(data.rating.empty() && data.activeUsers.empty() && data.silentUsers.empty());
+
+    MappedFile file {path};
+    SnapshotHeader header;
+
+    if (file.size() < sizeof(header)) {
+        return false;
+    }
+
+    memcpy(&header, file.data(), sizeof(header));
+
+    if (memcmp(header.magic, snapshotMagic, sizeof(header.magic)) != 0 || header.version != snapshotVersion ||
+        header.shardCount != data.appliedSequences.size() || header.ratingSize > header.userCount ||
+        header.sequencesOffset + header.shardCount * sizeof(sequence_t) > header.recordsOffset ||
+        header.recordsOffset + header.userCount * sizeof(SnapshotUserRecord) > header.namesOffset ||
+        header.namesOffset + header.namesSize > file.size() ||
+        header.recordsOffset % alignof(SnapshotUserRecord) != 0) {
+        return false;
+    }
+
+    const auto* records = reinterpret_cast<const SnapshotUserRecord*>(file.data() + header.recordsOffset);
+    const unsigned char* names = file.data() + header.namesOffset;
+
+    for (uint64_t i = 0; i < header.userCount; ++i) {
+        if (records[i].nameOffset + records[i].nameSize > header.namesSize) {
+            return false;
+        }
+    }
+
+    data.activeUsers.reserve(header.ratingSize);
+    data.rating.reserve(header.ratingSize);
+    data.silentUsers.reserve(header.userCount - header.ratingSize);
+
+    for (uint64_t i = 0; i < header.userCount; ++i) {
+        const SnapshotUserRecord& record = records[i];
+        BasicUserData userData;
+
+#ifdef PASS_NAMES_AROUND
+        userData.name.assign(names + record.nameOffset, names + record.nameOffset + record.nameSize);
+#endif
+        registeredIds.insert(record.id);
+
+        if (i >= header.ratingSize) {
+            data.silentUsers.emplace(record.id, std::move(userData));
+
+            continue;
+        }
+
+        // the user is built right in the map node, nothing else is allocated for it
+        FullUserData& ratedUser = data.activeUsers.try_emplace(record.id, record.id, static_cast<monetary_t>(record.amountWon),
+                                                              std::move(userData)).first->second;
+
+        // the records go in the rating order, so the position is the index
+        ratedUser.rating = static_cast<int>(i);
+        data.rating.push_back(&ratedUser);
+    }
+
+    memcpy(data.appliedSequences.data(), file.data() + header.sequencesOffset, header.shardCount * sizeof(sequence_t));
+    data.expirationDate = chrono_t {std::chrono::duration_cast<chrono_t::duration>(std::chrono::milliseconds {header.expirationDate})};
+    logOffset = header.logOffset;
+
+    stats.users = header.userCount;
+    stats.ratedUsers = header.ratingSize;
+
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef IQOPTIONTESTTASK_RATING_SNAPSHOT_H
+#define IQOPTIONTESTTASK_RATING_SNAPSHOT_H
+
+#include <string>
+#include <functional>
+
+#include "core_data.h"
+#include "rating_generation.h"
+
+class RegisteredIdSet;
+
+// --------------------------------------------------------------------- //
+/*
+ *  RatingSnapshot class
+ *
+ *  saves the user directory and the rating to a file laid out to be loaded
+ *  straight from a memory mapping: a header, fixed-size user records in the rating
+ *  order followed by the unrated users, and a blob of names referred to by offsets.
+ *  Loading is a single pass over the records, nothing gets searched or sorted.
+ *  Storing works from a capture of the ids and amounts, the names are asked for
+ *  a chunk at a time as the file is written, so it can go on in the background
+ */
+// --------------------------------------------------------------------- //
+
+class RatingSnapshot {
+public:
+
+    struct LoadStatistics {
+        unsigned long long users {0};
+        unsigned long long ratedUsers {0};
+    };
+
+    // the directory as a recalculation has left it, but for the names
+    struct Content {
+        RatingGenerationPtr rating; // captured without the names
+        std::vector<id_t> unratedIds;
+        std::vector<sequence_t> appliedSequences;
+        chrono_t expirationDate;
+        uint64_t logOffset {0}; // where the event log replay is to start
+    };
+
+    // the names of the users [from, to) in the snapshot order, the rated ones first, as they were at the capture;
+    // they go one after another, nameOffsets[i] being where the one at from + i starts
+    using NameResolver = std::function<void (size_t from, size_t to, buffer_t& names, std::vector<uint32_t>& nameOffsets)>;
+
+public:
+
+    // must be called between the recalculations, only the ids and the amounts are copied
+    static Content capture (const CoreRatingData& data, uint64_t logOffset);
+
+    // replaces the previous snapshot only once the new one is completely on the disk
+    static void store (const Content& content, const NameResolver& resolveNames, const std::string& path);
+
+    // the data must be empty; false if there's no snapshot, or it doesn't fit this service build
+    static bool load (CoreRatingData& data, RegisteredIdSet& registeredIds, const std::string& path,
+                      uint64_t& logOffset, LoadStatistics& stats);
+};
+
+#endif //IQOPTIONTESTTASK_RATING_SNAPSHOT_H
@@ -0,0 +1,274 @@
+#include <iostream>
+#include <algorithm>
+
+#include "rating_streamer.h"
+#include "../utils/date_time.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr size_t maxActiveStreams {4}; // every active stream keeps a whole generation alive
+static constexpr std::chrono::seconds streamIdleTimeout {30}; // a stream left without credits for that long is dropped
+static constexpr std::chrono::milliseconds streamerWakeTimeout {1000}; // only matters for noticing the idle streams
+
+using SnapshotFrameFlags = IpcProto::ProtocolConstants::SnapshotFrameFlags;
+
+// --------------------------------------------------------------------- //
+/*
+ *  RatingStreamer methods
+ */
+// --------------------------------------------------------------------- //
+
+RatingStreamer::RatingStreamer (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, ServerIpcTransport& transport)
+: m_coreData {coreData}, m_syncBlock {syncBlock}, m_transport {transport} {}
+
+// --------------------------------------------------------------------- //
+
+RatingStreamer::~RatingStreamer () {
+    {
+        std::lock_guard lg(m_lock);
+
+        m_stopping = true;
+    }
+
+    m_trigger.notify_one();
+
+    try {
+        if (m_taskHandle.valid()) {
+            m_taskHandle.get();
+        }
+    } catch (const transport_error_recoverable&) {
+        std::cerr << "Rating streamer exception: recoverable transport error" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Rating streamer exception: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "Rating streamer exception: unknown exception" << std::endl;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingStreamer::start () {
+    m_taskHandle = std::async(std::launch::async, &RatingStreamer::doWork, this);
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingStreamer::requestStream (const StreamRequest& request) {
+    {
+        std::lock_guard lg(m_lock);
+
+        m_streams.push_back(Stream {request});
+    }
+
+    m_trigger.notify_one();
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingStreamer::grantCredits (IpcProto::request_id_t requestId, unsigned int credits) {
+    {
+        std::lock_guard lg(m_lock);
+
+        auto stream = std::find_if(m_streams.begin(), m_streams.end(), [requestId](const Stream& s) {
+            return s.request.requestId == requestId;
+        });
+
+        // the stream might be over already, and the credits for it are just late
+        if (stream == m_streams.end()) {
+            return;
+        }
+
+        stream->request.credits = std::min(stream->request.credits + credits,
+                                           IpcProto::ProtocolConstants::SnapshotStreamLimits::maxCredits);
+    }
+
+    m_trigger.notify_one();
+}
+
+// --------------------------------------------------------------------- //
+
+/*
+ *  The streams take turns frame by frame, so a slow client of one doesn't hold the others back.
+ *  A new stream is either started or rejected right away, depending on how many are active
+ */
+
+void RatingStreamer::doWork () {
+    try {
+        BinaryOStream frameBuffer {m_transport.createAdaptedSnapshotFrameBuffer()};
+        auto frameBase = frameBuffer.getPos();
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        auto streamReady = [](const Stream& s) { return !s.generation || s.request.credits != 0; };
+
+        for (;;) {
+            m_trigger.wait_for(lock, streamerWakeTimeout, [this, &streamReady]()->bool{
+                return m_stopping || std::any_of(m_streams.begin(), m_streams.end(), streamReady);
+            });
+
+            if (m_stopping || m_syncBlock.stopSignals.badFlag.load(std::memory_order_relaxed)) {
+                break;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+
+            m_streams.remove_if([now](const Stream& s) {
+                return s.generation && s.request.credits == 0 && now - s.lastActivity > streamIdleTimeout;
+            });
+
+            auto stream = std::find_if(m_streams.begin(), m_streams.end(), streamReady);
+
+            if (stream == m_streams.end()) {
+                continue;
+            }
+
+            if (!stream->generation) {
+                auto activeStreams = std::count_if(m_streams.begin(), m_streams.end(), [](const Stream& s) {
+                    return static_cast<bool>(s.generation);
+                });
+
+                lock.unlock();
+
+                if (static_cast<size_t>(activeStreams) >= maxActiveStreams) {
+                    sendRejection(frameBuffer, frameBase, stream->request);
+                } else {
+                    stream->generation = captureGeneration();
+                    stream->lastActivity = std::chrono::steady_clock::now();
+                }
+
+                lock.lock();
+
+                if (!stream->generation) {
+                    m_streams.erase(stream);
+                }
+
+                continue;
+            }
+
+            --stream->request.credits;
+
+            lock.unlock();
+
+            sendFrame(frameBuffer, frameBase, *stream);
+
+            lock.lock();
+
+            if (stream->nextPosition >= stream->generation->size()) {
+                m_streams.erase(stream);
+            } else {
+                // to the back of the line
+                m_streams.splice(m_streams.end(), m_streams, stream);
+            }
+        }
+    } catch (const transport_error_recoverable&) {
+        m_syncBlock.stopSignals.signalError(false);
+
+        throw;
+    } catch (...) {
+        m_syncBlock.stopSignals.signalError();
+
+        throw;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+RatingGenerationPtr RatingStreamer::captureGeneration () {
+    RatingGenerationPtr generation;
+
+    m_syncBlock.pinData();
+
+    try {
+        generation = m_latestGeneration.lock();
+
+        if (!generation || generation->number != m_coreData.generation) {
+            // copying the names would take most of the time, they're looked up frame by frame as it is sent
+            generation = RatingGeneration::capture(m_coreData, DateTime::now(), SIZE_MAX, false);
+            m_latestGeneration = generation;
+        }
+    } catch (...) {
+        m_syncBlock.unpinData();
+
+        throw;
+    }
+
+    m_syncBlock.unpinData();
+
+    return generation;
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingStreamer::sendFrame (BinaryOStream& buffer, BinaryOStream::pos_t base, Stream& stream) {
+    using StorageBuilder = IpcProto::RatingSnapshotFrame::StorageBuilder;
+
+    const RatingGeneration& generation = *stream.generation;
+    const StreamRequest& request = stream.request;
+    auto frameBegin = stream.nextPosition;
+    auto frameEnd = std::min(generation.size(), frameBegin + request.positionsPerFrame);
+    id_t previousId {0};
+    monetary_t previousWinnings {0};
+
+#ifdef PASS_NAMES_AROUND
+    buffer_t name;
+#endif
+
+    resolveNames(generation, frameBegin, frameEnd);
+
+    StorageBuilder::storeFrameHeader(buffer, request.requestId, generation.number, static_cast<int>(generation.size()),
+                                     static_cast<int>(frameBegin), static_cast<unsigned int>(frameEnd - frameBegin),
+                                     request.encoding, frameEnd == generation.size() ? SnapshotFrameFlags::lastFrame : 0);
+
+    for (auto i = frameBegin; i < frameEnd; ++i) {
+#ifdef PASS_NAMES_AROUND
+        name.assign(m_frameNames.begin() + m_frameNameOffsets[i - frameBegin], m_frameNames.begin() + m_frameNameOffsets[i - frameBegin + 1]);
+#endif
+        StorageBuilder::storeFrameEntry(buffer, request.encoding, generation.ids[i], generation.amounts[i], previousId, previousWinnings
+#ifdef PASS_NAMES_AROUND
+                                        , name
+#endif
+                                        );
+
+        previousId = generation.ids[i];
+        previousWinnings = generation.amounts[i];
+    }
+
+    m_transport.blockedWriteExtendedMessage(buffer);
+
+    buffer.rewind(base);
+
+    stream.nextPosition = frameEnd;
+    stream.lastActivity = std::chrono::steady_clock::now();
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingStreamer::resolveNames (const RatingGeneration& generation, size_t from, size_t to) {
+    m_syncBlock.pinData();
+
+    try {
+        generation.resolveNames(m_coreData, from, to, m_frameNames, m_frameNameOffsets);
+    } catch (...) {
+        m_syncBlock.unpinData();
+
+        throw;
+    }
+
+    m_syncBlock.unpinData();
+}
+
+// --------------------------------------------------------------------- //
+
+void RatingStreamer::sendRejection (BinaryOStream& buffer, BinaryOStream::pos_t base, const StreamRequest& request) {
+    using StorageBuilder = IpcProto::RatingSnapshotFrame::StorageBuilder;
+
+    StorageBuilder::storeFrameHeader(buffer, request.requestId, 0, 0, 0, 0, request.encoding,
+                                     SnapshotFrameFlags::lastFrame | SnapshotFrameFlags::streamRejected);
+
+    m_transport.blockedWriteExtendedMessage(buffer);
+
+    buffer.rewind(base);
+}
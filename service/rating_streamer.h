@@ -0,0 +1,95 @@
+#ifndef IQOPTIONTESTTASK_RATING_STREAMER_H
+#define IQOPTIONTESTTASK_RATING_STREAMER_H
+
+#include <future>
+#include <list>
+
+#include "core_data.h"
+#include "rating_generation.h"
+#include "../ipc/transport.h"
+#include "../utils/clock_source.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  RatingStreamer class
+ *
+ *  serves the rating snapshot streams the downstream caches request to warm up. Every stream
+ *  is sent out of a generation captured when it starts, so it stays consistent however long
+ *  the client takes, and the frames go one by one as the client grants credits for them.
+ *  Only the ids and amounts are captured, the names of a frame are looked up, as they were
+ *  at the capture, while it is built. The streamer has a thread of its own, the workers never
+ *  wait for the streams except for the writer lock taken once per frame, nor the recalculations
+ *  except for the brief pin the names of a frame take
+ */
+// --------------------------------------------------------------------- //
+
+class RatingStreamer {
+public:
+
+    struct StreamRequest {
+        IpcProto::request_id_t requestId {0};
+        unsigned int positionsPerFrame {0};
+        unsigned int credits {0};
+        IpcProto::ProtocolConstants::SnapshotEncoding encoding {IpcProto::ProtocolConstants::SnapshotEncoding::PLAIN};
+    };
+
+public:
+
+    RatingStreamer (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, ServerIpcTransport& transport);
+    ~RatingStreamer ();
+
+    void start ();
+
+    // ingest shard methods
+
+    void requestStream (const StreamRequest& request);
+    void grantCredits (IpcProto::request_id_t requestId, unsigned int credits);
+
+private:
+
+    struct Stream {
+        explicit Stream (const StreamRequest& r) : request {r} {}
+
+        StreamRequest request; // the credits are guarded by the lock, the rest belongs to the streamer thread
+
+        RatingGenerationPtr generation;
+        size_t nextPosition {0};
+        steady_t lastActivity {};
+    };
+
+private:
+
+    void doWork ();
+
+    RatingGenerationPtr captureGeneration ();
+
+    // the names of a frame as they were at the capture, into the frame name storage
+    void resolveNames (const RatingGeneration& generation, size_t from, size_t to);
+
+    void sendFrame (BinaryOStream& buffer, BinaryOStream::pos_t base, Stream& stream);
+    void sendRejection (BinaryOStream& buffer, BinaryOStream::pos_t base, const StreamRequest& request);
+
+private:
+
+    const CoreRatingData& m_coreData;
+    CoreDataSyncBlock& m_syncBlock;
+    ServerIpcTransport& m_transport;
+
+    std::mutex m_lock;
+    std::condition_variable m_trigger;
+    bool m_stopping {false};
+
+    // the nodes stay put while the streamer thread works on them without the lock
+    std::list<Stream> m_streams;
+
+    // the streams starting at the same generation share it
+    std::weak_ptr<const RatingGeneration> m_latestGeneration;
+
+    // streamer thread only, kept to reuse the storage
+    buffer_t m_frameNames;
+    std::vector<uint32_t> m_frameNameOffsets;
+
+    std::future<void> m_taskHandle;
+};
+
+#endif //IQOPTIONTESTTASK_RATING_STREAMER_H
@@ -0,0 +1,76 @@
+#ifndef IQOPTIONTESTTASK_REGISTERED_IDS_H
+#define IQOPTIONTESTTASK_REGISTERED_IDS_H
+
+#include "core_data.h"
+#include "../utils/segmented_array.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  RegisteredIdSet class
+ *
+ *  a bitmap of all the user ids ever registered, which lets the ingest shards
+ *  turn down the messages about unknown users right away. The bitmap only takes
+ *  memory for the id ranges actually in use. Ids are only ever added, and both
+ *  adding and checking an id are lock-free
+ */
+// --------------------------------------------------------------------- //
+
+class RegisteredIdSet {
+public:
+
+    void insert (id_t userId) {
+        auto bitIndex = static_cast<uint32_t>(userId);
+
+        m_words.at(bitIndex / 64).fetch_or(wordMask(bitIndex), std::memory_order_relaxed);
+    }
+
+    bool contains (id_t userId) const {
+        auto bitIndex = static_cast<uint32_t>(userId);
+        auto word = m_words.find(bitIndex / 64);
+
+        return word && (word->load(std::memory_order_relaxed) & wordMask(bitIndex));
+    }
+
+private:
+
+    static uint64_t wordMask (uint32_t bitIndex) {
+        return uint64_t {1} << (bitIndex % 64);
+    }
+
+private:
+
+    // 64K ids per segment
+    SegmentedAtomicArray<uint64_t, 32 - 6, 10> m_words;
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  RatingStampTable class
+ *
+ *  the clock tick each user has last been sent the rating at, so that no user gets
+ *  more than one rating pack per tick however many rating jobs it has caused
+ */
+// --------------------------------------------------------------------- //
+
+class RatingStampTable {
+public:
+
+    // true if the user hasn't been claimed within the tick yet, and is claimed now
+    bool claim (id_t userId, uint32_t tick) {
+        return m_stamps.at(static_cast<uint32_t>(userId)).exchange(tick, std::memory_order_relaxed) != tick;
+    }
+
+    // undoes a claim nothing has been sent for, unless the user has been claimed within another tick since
+    void release (id_t userId, uint32_t tick) {
+        auto claimedTick = tick;
+
+        m_stamps.at(static_cast<uint32_t>(userId)).compare_exchange_strong(claimedTick, tick - 1, std::memory_order_relaxed);
+    }
+
+private:
+
+    // 64K ids per segment
+    SegmentedAtomicArray<uint32_t, 32, 16> m_stamps;
+};
+
+#endif //IQOPTIONTESTTASK_REGISTERED_IDS_H
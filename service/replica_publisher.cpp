@@ -0,0 +1,221 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "replica_publisher.h"
+
+using namespace IpcProto;
+
+// --------------------------------------------------------------------- //
+/*
+ *  ReplicaPublisher methods
+ */
+// --------------------------------------------------------------------- //
+
+ReplicaPublisher::ReplicaPublisher (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, const ReplicaPolicy& policy)
+: m_coreData {coreData}, m_syncBlock {syncBlock}, m_policy {policy} {}
+
+// --------------------------------------------------------------------- //
+
+ReplicaPublisher::~ReplicaPublisher () {
+    {
+        std::lock_guard lg(m_syncBlock.dataLock);
+
+        m_stopping = true;
+    }
+
+    // the workers wait on the same trigger, they just go back to sleep
+    m_syncBlock.dataRefreshedTrigger.notify_all();
+
+    try {
+        if (m_taskHandle.valid()) {
+            m_taskHandle.get();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Replica publisher exception: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "Replica publisher exception: unknown exception" << std::endl;
+    }
+
+    closeSegment();
+}
+
+// --------------------------------------------------------------------- //
+
+void ReplicaPublisher::start () {
+    if (m_policy.name.empty()) {
+        return;
+    }
+
+#ifdef IQOPTIONTESTTASK_HAS_SHM
+    try {
+        openSegment();
+    } catch (const std::exception& e) {
+        // the replica is an optional extra, the service goes on without it
+        std::cerr << "Rating replica disabled: " << e.what() << std::endl;
+
+        return;
+    }
+
+    m_taskHandle = std::async(std::launch::async, &ReplicaPublisher::doWork, this);
+#else
+    std::cerr << "Rating replica disabled: shared memory is not supported on this platform" << std::endl;
+#endif
+}
+
+// --------------------------------------------------------------------- //
+
+void ReplicaPublisher::doWork () {
+    // the readers get the rating the service has started with right away, be it empty or loaded from a snapshot
+    publishGeneration();
+
+    std::unique_lock<std::mutex> lock(m_syncBlock.dataLock);
+
+    for (;;) {
+        m_syncBlock.dataRefreshedTrigger.wait(lock, [this]()->bool{
+            return m_stopping || (!m_syncBlock.refreshInProgress.load(std::memory_order_relaxed) &&
+                                  m_coreData.generation != m_publishedGeneration);
+        });
+
+        if (m_stopping) {
+            break;
+        }
+
+        lock.unlock();
+
+        publishGeneration();
+
+        lock.lock();
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void ReplicaPublisher::openSegment () {
+#ifdef IQOPTIONTESTTASK_HAS_SHM
+    auto segmentSize = ReplicaLayout::segmentSize(m_policy.capacity);
+    int fd = shm_open(m_policy.name.c_str(), O_CREAT | O_RDWR, 0644);
+    struct stat segmentStat {};
+
+    if (fd >= 0 && fstat(fd, &segmentStat) == 0 && segmentStat.st_size != 0 &&
+        static_cast<size_t>(segmentStat.st_size) != segmentSize) {
+        // a segment of some other capacity is replaced rather than resized: the readers still mapping it
+        // keep the old generation instead of running past the end of a shrunk one
+        close(fd);
+        shm_unlink(m_policy.name.c_str());
+        fd = shm_open(m_policy.name.c_str(), O_CREAT | O_RDWR, 0644);
+    }
+
+    if (fd < 0) {
+        throw std::runtime_error {"can't open the shared memory segment " + m_policy.name};
+    }
+
+    void* mapping = MAP_FAILED;
+
+    if (ftruncate(fd, static_cast<off_t>(segmentSize)) == 0) {
+        mapping = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error {"can't map the shared memory segment " + m_policy.name};
+    }
+
+    m_segment = static_cast<unsigned char*>(mapping);
+    m_segmentSize = segmentSize;
+
+    auto& header = *reinterpret_cast<ReplicaHeader*>(m_segment);
+
+    // the segment left by the previous run is reused as is, so the readers survive the service restarts;
+    // it is never unlinked for the same reason. A run that has died mid-publish leaves the slot it wrote
+    // with an odd sequence, but that's never the active one, and the next publish evens it out
+    if (header.magic == ReplicaConstants::magic && header.version == ReplicaConstants::version &&
+        header.capacity == m_policy.capacity) {
+        return;
+    }
+
+    header.version = ReplicaConstants::version;
+    header.capacity = m_policy.capacity;
+    header.slotStride = ReplicaLayout::slotStride(m_policy.capacity);
+    header.activeSlot.store(0, std::memory_order_relaxed);
+
+    for (uint32_t slot = 0; slot < ReplicaConstants::slotCount; ++slot) {
+        auto& slotHeader = *reinterpret_cast<ReplicaSlotHeader*>(m_segment + ReplicaLayout::slotOffset(m_policy.capacity, slot));
+
+        slotHeader.sequence.store(0, std::memory_order_relaxed);
+        slotHeader.generation = 0;
+        slotHeader.size = 0;
+        slotHeader.ratingSize = 0;
+    }
+
+    // the readers check the magic first, so it goes last
+    std::atomic_thread_fence(std::memory_order_release);
+    header.magic = ReplicaConstants::magic;
+#endif
+}
+
+// --------------------------------------------------------------------- //
+
+void ReplicaPublisher::closeSegment () {
+#ifdef IQOPTIONTESTTASK_HAS_SHM
+    if (m_segment) {
+        munmap(m_segment, m_segmentSize);
+    }
+#endif
+    m_segment = nullptr;
+    m_segmentSize = 0;
+}
+
+// --------------------------------------------------------------------- //
+
+void ReplicaPublisher::publishGeneration () {
+    auto capacity = m_policy.capacity;
+    auto& header = *reinterpret_cast<ReplicaHeader*>(m_segment);
+
+    // the slot the readers are not directed to, a reader still busy with it from before will retry
+    auto slotIndex = (header.activeSlot.load(std::memory_order_relaxed) + 1) % ReplicaConstants::slotCount;
+    unsigned char* slot = m_segment + ReplicaLayout::slotOffset(capacity, slotIndex);
+    auto& slotHeader = *reinterpret_cast<ReplicaSlotHeader*>(slot);
+    auto ids = reinterpret_cast<id_t*>(slot + ReplicaLayout::idsOffset());
+    auto amounts = reinterpret_cast<monetary_t*>(slot + ReplicaLayout::amountsOffset(capacity));
+    auto index = reinterpret_cast<ReplicaIndexEntry*>(slot + ReplicaLayout::indexOffset(capacity));
+    // odd whatever the slot has been left with, so the end of the write always makes it even
+    auto sequence = slotHeader.sequence.load(std::memory_order_relaxed) | 1;
+
+    slotHeader.sequence.store(sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    m_syncBlock.pinData();
+
+    // the rating beyond the capacity is left out, the readers see the total size though
+    auto ratingSize = m_coreData.rating.size();
+    auto size = static_cast<uint32_t>(std::min<size_t>(ratingSize, capacity));
+
+    for (uint32_t position = 0; position < size; ++position) {
+        const FullUserData* userData = m_coreData.rating[position];
+
+        ids[position] = userData->id;
+        amounts[position] = userData->amountWon;
+    }
+
+    m_publishedGeneration = m_coreData.generation;
+
+    m_syncBlock.unpinData();
+
+    for (uint32_t position = 0; position < size; ++position) {
+        index[position] = ReplicaIndexEntry {ids[position], position};
+    }
+
+    std::sort(index, index + size, [](const ReplicaIndexEntry& left, const ReplicaIndexEntry& right) {
+        return left.id < right.id;
+    });
+
+    slotHeader.generation = m_publishedGeneration;
+    slotHeader.size = size;
+    slotHeader.ratingSize = static_cast<uint32_t>(ratingSize);
+
+    slotHeader.sequence.store(sequence + 1, std::memory_order_release);
+    header.activeSlot.store(slotIndex, std::memory_order_release);
+}
@@ -0,0 +1,54 @@
+#ifndef IQOPTIONTESTTASK_REPLICA_PUBLISHER_H
+#define IQOPTIONTESTTASK_REPLICA_PUBLISHER_H
+
+#include <future>
+#include <vector>
+
+#include "core_data.h"
+#include "../ipc/rating_replica.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  ReplicaPublisher class
+ *
+ *  mirrors every new rating generation into the shared memory replica the co-located
+ *  processes read through RatingReplicaReader. The rating is copied while the data is pinned,
+ *  the way the workers read it, and everything else (the id index, the slot switch) is done
+ *  once the pin is released. The readers never take any lock the service uses
+ */
+// --------------------------------------------------------------------- //
+
+class ReplicaPublisher {
+public:
+
+    ReplicaPublisher (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, const ReplicaPolicy& policy);
+    ~ReplicaPublisher ();
+
+    void start ();
+
+private:
+
+    void doWork ();
+
+    void openSegment ();
+    void closeSegment ();
+
+    void publishGeneration ();
+
+private:
+
+    const CoreRatingData& m_coreData;
+    CoreDataSyncBlock& m_syncBlock;
+    const ReplicaPolicy& m_policy;
+
+    unsigned char* m_segment {nullptr};
+    size_t m_segmentSize {0};
+
+    unsigned long long m_publishedGeneration {0};
+
+    bool m_stopping {false}; // guarded by the data lock, the publisher waits on the data refresh trigger
+
+    std::future<void> m_taskHandle;
+};
+
+#endif //IQOPTIONTESTTASK_REPLICA_PUBLISHER_H
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <algorithm>
+
+#include "snapshot_writer.h"
+#include "event_log.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  SnapshotWriter methods
+ */
+// --------------------------------------------------------------------- //
+
+SnapshotWriter::SnapshotWriter (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, const SnapshotPolicy& policy,
+                                EventLog* eventLog)
+: m_coreData {coreData}, m_syncBlock {syncBlock}, m_policy {policy}, m_eventLog {eventLog} {}
+
+// --------------------------------------------------------------------- //
+
+SnapshotWriter::~SnapshotWriter () {
+    {
+        std::lock_guard lg(m_lock);
+
+        m_stopping = true;
+    }
+
+    m_trigger.notify_one();
+
+    try {
+        if (m_taskHandle.valid()) {
+            m_taskHandle.get();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Snapshot writer exception: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "Snapshot writer exception: unknown exception" << std::endl;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void SnapshotWriter::start () {
+    if (m_policy.path.empty()) {
+        return;
+    }
+
+    m_taskHandle = std::async(std::launch::async, &SnapshotWriter::doWork, this);
+}
+
+// --------------------------------------------------------------------- //
+
+bool SnapshotWriter::ready () const {
+    std::lock_guard lg(m_lock);
+
+    return m_taskHandle.valid() && !m_pending;
+}
+
+// --------------------------------------------------------------------- //
+
+void SnapshotWriter::submit (RatingSnapshot::Content&& content) {
+    {
+        std::lock_guard lg(m_lock);
+
+        if (m_pending) {
+            return;
+        }
+
+        m_pending.emplace(std::move(content));
+    }
+
+    m_trigger.notify_one();
+}
+
+// --------------------------------------------------------------------- //
+
+void SnapshotWriter::doWork () {
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    for (;;) {
+        m_trigger.wait(lock, [this]()->bool{ return m_stopping || m_pending; });
+
+        if (m_stopping) {
+            break;
+        }
+
+        lock.unlock();
+
+        try {
+            // the content is only ever replaced once it's reset below
+            storeSnapshot(*m_pending);
+        } catch (const std::exception& e) {
+            // the service keeps working, the next snapshot may well succeed
+            std::cerr << "Rating snapshot failed: " << e.what() << std::endl;
+        }
+
+        lock.lock();
+
+        m_pending.reset();
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void SnapshotWriter::storeSnapshot (const RatingSnapshot::Content& content) {
+    RatingSnapshot::store(content, [this, &content](size_t from, size_t to, buffer_t& names, std::vector<uint32_t>& nameOffsets) {
+        resolveNames(content, from, to, names, nameOffsets);
+    }, m_policy.path);
+
+    if (m_eventLog) {
+        const auto& sequences = content.appliedSequences;
+
+        // the replay never needs what the snapshot reflects anymore
+        m_eventLog->discardApplied(*std::min_element(sequences.begin(), sequences.end()));
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void SnapshotWriter::resolveNames (const RatingSnapshot::Content& content, size_t from, size_t to,
+                                   buffer_t& names, std::vector<uint32_t>& nameOffsets) {
+    const RatingGeneration& rating = *content.rating;
+
+    names.clear();
+    nameOffsets.assign(1, 0);
+
+    m_syncBlock.pinData();
+
+    try {
+        // the users renamed since the capture get the names they had back then, the unrated ones included
+        for (auto i = from; i < to; ++i) {
+            auto userId = i < rating.size() ? rating.ids[i] : content.unratedIds[i - rating.size()];
+
+            if (const buffer_t* name = rating.nameOf(m_coreData, userId)) {
+                names.insert(names.end(), name->begin(), name->end());
+            }
+
+            nameOffsets.push_back(static_cast<uint32_t>(names.size()));
+        }
+    } catch (...) {
+        m_syncBlock.unpinData();
+
+        throw;
+    }
+
+    m_syncBlock.unpinData();
+}
@@ -0,0 +1,66 @@
+#ifndef IQOPTIONTESTTASK_SNAPSHOT_WRITER_H
+#define IQOPTIONTESTTASK_SNAPSHOT_WRITER_H
+
+#include <future>
+#include <optional>
+
+#include "core_data.h"
+#include "rating_snapshot.h"
+
+class EventLog;
+
+// --------------------------------------------------------------------- //
+/*
+ *  SnapshotWriter class
+ *
+ *  writes the snapshots out in the background, so the announcer only spends the time
+ *  it takes to capture the ids and the amounts. The names are looked up a chunk at a time
+ *  as the file is written, pinning the data the way the exporter does, and come out as they
+ *  were at the capture. A snapshot handed over while the previous one is still being written
+ *  is refused rather than queued. Once a snapshot is on the disk, the event log may drop
+ *  the blocks it reflects
+ */
+// --------------------------------------------------------------------- //
+
+class SnapshotWriter {
+public:
+
+    // the event log is only there when enabled
+    SnapshotWriter (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, const SnapshotPolicy& policy,
+                    EventLog* eventLog);
+    ~SnapshotWriter ();
+
+    void start ();
+
+    // announcer methods
+
+    // false while the previous snapshot is still being written, or if the snapshots are disabled
+    bool ready () const;
+
+    void submit (RatingSnapshot::Content&& content);
+
+private:
+
+    void doWork ();
+
+    void storeSnapshot (const RatingSnapshot::Content& content);
+
+    void resolveNames (const RatingSnapshot::Content& content, size_t from, size_t to,
+                       buffer_t& names, std::vector<uint32_t>& nameOffsets);
+
+private:
+
+    const CoreRatingData& m_coreData;
+    CoreDataSyncBlock& m_syncBlock;
+    const SnapshotPolicy& m_policy;
+    EventLog* m_eventLog;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_trigger;
+    std::optional<RatingSnapshot::Content> m_pending; // stays there until it's written
+    bool m_stopping {false};
+
+    std::future<void> m_taskHandle;
+};
+
+#endif //IQOPTIONTESTTASK_SNAPSHOT_WRITER_H
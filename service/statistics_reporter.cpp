@@ -0,0 +1,108 @@
+#include <iostream>
+
+#include "statistics_reporter.h"
+#include "job_queue.h"
+#include "subscriber_hub.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  StatisticsReporter methods
+ */
+// --------------------------------------------------------------------- //
+
+StatisticsReporter::StatisticsReporter (const ServerIpcTransport& transport, const JobQueue& jobQueue,
+                                        const SubscriberHub& subscriberHub, const StatisticsPolicy& policy)
+: m_transport {transport}, m_jobQueue {jobQueue}, m_subscriberHub {subscriberHub}, m_policy {policy} {}
+
+// --------------------------------------------------------------------- //
+
+StatisticsReporter::~StatisticsReporter () {
+    {
+        std::lock_guard lg(m_lock);
+
+        m_stopping = true;
+    }
+
+    m_stopTrigger.notify_one();
+
+    try {
+        if (m_taskHandle.valid()) {
+            m_taskHandle.get();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Statistics reporter exception: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "Statistics reporter exception: unknown exception" << std::endl;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void StatisticsReporter::start () {
+    if (m_policy.interval == std::chrono::milliseconds::zero()) {
+        return;
+    }
+
+    m_taskHandle = std::async(std::launch::async, &StatisticsReporter::doWork, this);
+}
+
+// --------------------------------------------------------------------- //
+
+void StatisticsReporter::report () const {
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    using std::chrono::microseconds;
+
+    auto lockStats = m_transport.writerLockStatistics();
+
+    std::cerr << "Writer lock: " << lockStats.acquisitions << " acquisitions, "
+              << lockStats.contendedAcquisitions << " contended, " << lockStats.spins << " spins, "
+              << lockStats.parks << " parks, "
+              << duration_cast<milliseconds>(lockStats.holdTime).count() << " ms held"
+              << std::endl;
+
+    auto outboundStats = m_transport.outboundStatistics();
+
+    std::cerr << "Outbound buffer: " << outboundStats.messages << " messages, " << outboundStats.depth << " bytes left unsent, "
+              << outboundStats.peakDepth << " bytes at peak, " << outboundStats.stalePacksDropped << " stale packs dropped, "
+              << outboundStats.blockedPushes << " writes blocked for "
+              << duration_cast<milliseconds>(outboundStats.blockedTime).count() << " ms"
+              << (outboundStats.overflown ? ", overflown" : "") << std::endl;
+
+    auto subscriberStats = m_subscriberHub.statistics();
+
+    if (subscriberStats.subscribers || subscriberStats.subscribersDropped) {
+        std::cerr << "Subscriber buffers: " << subscriberStats.subscribers << " subscribers, "
+                  << subscriberStats.outbound.messages << " messages, " << subscriberStats.outbound.depth << " bytes left unsent, "
+                  << subscriberStats.outbound.peakDepth << " bytes at the largest peak, "
+                  << subscriberStats.outbound.stalePacksDropped << " stale packs dropped, "
+                  << subscriberStats.subscribersDropped << " subscribers dropped for falling behind" << std::endl;
+    }
+
+    for (auto lane : {JobLane::Interactive, JobLane::Periodic}) {
+        auto laneStats = m_jobQueue.laneStatistics(lane);
+        auto averageWait = laneStats.jobs ? laneStats.totalWait / static_cast<std::chrono::nanoseconds::rep>(laneStats.jobs) : std::chrono::nanoseconds {0};
+
+        std::cerr << (lane == JobLane::Interactive ? "Interactive" : "Periodic") << " rating jobs: "
+                  << laneStats.jobs << " served, "
+                  << duration_cast<microseconds>(averageWait).count() << " us average wait, "
+                  << duration_cast<microseconds>(laneStats.maxWait).count() << " us max wait"
+                  << std::endl;
+    }
+
+    std::cerr << "Job queues: " << m_jobQueue.rejectedJobCount() << " jobs rejected, "
+              << m_jobQueue.deferredJobCount() << " rating chunks deferred until there was room" << std::endl;
+}
+
+// --------------------------------------------------------------------- //
+
+void StatisticsReporter::doWork () {
+    std::unique_lock<std::mutex> lock(m_lock);
+    auto nextReport = std::chrono::steady_clock::now() + m_policy.interval;
+
+    while (!m_stopTrigger.wait_until(lock, nextReport, [this]()->bool{ return m_stopping; })) {
+        report();
+
+        nextReport += m_policy.interval;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef IQOPTIONTESTTASK_STATISTICS_REPORTER_H
+#define IQOPTIONTESTTASK_STATISTICS_REPORTER_H
+
+#include <future>
+
+#include "core_data.h"
+#include "../ipc/transport.h"
+
+class JobQueue;
+class SubscriberHub;
+
+// --------------------------------------------------------------------- //
+/*
+ *  StatisticsReporter class
+ *
+ *  prints the writer lock, the outbound buffers and the job lanes figures to the error output
+ *  every interval while the service runs, and once more when the connection is over.
+ *  All the figures are cumulative since the connection has been made, but the buffer depths
+ */
+// --------------------------------------------------------------------- //
+
+class StatisticsReporter {
+public:
+
+    StatisticsReporter (const ServerIpcTransport& transport, const JobQueue& jobQueue,
+                        const SubscriberHub& subscriberHub, const StatisticsPolicy& policy);
+    ~StatisticsReporter ();
+
+    void start ();
+
+    void report () const;
+
+private:
+
+    void doWork ();
+
+private:
+
+    const ServerIpcTransport& m_transport;
+    const JobQueue& m_jobQueue;
+    const SubscriberHub& m_subscriberHub;
+    const StatisticsPolicy& m_policy;
+
+    std::mutex m_lock;
+    std::condition_variable m_stopTrigger;
+    bool m_stopping {false};
+
+    std::future<void> m_taskHandle;
+};
+
+#endif //IQOPTIONTESTTASK_STATISTICS_REPORTER_H
@@ -0,0 +1,353 @@
+#include <iostream>
+#include <thread>
+#include <algorithm>
+
+#include "subscriber_hub.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr size_t maxSubscribers {16}; // every subscriber takes a thread and a buffer of its own
+static constexpr size_t maxPendingSubscribers {16}; // the connections accepted but not subscribed yet, a thread each
+static constexpr std::chrono::milliseconds subscribeTimeout {5000}; // for the handshake and the subscription together
+static constexpr std::chrono::milliseconds watchdogPause {500};
+static constexpr std::chrono::milliseconds acceptRetryPause {1000}; // after a failed accept, e.g. when out of descriptors
+
+// --------------------------------------------------------------------- //
+/*
+ *  SubscriberHub methods
+ */
+// --------------------------------------------------------------------- //
+
+SubscriberHub::SubscriberHub (const SubscriberPolicy& policy)
+: m_policy {policy}, m_acceptor {m_ios}, m_routes {std::make_shared<const RouteList>()} {}
+
+// --------------------------------------------------------------------- //
+
+SubscriberHub::~SubscriberHub () {
+    {
+        std::lock_guard lg(m_lock);
+
+        m_stopping = true;
+    }
+
+    m_stopTrigger.notify_one();
+
+    if (m_watchdogHandle.valid()) {
+        try {
+            m_watchdogHandle.get();
+        } catch (const std::exception& e) {
+            std::cerr << "Subscriber watchdog exception: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Subscriber watchdog exception: unknown exception" << std::endl;
+        }
+    }
+
+    if (m_taskHandle.valid()) {
+        try {
+            // the acceptor thread is blocked in accept, connecting is the portable way to wake it up
+            TCPClientSocketTransport waker;
+
+            waker.init("127.0.0.1", std::to_string(m_policy.port));
+        } catch (...) {}
+
+        try {
+            m_taskHandle.get();
+        } catch (const std::exception& e) {
+            std::cerr << "Subscriber hub exception: " << e.what() << std::endl;
+        } catch (...) {
+            std::cerr << "Subscriber hub exception: unknown exception" << std::endl;
+        }
+    }
+
+    std::list<Connection> connections;
+
+    {
+        std::lock_guard lg(m_lock);
+
+        connections.swap(m_connections);
+    }
+
+    for (auto& connection : connections) {
+        connection.subscriber->transport.disconnect();
+    }
+
+    // the subscriber tasks never throw, and they take the hub lock on the way out
+    for (auto& connection : connections) {
+        if (connection.taskHandle.valid()) {
+            connection.taskHandle.wait();
+        }
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void SubscriberHub::start () {
+    if (!m_policy.port) {
+        return;
+    }
+
+    try {
+        using asio::ip::tcp;
+
+        m_acceptor = tcp::acceptor(m_ios, tcp::endpoint(tcp::v4(), m_policy.port));
+    } catch (const std::exception& e) {
+        // the subscribers are an optional extra, the service goes on without them
+        std::cerr << "Subscriber endpoint disabled: " << e.what() << std::endl;
+
+        return;
+    }
+
+    m_taskHandle = std::async(std::launch::async, &SubscriberHub::doAccept, this);
+    m_watchdogHandle = std::async(std::launch::async, &SubscriberHub::doWatch, this);
+}
+
+// --------------------------------------------------------------------- //
+
+bool SubscriberHub::publish (id_t id, BinaryOStream& message, bool periodic) {
+    if (!m_routeCount.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    RouteListPtr routes = std::atomic_load(&m_routes);
+    auto prefixed {false};
+    auto owned {false};
+
+    // the filters may overlap, every subscriber owning the user gets a copy
+    for (const auto& subscriber : *routes) {
+        if (!subscriber->filter.matches(id)) {
+            continue;
+        }
+
+        if (!prefixed) {
+            message.setPos(0);
+            message << static_cast<IpcProto::message_size_t>(message.storage().size());
+
+            prefixed = true;
+        }
+
+        // a subscriber can't keep up if there's no room at once, dropping it rather than letting the workers wait
+        if (subscriber->transport.queueMessage(message.storage(), id, periodic)) {
+            owned = true;
+        } else {
+            subscriber->transport.disconnect();
+        }
+    }
+
+    // with no subscriber taking the pack it goes to the ingest connection after all
+    return owned;
+}
+
+// --------------------------------------------------------------------- //
+
+SubscriberHub::Statistics SubscriberHub::statistics () const {
+    RouteListPtr routes = std::atomic_load(&m_routes);
+    Statistics stats;
+
+    stats.subscribers = routes->size();
+    stats.subscribersDropped = m_subscribersDropped.load(std::memory_order_relaxed);
+
+    for (const auto& subscriber : *routes) {
+        auto outboundStats = subscriber->transport.outboundStatistics();
+
+        stats.outbound.depth += outboundStats.depth;
+        stats.outbound.peakDepth = std::max(stats.outbound.peakDepth, outboundStats.peakDepth);
+        stats.outbound.messages += outboundStats.messages;
+        stats.outbound.stalePacksDropped += outboundStats.stalePacksDropped;
+    }
+
+    return stats;
+}
+
+// --------------------------------------------------------------------- //
+
+void SubscriberHub::doAccept () {
+    for (;;) {
+        auto subscriber = std::make_shared<Subscriber>(std::make_unique<Spinlock>(),
+                                                       OutboundPolicy {m_policy.bufferSize, std::chrono::milliseconds::zero()});
+        auto accepted {true};
+
+        try {
+            subscriber->transport.connect(m_acceptor);
+        } catch (const std::exception& e) {
+            std::cerr << "Subscriber hub exception: " << e.what() << std::endl;
+
+            accepted = false;
+        }
+
+        {
+            std::lock_guard lg(m_lock);
+
+            if (m_stopping) {
+                break;
+            }
+
+            reapConnections();
+
+            auto pending = std::count_if(m_connections.begin(), m_connections.end(), [](const Connection& c) {
+                return !c.subscriber->routed;
+            });
+
+            // the connection is closed as the subscriber goes out of scope
+            if (accepted && m_routeCount.load(std::memory_order_relaxed) >= maxSubscribers) {
+                std::cerr << "Subscriber rejected: there are " << maxSubscribers << " subscribers already" << std::endl;
+            } else if (accepted && static_cast<size_t>(pending) >= maxPendingSubscribers) {
+                std::cerr << "Subscriber rejected: " << maxPendingSubscribers << " connections are yet to subscribe" << std::endl;
+            } else if (accepted) {
+                subscriber->subscribeDeadline = std::chrono::steady_clock::now() + subscribeTimeout;
+
+                m_connections.push_back(Connection {subscriber, std::async(std::launch::async, &SubscriberHub::serve, this, subscriber)});
+            }
+        }
+
+        if (!accepted) {
+            std::this_thread::sleep_for(acceptRetryPause);
+        }
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void SubscriberHub::doWatch () {
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (!m_stopTrigger.wait_for(lock, watchdogPause, [this]()->bool{ return m_stopping; })) {
+        auto now = std::chrono::steady_clock::now();
+
+        for (auto& connection : m_connections) {
+            Subscriber& s = *connection.subscriber;
+
+            if (s.routed || now < s.subscribeDeadline) {
+                continue;
+            }
+
+            // the serve thread blocked in the receive fails and lets the connection go
+            s.transport.disconnect();
+            s.subscribeDeadline = std::chrono::steady_clock::time_point::max();
+
+            std::cerr << "Subscriber timed out: no valid subscription within " << subscribeTimeout.count() << " ms" << std::endl;
+        }
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void SubscriberHub::serve (SubscriberPtr subscriber) {
+    using IpcProto::ProtocolConstants;
+
+    Subscriber& s = *subscriber;
+    auto routed {false};
+
+    try {
+        s.transport.handshake();
+
+        buffer_t messageStorage;
+        BinaryIStream message = s.transport.receive(messageStorage);
+        IpcProto::message_code_t messageCode {ProtocolConstants::invalidMessageCode};
+
+        message >> messageCode;
+
+        auto subscribed = messageCode == static_cast<IpcProto::message_code_t>(ProtocolConstants::ClientMessageCode::SUBSCRIBE_RATINGS);
+
+        if (subscribed) {
+            s.filter.init(message);
+        }
+
+        if (!subscribed || !s.filter.valid()) {
+            std::cerr << "Subscriber protocol error: a valid subscription must follow the handshake" << std::endl;
+
+            return;
+        }
+
+        if (!route(subscriber)) {
+            std::cerr << "Subscriber rejected: there are " << maxSubscribers << " subscribers already" << std::endl;
+
+            return;
+        }
+
+        routed = true;
+
+        // the writer takes all the packs queued meanwhile at once, so a subscriber fallen behind catches up in large writes
+        s.transport.writeQueued();
+    } catch (const transport_error_recoverable&) {
+        // the subscriber has gone before subscribing
+    } catch (const BinaryIStream::storage_underflow&) {
+        std::cerr << "Subscriber protocol error: malformed subscription" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Subscriber exception: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "Subscriber exception: unknown exception" << std::endl;
+    }
+
+    if (!routed) {
+        return;
+    }
+
+    auto outboundStats = s.transport.outboundStatistics();
+
+    unroute(subscriber);
+
+    if (outboundStats.overflown) {
+        m_subscribersDropped.fetch_add(1, std::memory_order_relaxed);
+
+        std::cerr << "Subscriber dropped: fell behind by more than " << m_policy.bufferSize << " bytes, "
+                  << outboundStats.stalePacksDropped << " stale packs dropped before" << std::endl;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+bool SubscriberHub::route (const SubscriberPtr& subscriber) {
+    std::lock_guard lg(m_lock);
+
+    // a connection only takes a subscriber place once it has subscribed
+    if (m_routes->size() >= maxSubscribers) {
+        return false;
+    }
+
+    subscriber->routed = true;
+
+    auto routes = std::make_shared<RouteList>(*m_routes);
+
+    routes->push_back(subscriber);
+
+    auto routeCount = routes->size();
+
+    std::atomic_store(&m_routes, RouteListPtr {std::move(routes)});
+    m_routeCount.store(routeCount, std::memory_order_relaxed);
+
+    std::cerr << "Subscriber connected, " << routeCount << " subscribers in total" << std::endl;
+
+    return true;
+}
+
+// --------------------------------------------------------------------- //
+
+void SubscriberHub::unroute (const SubscriberPtr& subscriber) {
+    std::lock_guard lg(m_lock);
+
+    auto routes = std::make_shared<RouteList>(*m_routes);
+
+    routes->erase(std::remove(routes->begin(), routes->end(), subscriber), routes->end());
+
+    auto routeCount = routes->size();
+
+    // the packs of its users go to the ingest connection again
+    m_routeCount.store(routeCount, std::memory_order_relaxed);
+    std::atomic_store(&m_routes, RouteListPtr {std::move(routes)});
+
+    if (!m_stopping) {
+        std::cerr << "Subscriber disconnected, " << routeCount << " subscribers left" << std::endl;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void SubscriberHub::reapConnections () {
+    m_connections.remove_if([](const Connection& c) {
+        return c.taskHandle.wait_for(std::chrono::seconds {0}) == std::future_status::ready;
+    });
+}
@@ -0,0 +1,109 @@
+#ifndef IQOPTIONTESTTASK_SUBSCRIBER_HUB_H
+#define IQOPTIONTESTTASK_SUBSCRIBER_HUB_H
+
+#include <future>
+#include <list>
+#include <vector>
+
+#include "core_data.h"
+#include "../ipc/transport.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  SubscriberHub class
+ *
+ *  fans the rating packs out to the subscriber connections accepted on a port of their own.
+ *  Every subscriber has an outbound queue and a writer thread of its own, so the workers only
+ *  ever copy the packs into the queues, and a slow subscriber holds back neither the workers,
+ *  nor the ingest connection, nor the other subscribers. The packs of the users no subscriber owns
+ *  keep going to the ingest connection. The hub outlives the ingest connection restarts,
+ *  the subscribers stay connected meanwhile. A connection which doesn't subscribe in time
+ *  is closed by the watchdog thread, so the idle ones can't take the subscriber places
+ */
+// --------------------------------------------------------------------- //
+
+class SubscriberHub {
+public:
+
+    struct Statistics {
+        size_t subscribers {0};
+        OutboundQueue::Statistics outbound; // summed up over the subscribers connected, but the peak, which is the largest one
+        unsigned long long subscribersDropped {0};
+    };
+
+public:
+
+    explicit SubscriberHub (const SubscriberPolicy& policy);
+    ~SubscriberHub ();
+
+    void start ();
+
+    // worker methods
+
+    // the message must be complete but for the size prefix, false means no subscriber has taken it
+    bool publish (id_t id, BinaryOStream& message, bool periodic);
+
+    Statistics statistics () const;
+
+private:
+
+    struct Subscriber {
+        Subscriber (SpinlockPtr&& writerLock, const OutboundPolicy& outboundPolicy)
+        : transport {std::move(writerLock), outboundPolicy} {}
+
+        SubscriberIpcTransport transport;
+        IpcProto::SubscribeRatingsMsg filter; // set before the subscriber is routed to, never changed after
+
+        // guarded by the hub lock
+        std::chrono::steady_clock::time_point subscribeDeadline;
+        bool routed {false};
+    };
+
+    using SubscriberPtr = std::shared_ptr<Subscriber>;
+
+    // the task handle is kept apart from the subscriber, the task holds a pointer to it
+    struct Connection {
+        SubscriberPtr subscriber;
+        std::future<void> taskHandle;
+    };
+
+    using RouteList = std::vector<SubscriberPtr>;
+    using RouteListPtr = std::shared_ptr<const RouteList>;
+
+private:
+
+    void doAccept ();
+    void doWatch ();
+    void serve (SubscriberPtr subscriber);
+
+    // false if there are too many subscribers already
+    bool route (const SubscriberPtr& subscriber);
+    void unroute (const SubscriberPtr& subscriber);
+    void reapConnections ();
+
+private:
+
+    const SubscriberPolicy m_policy;
+
+    asio::io_service m_ios;
+    asio::ip::tcp::acceptor m_acceptor;
+
+    // guards the connections and the route list changes, never taken by the workers
+    std::mutex m_lock;
+    std::condition_variable m_stopTrigger;
+    std::list<Connection> m_connections;
+    bool m_stopping {false};
+
+    // replaced as a whole on every change, so the workers never wait for m_lock; the atomic shared_ptr access
+    // isn't lock-free itself though (the standard libraries guard it with a small pool of locks), the workers
+    // only hold one of those for the pointer copy, never while the route list is walked
+    RouteListPtr m_routes;
+    std::atomic<size_t> m_routeCount {0};
+
+    std::atomic<unsigned long long> m_subscribersDropped {0};
+
+    std::future<void> m_taskHandle;
+    std::future<void> m_watchdogHandle;
+};
+
+#endif //IQOPTIONTESTTASK_SUBSCRIBER_HUB_H
@@ -0,0 +1,276 @@
+#include <iostream>
+#include <algorithm>
+
+#include "top_rating_feed.h"
+#include "../utils/date_time.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and functions
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr std::chrono::milliseconds feedWakeTimeout {1000}; // only matters for noticing the stop signals
+
+using TopChangeFlags = IpcProto::ProtocolConstants::TopChangeFlags;
+
+static bool sameName (const RatingGeneration& left, size_t leftPosition, const RatingGeneration& right, size_t rightPosition) {
+    return std::equal(left.names.begin() + left.nameOffsets[leftPosition], left.names.begin() + left.nameOffsets[leftPosition + 1],
+                      right.names.begin() + right.nameOffsets[rightPosition], right.names.begin() + right.nameOffsets[rightPosition + 1]);
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  TopRatingFeed methods
+ */
+// --------------------------------------------------------------------- //
+
+TopRatingFeed::TopRatingFeed (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, ServerIpcTransport& transport)
+: m_coreData {coreData}, m_syncBlock {syncBlock}, m_transport {transport} {}
+
+// --------------------------------------------------------------------- //
+
+TopRatingFeed::~TopRatingFeed () {
+    {
+        std::lock_guard lg(m_syncBlock.dataLock);
+
+        m_stopping = true;
+    }
+
+    // the workers wait on the same trigger, they just go back to sleep
+    m_syncBlock.dataRefreshedTrigger.notify_all();
+
+    try {
+        if (m_taskHandle.valid()) {
+            m_taskHandle.get();
+        }
+    } catch (const transport_error_recoverable&) {
+        std::cerr << "Top rating feed exception: recoverable transport error" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Top rating feed exception: " << e.what() << std::endl;
+    } catch (...) {
+        std::cerr << "Top rating feed exception: unknown exception" << std::endl;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+void TopRatingFeed::start () {
+    m_taskHandle = std::async(std::launch::async, &TopRatingFeed::doWork, this);
+}
+
+// --------------------------------------------------------------------- //
+
+void TopRatingFeed::subscribe (IpcProto::request_id_t subscriptionId, unsigned int topPositions) {
+    {
+        std::lock_guard lg(m_syncBlock.dataLock);
+
+        auto subscription = std::find_if(m_subscriptions.begin(), m_subscriptions.end(), [subscriptionId](const Subscription& s) {
+            return s.id == subscriptionId;
+        });
+
+        if (!topPositions) {
+            if (subscription != m_subscriptions.end()) {
+                m_subscriptions.erase(subscription);
+            }
+
+            return;
+        }
+
+        if (subscription == m_subscriptions.end()) {
+            // over the limit the subscriptions are ignored
+            if (m_subscriptions.size() >= IpcProto::ProtocolConstants::TopFeedLimits::maxSubscriptions) {
+                return;
+            }
+
+            subscription = m_subscriptions.insert(m_subscriptions.end(), Subscription {subscriptionId});
+        }
+
+        subscription->topPositions = topPositions;
+        subscription->version = ++m_subscriptionVersion;
+        subscription->baselineSent = false;
+
+        m_subscriptionsChanged = true;
+    }
+
+    m_syncBlock.dataRefreshedTrigger.notify_all();
+}
+
+// --------------------------------------------------------------------- //
+
+void TopRatingFeed::doWork () {
+    try {
+        BinaryOStream diffBuffer {m_transport.createAdaptedTopDiffBuffer()};
+        auto diffBase = diffBuffer.getPos();
+        std::unique_lock<std::mutex> lock(m_syncBlock.dataLock);
+
+        for (;;) {
+            auto workToDo = m_syncBlock.dataRefreshedTrigger.wait_for(lock, feedWakeTimeout, [this]()->bool{
+                return m_stopping || m_subscriptionsChanged ||
+                       (!m_subscriptions.empty() && !m_syncBlock.refreshInProgress.load(std::memory_order_relaxed) &&
+                        (!m_previousTop || m_coreData.generation != m_previousTop->number));
+            });
+
+            if (m_stopping || m_syncBlock.stopSignals.badFlag.load(std::memory_order_relaxed)) {
+                break;
+            }
+
+            if (!workToDo) {
+                continue;
+            }
+
+            m_subscriptionsChanged = false;
+
+            if (m_subscriptions.empty()) {
+                // nothing to compare against then, whoever subscribes next starts with a baseline anyway
+                m_previousTop.reset();
+
+                continue;
+            }
+
+            auto subscriptions = m_subscriptions;
+
+            lock.unlock();
+
+            RatingGenerationPtr currentTop = captureTop();
+            auto topChanged = !m_previousTop || m_previousTop->number != currentTop->number;
+
+            m_currentPositions.clear();
+
+            for (size_t i = 0; i < currentTop->size(); ++i) {
+                m_currentPositions.emplace(currentTop->ids[i], static_cast<unsigned int>(i));
+            }
+
+            for (const auto& subscription : subscriptions) {
+                if (topChanged || !subscription.baselineSent) {
+                    sendDiff(diffBuffer, diffBase, subscription, *currentTop);
+                }
+            }
+
+            m_previousTop = std::move(currentTop);
+            m_previousPositions.swap(m_currentPositions);
+
+            lock.lock();
+
+            // the subscriptions renewed meanwhile are still waiting for their baselines
+            for (auto& subscription : m_subscriptions) {
+                auto served = std::any_of(subscriptions.begin(), subscriptions.end(), [&subscription](const Subscription& s) {
+                    return s.id == subscription.id && s.version == subscription.version;
+                });
+
+                subscription.baselineSent = subscription.baselineSent || served;
+            }
+        }
+    } catch (const transport_error_recoverable&) {
+        m_syncBlock.stopSignals.signalError(false);
+
+        throw;
+    } catch (...) {
+        m_syncBlock.stopSignals.signalError();
+
+        throw;
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+RatingGenerationPtr TopRatingFeed::captureTop () {
+    RatingGenerationPtr top;
+
+    m_syncBlock.pinData();
+
+    try {
+        if (m_previousTop && m_previousTop->number == m_coreData.generation) {
+            top = m_previousTop;
+        } else {
+            top = RatingGeneration::capture(m_coreData, DateTime::now(), IpcProto::ProtocolConstants::TopFeedLimits::maxTopPositions);
+        }
+    } catch (...) {
+        m_syncBlock.unpinData();
+
+        throw;
+    }
+
+    m_syncBlock.unpinData();
+
+    return top;
+}
+
+// --------------------------------------------------------------------- //
+
+void TopRatingFeed::sendDiff (BinaryOStream& buffer, BinaryOStream::pos_t base, const Subscription& subscription,
+                              const RatingGeneration& current) {
+    using StorageBuilder = IpcProto::TopRatingDiff::StorageBuilder;
+
+    // the baseline is the diff against an empty top
+    auto baseline = !subscription.baselineSent;
+    const RatingGeneration* previous = baseline ? nullptr : m_previousTop.get();
+    auto currentCount = std::min<size_t>(subscription.topPositions, current.size());
+    auto previousCount = previous ? std::min<size_t>(subscription.topPositions, previous->size()) : 0;
+    unsigned int changeCount {0};
+    buffer_t name;
+
+    // the change count is only known at the end, the header is written over then
+    StorageBuilder::storeDiffHeader(buffer, subscription.id, current.number, static_cast<int>(current.ratingSize),
+                                    static_cast<IpcProto::rating_dimension_t>(subscription.topPositions), baseline, 0);
+
+    for (size_t i = 0; i < currentCount; ++i) {
+        unsigned char flags {0};
+        auto previousPosition = previous ? m_previousPositions.find(current.ids[i]) : m_previousPositions.end();
+
+        if (previousPosition == m_previousPositions.end() || previousPosition->second >= previousCount) {
+            flags = TopChangeFlags::entered;
+        } else {
+            auto j = previousPosition->second;
+
+            flags |= j != i ? TopChangeFlags::moved : 0;
+            flags |= previous->amounts[j] != current.amounts[i] ? TopChangeFlags::amountChanged : 0;
+            flags |= !sameName(*previous, j, current, i) ? TopChangeFlags::renamed : 0;
+        }
+
+        if (!flags) {
+            continue;
+        }
+
+        name.assign(current.names.begin() + current.nameOffsets[i], current.names.begin() + current.nameOffsets[i + 1]);
+
+        StorageBuilder::storeChange(buffer, flags, current.ids[i], static_cast<int>(i), current.amounts[i]
+#ifdef PASS_NAMES_AROUND
+                                    , name
+#endif
+                                    );
+
+        ++changeCount;
+    }
+
+    for (size_t j = 0; j < previousCount; ++j) {
+        auto currentPosition = m_currentPositions.find(previous->ids[j]);
+
+        if (currentPosition != m_currentPositions.end() && currentPosition->second < currentCount) {
+            continue;
+        }
+
+        name.clear();
+
+        StorageBuilder::storeChange(buffer, TopChangeFlags::left, previous->ids[j], static_cast<int>(j), previous->amounts[j]
+#ifdef PASS_NAMES_AROUND
+                                    , name
+#endif
+                                    );
+
+        ++changeCount;
+    }
+
+    if (changeCount || baseline) {
+        auto end = buffer.getPos();
+
+        buffer.setPos(base);
+        StorageBuilder::storeDiffHeader(buffer, subscription.id, current.number, static_cast<int>(current.ratingSize),
+                                        static_cast<IpcProto::rating_dimension_t>(subscription.topPositions), baseline, changeCount);
+        buffer.setPos(end);
+
+        m_transport.blockedWriteExtendedMessage(buffer);
+    }
+
+    buffer.rewind(base);
+}
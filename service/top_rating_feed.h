@@ -0,0 +1,75 @@
+#ifndef IQOPTIONTESTTASK_TOP_RATING_FEED_H
+#define IQOPTIONTESTTASK_TOP_RATING_FEED_H
+
+#include <future>
+#include <vector>
+#include <unordered_map>
+
+#include "core_data.h"
+#include "rating_generation.h"
+#include "../ipc/transport.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  TopRatingFeed class
+ *
+ *  sends the subscribers the changes of the top positions once per recalculation. After every
+ *  recalculation the feed pins the data just long enough to copy the top of the new generation,
+ *  compares it with the top of the previous one and sends each subscriber the diff of as many
+ *  positions as it has asked for, if there's any difference at all
+ */
+// --------------------------------------------------------------------- //
+
+class TopRatingFeed {
+public:
+
+    TopRatingFeed (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock, ServerIpcTransport& transport);
+    ~TopRatingFeed ();
+
+    void start ();
+
+    // ingest shard methods
+
+    // zero positions cancel the subscription
+    void subscribe (IpcProto::request_id_t subscriptionId, unsigned int topPositions);
+
+private:
+
+    struct Subscription {
+        IpcProto::request_id_t id {0};
+        unsigned int topPositions {0};
+        unsigned long long version {0}; // tells a subscription renewed meanwhile from the one a baseline was sent for
+        bool baselineSent {false};
+    };
+
+    using PositionMap = std::unordered_map<id_t, unsigned int>;
+
+private:
+
+    void doWork ();
+
+    RatingGenerationPtr captureTop ();
+    void sendDiff (BinaryOStream& buffer, BinaryOStream::pos_t base, const Subscription& subscription,
+                   const RatingGeneration& current);
+
+private:
+
+    const CoreRatingData& m_coreData;
+    CoreDataSyncBlock& m_syncBlock;
+    ServerIpcTransport& m_transport;
+
+    // guarded by the data lock, the feed waits on the data refresh trigger
+    std::vector<Subscription> m_subscriptions;
+    unsigned long long m_subscriptionVersion {0};
+    bool m_subscriptionsChanged {false};
+    bool m_stopping {false};
+
+    // the top the subscribers have last been told about, and where everyone was in it
+    RatingGenerationPtr m_previousTop;
+    PositionMap m_previousPositions;
+    PositionMap m_currentPositions;
+
+    std::future<void> m_taskHandle;
+};
+
+#endif //IQOPTIONTESTTASK_TOP_RATING_FEED_H
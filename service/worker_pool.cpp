@@ -1,8 +1,36 @@
 #include <iostream>
+#include <thread>
 
 #include "worker_pool.h"
+#include "registered_ids.h"
+#include "subscriber_hub.h"
+#include "../utils/coarse_clock.h"
 #include "../ipc/protocol.h"
 
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and functions
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr int idleSpinRounds {64}; // how many times an idle worker polls its queues before parking
+static constexpr std::chrono::milliseconds workerParkTimeout {100}; // only matters for noticing the stop signals
+static constexpr int interactiveBurstLimit {64}; // how many connect-triggered jobs may delay the announcements in a row
+
+static void storeRatingEntries (BinaryOStream& buffer, const RatingVector& rating, int begin, int end) {
+    using StorageBuilder = IpcProto::RatingPackMessage::StorageBuilder;
+
+    for (auto i = begin; i < end; ++i) {
+        auto userData = rating[i];
+
+        StorageBuilder::storePackEntry(buffer, userData->id, userData->amountWon
+#ifdef PASS_NAMES_AROUND
+                                       , userData->name
+#endif
+                                       );
+    }
+}
+
 // --------------------------------------------------------------------- //
 /*
  *  WorkerPool methods
@@ -10,8 +38,10 @@
 // --------------------------------------------------------------------- //
 
 WorkerPool::WorkerPool (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock,
-                        ServerIpcTransport& transport)
-    : m_coreData(coreData), m_syncBlock(syncBlock), m_transport(transport) {}
+                        const CoarseClock& clock, RatingStampTable& ratingStamps,
+                        ServerIpcTransport& transport, SubscriberHub& subscribers)
+    : m_coreData(coreData), m_syncBlock(syncBlock), m_clock(clock), m_ratingStamps(ratingStamps)
+    , m_transport(transport), m_subscribers(subscribers) {}
 
 // --------------------------------------------------------------------- //
 
@@ -54,14 +84,37 @@ struct RatingBufferData {
     BinaryOStream::pos_t topRatingsEnd {0};
 };
 
+struct ErrorBufferData {
+    ErrorBufferData (BinaryOStream&& b) : buffer{std::move(b)}, base{buffer.getPos()} {}
+
+    BinaryOStream buffer;
+    BinaryOStream::pos_t base;
+};
+
+struct QueryBufferData {
+    QueryBufferData (BinaryOStream&& b) : buffer{std::move(b)}, base{buffer.getPos()} {}
+
+    BinaryOStream buffer;
+    BinaryOStream::pos_t base;
+};
+
+/*
+ *  The connect-triggered rating jobs go first, since there is a user waiting for each of them, while
+ *  the announcements are fine to come a bit later within the slot. Still the worker never serves more
+ *  than interactiveBurstLimit of them in a row, so a connect storm can't hold the announcements back
+ *  for long, and the announcements are served chunk by chunk, so they can't hold the connects back either
+ */
+
 void WorkerPool::doWork (JobQueue::QueueConsumer&& consumer) {
     try {
         RatingBufferData ratingBuffer {m_transport.createAdaptedRatingBuffer()};
-        BinaryOStream errorBuffer {m_transport.createAdaptedErrorBuffer()};
-        auto errorBufferBase = errorBuffer.getPos();
+        ErrorBufferData errorBuffer {m_transport.createAdaptedErrorBuffer()};
+        QueryBufferData queryBuffer {m_transport.createAdaptedQueryResultBuffer()};
 
         cacheTopRatings(ratingBuffer);
 
+        auto idleRounds {0};
+
         for (;;) {
             auto newJobs = false;
 
@@ -70,12 +123,16 @@ void WorkerPool::doWork (JobQueue::QueueConsumer&& consumer) {
             }
 
             if (m_syncBlock.refreshInProgress.load(std::memory_order_relaxed)) {
-                depleteUserDataMessages(ratingBuffer, consumer);
+                // no rating job may outlive the refresh, so helping the others to finish theirs as well
+                depleteRatingChunks(ratingBuffer, errorBuffer, queryBuffer, consumer);
+
+                while (stealRatingChunk(ratingBuffer, consumer)) {}
 
                 {
                     std::unique_lock<std::mutex> lock(m_syncBlock.dataLock);
 
                     m_syncBlock.dataReaderCount.fetch_sub(1, std::memory_order_relaxed);
+                    m_syncBlock.readersGoneTrigger.notify_one();
                     m_syncBlock.dataRefreshedTrigger.wait(lock, [this]()->bool{
                         return !m_syncBlock.refreshInProgress.load(std::memory_order_relaxed);
                     });
@@ -88,47 +145,47 @@ void WorkerPool::doWork (JobQueue::QueueConsumer&& consumer) {
 
             // process error queue first
             {
-                ErrorPtr error {};
+                ProtocolErrorRecord error {};
 
                 while ((error = consumer.dequeueError())) {
-                    processError(errorBuffer, errorBufferBase, error);
+                    processError(errorBuffer, error);
 
                     newJobs = true;
                 }
             }
 
-            // process id-based rating queue
-            {
-                UserIdPromise userIdPromise {UserDataConstants::invalidId, false};
-
-                while ((userIdPromise = consumer.dequeueUserIdPromise()).first != UserDataConstants::invalidId) {
-                    if (!processRating(ratingBuffer, userIdPromise)) {
-                        ErrorPtr error {new IpcProto::UserUnrecognizedError {userIdPromise.first}};
-
-                        processError(errorBuffer, errorBufferBase, error);
-                    }
+            // then the interactive lane, then the periodic one
+            auto someRatingRequestsProcessed = processRatingRequests(ratingBuffer, errorBuffer, queryBuffer, consumer, interactiveBurstLimit);
+            auto someRatingChunksProcessed = depleteRatingChunks(ratingBuffer, errorBuffer, queryBuffer, consumer);
+            newJobs = newJobs || someRatingRequestsProcessed || someRatingChunksProcessed;
 
-                    newJobs = true;
-                }
+            if (!newJobs) {
+                // own queues are empty, trying to take some load off the other workers
+                newJobs = stealRatingChunk(ratingBuffer, consumer);
             }
 
-            auto someUserDataMessagesProcessed = depleteUserDataMessages(ratingBuffer, consumer);
-            newJobs = newJobs || someUserDataMessagesProcessed;
+            if (newJobs) {
+                idleRounds = 0;
+            } else if (++idleRounds < idleSpinRounds) {
+                // thread has nothing to do, letting other threads try before giving up the core
+                std::this_thread::yield();
+            } else {
+                idleRounds = 0;
 
-            if (!newJobs) {
-                // thread has nothing to do, letting other threads try
-                //std::this_thread::yield();
-                std::this_thread::sleep_for(std::chrono::milliseconds{10});
+                park(consumer);
             }
         }
+
+        // stopping, the recalculator must not wait for us anymore
+        releaseDataReader();
     } catch (const transport_error_recoverable&) {
         m_syncBlock.stopSignals.signalError(false);
-        m_syncBlock.dataReaderCount.fetch_sub(1, std::memory_order_relaxed);
+        releaseDataReader();
 
         throw;
     } catch (...) {
         m_syncBlock.stopSignals.signalError();
-        m_syncBlock.dataReaderCount.fetch_sub(1, std::memory_order_relaxed);
+        releaseDataReader();
 
         throw;
     }
@@ -136,12 +193,50 @@ void WorkerPool::doWork (JobQueue::QueueConsumer&& consumer) {
 
 // --------------------------------------------------------------------- //
 
-bool WorkerPool::depleteUserDataMessages (RatingBufferData& bufferData, JobQueue::QueueConsumer &consumer) {
-    const FullUserData* userData = nullptr;
+void WorkerPool::park (JobQueue::QueueConsumer& consumer) {
+    auto waitKey = consumer.prepareWait();
+
+    // the producers and the recalculator notify after changing their state, so anything
+    // happening after this check is guaranteed to wake us up
+    if (consumer.jobsPending() ||
+        m_syncBlock.refreshInProgress.load(std::memory_order_relaxed) ||
+        m_syncBlock.stopSignals.badFlag.load(std::memory_order_relaxed)) {
+        consumer.cancelWait();
+
+        return;
+    }
+
+    consumer.wait(waitKey, workerParkTimeout);
+}
+
+// --------------------------------------------------------------------- //
+
+void WorkerPool::releaseDataReader () {
+    {
+        // the counter is changed under the lock so that the recalculator can't miss the notification
+        std::lock_guard lg(m_syncBlock.dataLock);
+
+        m_syncBlock.dataReaderCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    m_syncBlock.readersGoneTrigger.notify_one();
+}
+
+// --------------------------------------------------------------------- //
+
+bool WorkerPool::processRatingRequests (RatingBufferData& ratingBuffer, ErrorBufferData& errorBuffer, QueryBufferData& queryBuffer,
+                                        JobQueue::QueueConsumer& consumer, int maxCount) {
+    RatingRequest request {};
     auto newJobs {false};
 
-    while ((userData = consumer.dequeueUserData()) != nullptr) {
-        processRating(bufferData, userData);
+    for (auto i = 0; i < maxCount && (request = consumer.dequeueRatingRequest()).userId != UserDataConstants::invalidId; ++i) {
+        consumer.recordWait(JobLane::Interactive, request.enqueuedAt);
+
+        if (request.isQuery) {
+            processQuery(queryBuffer, request);
+        } else if (!processRating(ratingBuffer, request)) {
+            processError(errorBuffer, ProtocolErrorRecord::userUnrecognized(request.userId));
+        }
 
         newJobs = true;
     }
@@ -151,24 +246,70 @@ bool WorkerPool::depleteUserDataMessages (RatingBufferData& bufferData, JobQueue
 
 // --------------------------------------------------------------------- //
 
-void WorkerPool::processRating (RatingBufferData& bufferData, const FullUserData* userData) {
-    processRatingImpl(bufferData, userData->id, userData->rating);
+bool WorkerPool::depleteRatingChunks (RatingBufferData& ratingBuffer, ErrorBufferData& errorBuffer, QueryBufferData& queryBuffer,
+                                      JobQueue::QueueConsumer &consumer) {
+    RatingChunk chunk {};
+    auto newJobs {false};
+
+    while ((chunk = consumer.dequeueRatingChunk()).count != 0) {
+        consumer.recordWait(JobLane::Periodic, chunk.enqueuedAt);
+
+        processRating(ratingBuffer, chunk);
+
+        // letting the connects which have come meanwhile through before the next chunk
+        processRatingRequests(ratingBuffer, errorBuffer, queryBuffer, consumer, interactiveBurstLimit);
+
+        newJobs = true;
+    }
+
+    return newJobs;
 }
 
 // --------------------------------------------------------------------- //
 
-bool WorkerPool::processRating (RatingBufferData& bufferData, UserIdPromise userIdPromise) {
-    auto activeUser = m_coreData.activeUsers.find(userIdPromise.first);
+bool WorkerPool::stealRatingChunk (RatingBufferData& bufferData, JobQueue::QueueConsumer &consumer) {
+    RatingChunk chunk = consumer.stealRatingChunk();
+
+    if (chunk.count == 0) {
+        return false;
+    }
+
+    consumer.recordWait(JobLane::Periodic, chunk.enqueuedAt);
+
+    processRating(bufferData, chunk);
+
+    return true;
+}
+
+// --------------------------------------------------------------------- //
+
+void WorkerPool::processRating (RatingBufferData& bufferData, const RatingChunk& chunk) {
+    auto tick = m_clock.tickCount();
+
+    for (unsigned int i = 0; i < chunk.count; ++i) {
+        const FullUserData* userData = chunk.users[i];
+
+        // the users who have just (re)connected have already got their rating within this tick
+        if (m_ratingStamps.claim(userData->id, tick)) {
+            processRatingImpl(bufferData, userData->id, userData->rating, true);
+        }
+    }
+}
+
+// --------------------------------------------------------------------- //
+
+bool WorkerPool::processRating (RatingBufferData& bufferData, const RatingRequest& request) {
+    auto activeUser = m_coreData.activeUsers.find(request.userId);
 
     if (activeUser != m_coreData.activeUsers.end()) {
-        processRatingImpl(bufferData, activeUser->second->id, activeUser->second->rating);
+        processRatingImpl(bufferData, activeUser->second.id, activeUser->second.rating, false);
 
         return true;
     }
 
-    if (m_coreData.silentUsers.find(userIdPromise.first) != m_coreData.silentUsers.end() || userIdPromise.second) {
+    if (m_coreData.silentUsers.find(request.userId) != m_coreData.silentUsers.end() || request.registeredLately) {
         // user is not in the rating, giving him the "one past the last" place
-        processRatingImpl(bufferData, userIdPromise.first, static_cast<int>(m_coreData.rating.size()));
+        processRatingImpl(bufferData, request.userId, static_cast<int>(m_coreData.rating.size()), false);
 
         return true;
     }
@@ -178,12 +319,50 @@ bool WorkerPool::processRating (RatingBufferData& bufferData, UserIdPromise user
 
 // --------------------------------------------------------------------- //
 
-void WorkerPool::processError (BinaryOStream& buffer, BinaryOStream::pos_t pos, const ErrorPtr& error) {
-    error->store(buffer);
+void WorkerPool::processError (ErrorBufferData& bufferData, const ProtocolErrorRecord& error) {
+    error.store(bufferData.buffer);
+
+    m_transport.blockedWriteMessage(bufferData.buffer);
+
+    bufferData.buffer.rewind(bufferData.base);
+}
+
+// --------------------------------------------------------------------- //
+
+void WorkerPool::processQuery (QueryBufferData& bufferData, const RatingRequest& request) {
+    using StorageBuilder = IpcProto::RatingQueryResult::StorageBuilder;
+
+    const RatingQueryDimensions& query = request.query;
+    auto ratingSize = static_cast<int>(m_coreData.rating.size());
+    auto ratingPos {-1};
+    auto activeUser = m_coreData.activeUsers.find(request.userId);
 
-    m_transport.blockedWriteMessage(buffer);
+    if (activeUser != m_coreData.activeUsers.end()) {
+        ratingPos = activeUser->second.rating;
+    } else if (m_coreData.silentUsers.find(request.userId) != m_coreData.silentUsers.end() || request.registeredLately) {
+        // same as for the connects, a user not in the rating is "one past the last"
+        ratingPos = ratingSize;
+    }
+
+    auto topCount = std::min(static_cast<int>(query.topPositions), ratingSize);
+    auto surroundingsBegin = topCount;
+    auto surroundingsEnd = topCount;
+
+    if (ratingPos >= 0) {
+        surroundingsBegin = std::max(topCount, ratingPos - query.positionsBefore);
+        surroundingsEnd = std::max(surroundingsBegin, std::min(ratingSize, ratingPos + query.positionsAfter + 1));
+    }
+
+    StorageBuilder::storeResultHeader(bufferData.buffer, query.requestId, request.userId, ratingSize, ratingPos,
+                                      static_cast<IpcProto::rating_dimension_t>(topCount), surroundingsBegin,
+                                      static_cast<IpcProto::rating_dimension_t>(surroundingsEnd - surroundingsBegin));
+
+    storeRatingEntries(bufferData.buffer, m_coreData.rating, 0, topCount);
+    storeRatingEntries(bufferData.buffer, m_coreData.rating, surroundingsBegin, surroundingsEnd);
+
+    m_transport.blockedWriteMessage(bufferData.buffer);
 
-    buffer.rewind(pos);
+    bufferData.buffer.rewind(bufferData.base);
 }
 
 // --------------------------------------------------------------------- //
@@ -197,46 +376,33 @@ void WorkerPool::cacheTopRatings (RatingBufferData& bufferData) {
     StorageBuilder::storePackHeader(bufferData.buffer, UserDataConstants::invalidId, 0, 0);
     auto maxTopRating = std::min(topPositions, static_cast<int>(m_coreData.rating.size()));
 
-    for (auto i = 0; i < maxTopRating; ++i) {
-        auto userData = m_coreData.rating[i];
-
-        StorageBuilder::storePackEntry(bufferData.buffer, userData->id, userData->amountWon
-#ifdef PASS_NAMES_AROUND
-                                       , userData->name
-#endif
-                                      );
-    }
+    storeRatingEntries(bufferData.buffer, m_coreData.rating, 0, maxTopRating);
 
     bufferData.topRatingsEnd = bufferData.buffer.getPos();
 }
 
 // --------------------------------------------------------------------- //
 
-void WorkerPool::processRatingImpl (RatingBufferData& bufferData, id_t id, int rating) {
+void WorkerPool::processRatingImpl (RatingBufferData& bufferData, id_t id, int rating, bool periodic) {
     constexpr auto& topPositions = IpcProto::ProtocolConstants::RatingDimensions::topPositions;
     constexpr auto& competitionDistance = IpcProto::ProtocolConstants::RatingDimensions::competitionDistance;
     using StorageBuilder = IpcProto::RatingPackMessage::StorageBuilder;
 
-    assert(rating <= m_coreData.rating.size());
+    assert(rating <= static_cast<int>(m_coreData.rating.size()));
     assert(bufferData.buffer.getPos() == bufferData.topRatingsEnd);
 
     auto ratingRangeBegin = std::max(topPositions, rating - competitionDistance); // that's an element index
     auto ratingRangeEnd = std::min(static_cast<int>(m_coreData.rating.size()), rating + competitionDistance + 1);
 
-    for (auto i = ratingRangeBegin; i < ratingRangeEnd; ++i) {
-        auto userData = m_coreData.rating[i];
-
-        StorageBuilder::storePackEntry(bufferData.buffer, userData->id, userData->amountWon
-#ifdef PASS_NAMES_AROUND
-                                       , userData->name
-#endif
-                                       );
-    }
+    storeRatingEntries(bufferData.buffer, m_coreData.rating, ratingRangeBegin, ratingRangeEnd);
 
     bufferData.buffer.setPos(bufferData.base);
     StorageBuilder::storePackHeader(bufferData.buffer, id, static_cast<int>(m_coreData.rating.size()), rating);
 
-    m_transport.blockedWriteMessage(bufferData.buffer);
+    // the packs of the users owned by the subscribers don't go to the ingest connection
+    if (!m_subscribers.publish(id, bufferData.buffer, periodic)) {
+        m_transport.blockedWriteMessage(bufferData.buffer, id, periodic);
+    }
 
     // buffer must be restored to the "top ratings only" state, otherwise cache will be broken
     bufferData.buffer.rewind(bufferData.topRatingsEnd);
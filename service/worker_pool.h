@@ -9,12 +9,18 @@
 #include "../ipc/transport.h"
 
 struct RatingBufferData;
+struct ErrorBufferData;
+struct QueryBufferData;
+class CoarseClock;
+class RatingStampTable;
+class SubscriberHub;
 
 class WorkerPool {
 public:
 
     WorkerPool (const CoreRatingData& coreData, CoreDataSyncBlock& syncBlock,
-                ServerIpcTransport& transport);
+                const CoarseClock& clock, RatingStampTable& ratingStamps,
+                ServerIpcTransport& transport, SubscriberHub& subscribers);
     ~WorkerPool ();
 
     void start (JobQueue& m_jobQueue);
@@ -22,22 +28,32 @@ public:
 private:
 
     void doWork (JobQueue::QueueConsumer&& consumer);
+    void park (JobQueue::QueueConsumer& consumer);
+    void releaseDataReader ();
 
-    bool depleteUserDataMessages (RatingBufferData& bufferData, JobQueue::QueueConsumer& consumer);
+    bool processRatingRequests (RatingBufferData& ratingBuffer, ErrorBufferData& errorBuffer, QueryBufferData& queryBuffer,
+                                JobQueue::QueueConsumer& consumer, int maxCount);
+    bool depleteRatingChunks (RatingBufferData& ratingBuffer, ErrorBufferData& errorBuffer, QueryBufferData& queryBuffer,
+                              JobQueue::QueueConsumer& consumer);
+    bool stealRatingChunk (RatingBufferData& bufferData, JobQueue::QueueConsumer& consumer);
 
-    void processRating (RatingBufferData& bufferData, const FullUserData* userData);
-    bool processRating (RatingBufferData& bufferData, UserIdPromise userIdPromise);
-    void processError (BinaryOStream& buffer, BinaryOStream::pos_t pos, const ErrorPtr& error);
+    void processRating (RatingBufferData& bufferData, const RatingChunk& chunk);
+    bool processRating (RatingBufferData& bufferData, const RatingRequest& request);
+    void processError (ErrorBufferData& bufferData, const ProtocolErrorRecord& error);
+    void processQuery (QueryBufferData& bufferData, const RatingRequest& request);
 
     void cacheTopRatings (RatingBufferData& bufferData);
 
-    void processRatingImpl (RatingBufferData& bufferData, id_t id, int rating);
+    void processRatingImpl (RatingBufferData& bufferData, id_t id, int rating, bool periodic);
 
 private:
 
     const CoreRatingData& m_coreData;
     CoreDataSyncBlock& m_syncBlock;
+    const CoarseClock& m_clock;
+    RatingStampTable& m_ratingStamps;
     ServerIpcTransport& m_transport;
+    SubscriberHub& m_subscribers;
 
     std::vector<std::future<void>> m_workerHandles;
 };
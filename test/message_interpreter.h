@@ -35,6 +35,10 @@ public:
                     error = std::make_unique<IpcProto::MultipleRegistrationError>();
                     error->init(data);
                     return MessageCode::PROTOCOL_ERROR;
+                case ProtocolError::RATING_QUERY_REJECTED:
+                    error = std::make_unique<IpcProto::RatingQueryRejectedError>();
+                    error->init(data);
+                    return MessageCode::PROTOCOL_ERROR;
                 default: assert(false);
                 }
                 break;
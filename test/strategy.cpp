@@ -19,6 +19,11 @@ enum MessageCode {
     MC_FAKE_USER
 };
 
+// the second of the current minute
+static unsigned char currentSecondIndex () {
+    return static_cast<unsigned char>(DateTime::currentSlotIndex(std::chrono::minutes {1}, std::chrono::seconds {1}));
+}
+
 using MessageRequestList = std::list<MessageCode>;
 using MessageMinuteMap = std::array<MessageRequestList, 60>;
 
@@ -70,7 +75,7 @@ void Strategy::run (const std::string& host, const std::string& port) {
         }
 
         std::this_thread::sleep_until(DateTime::nextFullSecond());
-        auto currentSecond = DateTime::currentSecondIndex();
+        auto currentSecond = currentSecondIndex();
         auto steadyIntervalStart = std::chrono::steady_clock::now();
 
         for (;;) {
@@ -211,7 +216,7 @@ void Strategy::run (const std::string& host, const std::string& port) {
 
             std::this_thread::sleep_until(DateTime::nextFullSecond());
             steadyIntervalStart = std::chrono::steady_clock::now();
-            currentSecond = DateTime::currentSecondIndex();
+            currentSecond = currentSecondIndex();
 
             { std::lock_guard lg(m_dataAccess); m_prevMinData.setNextMinuteData(m_curMinData); }
         }
@@ -317,7 +322,7 @@ void Strategy::processResponses () {
         while (!m_badFlag.load(std::memory_order_relaxed)) {
             BinaryIStream buffer = m_transport.receive(msgStorage);
             IpcProto::message_code_t mc;
-            auto currentSecond = DateTime::currentSecondIndex();
+            auto currentSecond = currentSecondIndex();
 
             buffer >> mc;
 
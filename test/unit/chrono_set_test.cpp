@@ -0,0 +1,114 @@
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include "unit_test.h"
+#include "../../service/core_data.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static std::vector<std::unique_ptr<FullUserData>> makeUsers (int count) {
+    std::vector<std::unique_ptr<FullUserData>> users;
+
+    for (int i = 0; i < count; ++i) {
+        users.push_back(std::make_unique<FullUserData>(i, 0, BasicUserData {}));
+    }
+
+    return users;
+}
+
+// every user in the set is where its index says, and the array has no gaps
+static bool denselyIndexed (const ChronoSet& chronoSet) {
+    for (size_t i = 0; i < chronoSet.size(); ++i) {
+        if (!chronoSet.data()[i] || chronoSet.data()[i]->chronoSetIndex != i) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static std::vector<id_t> idsOf (const ChronoSet& chronoSet) {
+    std::vector<id_t> ids;
+
+    for (size_t i = 0; i < chronoSet.size(); ++i) {
+        ids.push_back(chronoSet.data()[i]->id);
+    }
+
+    std::sort(ids.begin(), ids.end());
+
+    return ids;
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(chronoSetStaysDenseThroughErasures) {
+    auto users = makeUsers(5);
+    ChronoSet chronoSet;
+
+    for (auto& user : users) {
+        chronoSet.insert(user.get());
+    }
+
+    CHECK(chronoSet.size() == 5);
+    CHECK(denselyIndexed(chronoSet));
+
+    // the last user fills the gap in the middle
+    chronoSet.erase(users[1].get());
+
+    CHECK(chronoSet.size() == 4);
+    CHECK(chronoSet.data()[1] == users[4].get());
+    CHECK(denselyIndexed(chronoSet));
+
+    // the last one itself goes without moving anybody
+    chronoSet.erase(users[3].get());
+
+    CHECK((idsOf(chronoSet) == std::vector<id_t> {0, 2, 4}));
+    CHECK(denselyIndexed(chronoSet));
+
+    // a user coming back takes the end
+    chronoSet.insert(users[1].get());
+
+    CHECK(chronoSet.data()[3] == users[1].get());
+    CHECK(denselyIndexed(chronoSet));
+
+    for (auto id : {0, 2, 4, 1}) {
+        chronoSet.erase(users[id].get());
+    }
+
+    CHECK(chronoSet.size() == 0);
+}
+
+UNIT_TEST(chronoSetUsersMoveBetweenSlots) {
+    auto users = makeUsers(100);
+    IterationData iterationData {4};
+
+    for (auto& user : users) {
+        iterationData.usersOnline[user->id % 4].insert(user.get());
+    }
+
+    // every other user reconnects at the next slot, the way the calculator moves them
+    for (auto& user : users) {
+        if (user->id % 2) {
+            iterationData.usersOnline[user->id % 4].erase(user.get());
+            iterationData.usersOnline[(user->id + 1) % 4].insert(user.get());
+        }
+    }
+
+    CHECK(iterationData.usersOnline[0].size() == 50);
+    CHECK(iterationData.usersOnline[1].size() == 0);
+    CHECK(iterationData.usersOnline[2].size() == 50);
+    CHECK(iterationData.usersOnline[3].size() == 0);
+
+    for (const auto& chronoSet : iterationData.usersOnline) {
+        CHECK(denselyIndexed(chronoSet));
+    }
+}
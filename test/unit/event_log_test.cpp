@@ -0,0 +1,282 @@
+#include <fstream>
+
+#include "unit_test.h"
+#include "temporary_path.h"
+#include "../../service/event_log.h"
+#include "../../service/registered_ids.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+template <typename Message>
+static buffer_t messageData (const Message& msg) {
+    BinaryOStream buffer;
+
+    IpcProto::UserMsgCodePrefixer<Message>::prefix(buffer);
+    msg.store(buffer);
+
+    return buffer.storage();
+}
+
+// the header of a block is followed by the messages, each one prefixed with its size
+static uint64_t blockLength (const buffer_t& messageData) {
+    return 32 + sizeof(IpcProto::message_size_t) + messageData.size();
+}
+
+static IncomingDataBuffer& writerBuffer (IncomingDataRing& ring) {
+    return ring.buffers[ring.writerEpoch % IncomingDataRing::size];
+}
+
+// a session of the service: the log is replayed first, then the new messages are logged
+struct LogSession {
+    LogSession (const std::string& path, size_t shardCount)
+    : log {EventLogConfig {path}, stopSignals}, incomingData(shardCount) {}
+
+    void replay (std::vector<sequence_t> applied = {}, uint64_t startOffset = 0) {
+        applied.resize(incomingData.size(), 0);
+        stats = log.replay(incomingData, registeredIds, applied, startOffset);
+    }
+
+    SystemStopSignals stopSignals;
+    EventLog log;
+    IncomingDataShards incomingData;
+    RegisteredIdSet registeredIds;
+    EventLog::ReplayStatistics stats;
+};
+
+// every message goes into a block of its own, returns once they are all written to the file
+static bool logInBlocks (LogSession& session, const std::string& path, const std::vector<buffer_t>& messages) {
+    auto expectedLength = std::filesystem::file_size(path);
+
+    for (const auto& message : messages) {
+        session.log.append(message);
+        session.log.flush();
+
+        expectedLength += blockLength(message);
+    }
+
+    return eventually([&path, expectedLength]() { return std::filesystem::file_size(path) == expectedLength; });
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(eventLogReplaysWhatTheDispatcherWouldBuffer) {
+    TemporaryPath logFile {"unit_event_log_replay.log"};
+
+    {
+        LogSession session {logFile.path(), 2};
+
+        session.replay();
+        session.log.start();
+
+        CHECK(session.log.append(messageData(IpcProto::UserRegisteredMsg {1, std::string {"one"}})) == 1);
+        CHECK(session.log.append(messageData(IpcProto::UserConnectedMsg {1})) == 2);
+        CHECK(session.log.append(messageData(IpcProto::UserDealWonMsg {1, 100})) == 3);
+
+        session.log.flush();
+
+        CHECK(session.log.append(messageData(IpcProto::UserDealWonMsg {2, 50})) == 4);
+        CHECK(session.log.append(messageData(IpcProto::UserRenamedMsg {1, std::string {"uno"}})) == 5);
+        CHECK(session.log.append(messageData(IpcProto::UserDealWonMsg {1, 20})) == 6);
+
+        // the last batch is committed as the log is closed
+    }
+
+    LogSession session {logFile.path(), 2};
+
+    session.replay();
+
+    auto& buffer = writerBuffer(session.incomingData[1]);
+
+    // the connect belongs to a session long gone, while the deal of the user never registered is read but dropped
+    CHECK(session.stats.blocks == 2);
+    CHECK(session.stats.messages == 5);
+    CHECK(session.stats.bytesDiscarded == 0);
+    CHECK(session.registeredIds.contains(1));
+    CHECK(!session.registeredIds.contains(2));
+    CHECK(buffer.usersRegistered.count(1) == 1);
+    CHECK(buffer.connectionChanges.empty());
+    CHECK(buffer.dealsWon.size() == 1);
+    CHECK(buffer.dealsWon[1] == 120);
+    CHECK(buffer.lastSequence == 6);
+#ifdef PASS_NAMES_AROUND
+    CHECK((buffer.usersRenamed[1] == buffer_t {'u', 'n', 'o'}));
+#endif
+    CHECK(writerBuffer(session.incomingData[0]).dealsWon.empty());
+
+    // the numbering goes on where the log has left off
+    CHECK(session.log.append(messageData(IpcProto::UserDealWonMsg {1, 1})) == 7);
+}
+
+UNIT_TEST(eventLogSkipsTheAppliedMessages) {
+    TemporaryPath logFile {"unit_event_log_applied.log"};
+
+    {
+        LogSession session {logFile.path(), 2};
+
+        session.replay();
+        session.log.start();
+
+        session.log.append(messageData(IpcProto::UserRegisteredMsg {1, std::string {"one"}}));
+        session.log.append(messageData(IpcProto::UserRegisteredMsg {2, std::string {"two"}}));
+        session.log.append(messageData(IpcProto::UserDealWonMsg {1, 100}));
+        session.log.append(messageData(IpcProto::UserDealWonMsg {2, 50}));
+        session.log.append(messageData(IpcProto::UserDealWonMsg {1, 20}));
+    }
+
+    // the snapshot has applied the shard of user 1 up to its first deal, and nothing of the other one;
+    // the users it has registered are known before the replay
+    LogSession session {logFile.path(), 2};
+
+    session.registeredIds.insert(1);
+    session.replay({0, 3});
+
+    CHECK(session.stats.messages == 3);
+    CHECK(writerBuffer(session.incomingData[1]).usersRegistered.empty());
+    CHECK(writerBuffer(session.incomingData[1]).dealsWon[1] == 20);
+    CHECK(writerBuffer(session.incomingData[0]).usersRegistered.count(2) == 1);
+    CHECK(writerBuffer(session.incomingData[0]).dealsWon[2] == 50);
+}
+
+UNIT_TEST(eventLogTornTailIsCutOff) {
+    TemporaryPath logFile {"unit_event_log_torn.log"};
+
+    {
+        LogSession session {logFile.path(), 1};
+
+        session.replay();
+        session.log.start();
+
+        session.log.append(messageData(IpcProto::UserRegisteredMsg {1, std::string {"one"}}));
+        session.log.append(messageData(IpcProto::UserDealWonMsg {1, 100}));
+    }
+
+    auto committedLength = std::filesystem::file_size(logFile.path());
+
+    // the crash has left half of a block behind
+    {
+        std::ofstream file {logFile.path(), std::ios::binary | std::ios::app};
+
+        file.write("ELOG-torn", 9);
+    }
+
+    {
+        LogSession session {logFile.path(), 1};
+
+        session.replay();
+
+        CHECK(session.stats.blocks == 1);
+        CHECK(session.stats.bytesDiscarded == 9);
+        CHECK(std::filesystem::file_size(logFile.path()) == committedLength);
+
+        // so the new blocks go right after the last good one
+        session.log.start();
+        session.log.append(messageData(IpcProto::UserDealWonMsg {1, 5}));
+    }
+
+    LogSession session {logFile.path(), 1};
+
+    session.replay();
+
+    CHECK(session.stats.blocks == 2);
+    CHECK(session.stats.bytesDiscarded == 0);
+    CHECK(writerBuffer(session.incomingData[0]).dealsWon[1] == 105);
+}
+
+UNIT_TEST(eventLogReplayStartsWhereTheSnapshotPoints) {
+    TemporaryPath logFile {"unit_event_log_resume.log"};
+    auto lastDeal = messageData(IpcProto::UserDealWonMsg {1, 20});
+    uint64_t resumeOffset {0};
+
+    {
+        LogSession session {logFile.path(), 1};
+
+        session.replay();
+        session.log.start();
+
+        CHECK(logInBlocks(session, logFile.path(), {messageData(IpcProto::UserRegisteredMsg {1, std::string {"one"}}),
+                                                    messageData(IpcProto::UserDealWonMsg {1, 100}), lastDeal}));
+
+        // the snapshot has applied the first two messages, only the last block may hold anything past them;
+        // the blocks are only pointed at once they are synced
+        CHECK(eventually([&session, &resumeOffset, expectedOffset = std::filesystem::file_size(logFile.path()) - blockLength(lastDeal)]() {
+            resumeOffset = session.log.resumeOffset(2);
+
+            return resumeOffset == expectedOffset;
+        }));
+    }
+
+    {
+        LogSession session {logFile.path(), 1};
+
+        session.registeredIds.insert(1);
+        session.replay({2}, resumeOffset);
+
+        CHECK(session.stats.bytesSkipped == resumeOffset);
+        CHECK(session.stats.blocks == 1);
+        CHECK(writerBuffer(session.incomingData[0]).dealsWon[1] == 20);
+    }
+
+    // an offset where no block starts can't be trusted, the log is replayed in full then
+    LogSession session {logFile.path(), 1};
+
+    session.registeredIds.insert(1);
+    session.replay({2}, resumeOffset + 1);
+
+    CHECK(session.stats.bytesSkipped == 0);
+    CHECK(session.stats.blocks == 3);
+    CHECK(session.stats.messages == 1);
+    CHECK(writerBuffer(session.incomingData[0]).dealsWon[1] == 20);
+}
+
+UNIT_TEST(eventLogIsCutOnceASnapshotCoversIt) {
+    TemporaryPath logFile {"unit_event_log_cut.log"};
+    auto lastDeal = messageData(IpcProto::UserDealWonMsg {1, 20});
+    auto nextDeal = messageData(IpcProto::UserDealWonMsg {1, 5});
+    uint64_t resumeOffset {0};
+
+    {
+        LogSession session {logFile.path(), 1};
+
+        session.replay();
+        session.log.start();
+
+        CHECK(logInBlocks(session, logFile.path(), {messageData(IpcProto::UserRegisteredMsg {1, std::string {"one"}}),
+                                                    messageData(IpcProto::UserDealWonMsg {1, 100}), lastDeal}));
+
+        CHECK(eventually([&session, &resumeOffset, expectedOffset = std::filesystem::file_size(logFile.path()) - blockLength(lastDeal)]() {
+            resumeOffset = session.log.resumeOffset(2);
+
+            return resumeOffset == expectedOffset;
+        }));
+
+        // the snapshot is on the disk, the blocks it reflects go at the next commit
+        session.log.discardApplied(2);
+
+        CHECK(eventually([&logFile, &lastDeal]() { return std::filesystem::file_size(logFile.path()) == blockLength(lastDeal); }));
+
+        // and the new ones go right after what's left
+        CHECK(logInBlocks(session, logFile.path(), {nextDeal}));
+    }
+
+    CHECK(std::filesystem::file_size(logFile.path()) == blockLength(lastDeal) + blockLength(nextDeal));
+
+    // the offset the snapshot has got points past the end of the log by now, which makes the replay start over
+    LogSession session {logFile.path(), 1};
+
+    session.registeredIds.insert(1);
+    session.replay({2}, resumeOffset);
+
+    CHECK(session.stats.bytesSkipped == 0);
+    CHECK(session.stats.blocks == 2);
+    CHECK(writerBuffer(session.incomingData[0]).dealsWon[1] == 25);
+    CHECK(writerBuffer(session.incomingData[0]).lastSequence == 4);
+    CHECK(session.log.append(nextDeal) == 5);
+}
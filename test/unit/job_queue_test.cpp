@@ -0,0 +1,172 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "unit_test.h"
+#include "../../service/job_queue.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr int producerCount {4};
+static constexpr int jobsPerProducer {20000};
+
+static RatingRequest ratingRequestFor (id_t userId) {
+    RatingRequest request;
+
+    request.userId = userId;
+
+    return request;
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(boundedQueuesRejectOnceAllAreFull) {
+    JobQueue jobQueue {2, 4};
+    std::vector<int> seen(8, 0);
+
+    for (id_t id = 0; id < 8; ++id) {
+        CHECK(jobQueue.enqueueRatingJob(ratingRequestFor(id)));
+    }
+
+    // every queue is full by now, the job is dropped and counted
+    CHECK(!jobQueue.enqueueRatingJob(ratingRequestFor(8)));
+    CHECK(jobQueue.rejectedJobCount() == 1);
+
+    for (int consumerIndex = 0; consumerIndex < 2; ++consumerIndex) {
+        auto consumer = jobQueue.getConsumer(consumerIndex);
+
+        for (auto request = consumer.dequeueRatingRequest(); request.userId != UserDataConstants::invalidId;
+             request = consumer.dequeueRatingRequest()) {
+            CHECK(request.userId >= 0 && request.userId < 8);
+
+            if (request.userId >= 0 && request.userId < 8) {
+                ++seen[request.userId];
+            }
+        }
+    }
+
+    CHECK((seen == std::vector<int>(8, 1)));
+
+    // the room is back once the consumers have taken the jobs
+    CHECK(jobQueue.enqueueRatingJob(ratingRequestFor(9)));
+}
+
+UNIT_TEST(concurrentProducersAndConsumersLoseNothing) {
+    JobQueue jobQueue {2, 256};
+    std::vector<std::atomic<int>> seen(producerCount * jobsPerProducer);
+    std::atomic<int> consumed {0};
+    std::vector<std::thread> threads;
+
+    for (int producer = 0; producer < producerCount; ++producer) {
+        threads.emplace_back([&jobQueue, producer]() {
+            for (int i = 0; i < jobsPerProducer; ++i) {
+                // a full queue is the producer's problem, this one just tries again
+                while (!jobQueue.enqueueRatingJob(ratingRequestFor(producer * jobsPerProducer + i))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    for (int consumerIndex = 0; consumerIndex < 2; ++consumerIndex) {
+        threads.emplace_back([&jobQueue, &seen, &consumed, consumerIndex]() {
+            auto consumer = jobQueue.getConsumer(consumerIndex);
+
+            while (consumed.load() < producerCount * jobsPerProducer) {
+                auto request = consumer.dequeueRatingRequest();
+
+                if (request.userId == UserDataConstants::invalidId) {
+                    std::this_thread::yield();
+
+                    continue;
+                }
+
+                seen[request.userId].fetch_add(1);
+                consumed.fetch_add(1);
+            }
+        });
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto allOnce {true};
+
+    for (const auto& count : seen) {
+        allOnce = allOnce && count.load() == 1;
+    }
+
+    CHECK(allOnce);
+    CHECK(consumed.load() == producerCount * jobsPerProducer);
+}
+
+UNIT_TEST(rangeStaysTogetherForTheIdleWorkerToSteal) {
+    JobQueue jobQueue {2, 64};
+    std::vector<const FullUserData*> users(1000, nullptr);
+
+    CHECK(jobQueue.enqueueRatingChunks(users.data(), users.size()) == users.size());
+
+    auto first = jobQueue.getConsumer(0);
+    auto second = jobQueue.getConsumer(1);
+
+    // the whole range went into one of the packs, the other consumer only gets to it by stealing
+    auto ownChunk = first.dequeueRatingChunk();
+    auto& owner = ownChunk.count ? first : second;
+    auto& thief = ownChunk.count ? second : first;
+
+    if (!ownChunk.count) {
+        ownChunk = owner.dequeueRatingChunk();
+    }
+
+    CHECK(ownChunk.users == users.data());
+    CHECK(ownChunk.count == JobQueue::ratingChunkSize);
+    CHECK(thief.dequeueRatingChunk().count == 0);
+    CHECK(thief.jobsPending());
+
+    size_t stolenCount {0};
+    auto nextUser = users.data() + ownChunk.count;
+
+    for (auto chunk = thief.stealRatingChunk(); chunk.count; chunk = thief.stealRatingChunk()) {
+        // the chunks come in the range order, the stolen ones just as the owned ones
+        CHECK(chunk.users == nextUser);
+
+        nextUser += chunk.count;
+        stolenCount += chunk.count;
+    }
+
+    CHECK(stolenCount == users.size() - JobQueue::ratingChunkSize);
+    CHECK(!thief.jobsPending());
+    CHECK(owner.dequeueRatingChunk().count == 0);
+}
+
+UNIT_TEST(rangeSpillsOverAndTheRestIsDeferred) {
+    JobQueue jobQueue {2, 2};
+    std::vector<const FullUserData*> users(1500, nullptr);
+
+    // two chunks fit into every pack, the rest is for the caller to hand over again
+    CHECK(jobQueue.enqueueRatingChunks(users.data(), users.size()) == 4 * JobQueue::ratingChunkSize);
+    CHECK(jobQueue.deferredJobCount() == 2);
+    CHECK(jobQueue.rejectedJobCount() == 0);
+
+    auto consumer = jobQueue.getConsumer(0);
+    size_t takenCount {0};
+
+    for (auto chunk = consumer.dequeueRatingChunk(); chunk.count; chunk = consumer.dequeueRatingChunk()) {
+        takenCount += chunk.count;
+    }
+
+    for (auto chunk = consumer.stealRatingChunk(); chunk.count; chunk = consumer.stealRatingChunk()) {
+        takenCount += chunk.count;
+    }
+
+    CHECK(takenCount == 4 * JobQueue::ratingChunkSize);
+}
@@ -0,0 +1,74 @@
+#ifndef IQOPTIONTESTTASK_LOOPBACK_TRANSPORT_H
+#define IQOPTIONTESTTASK_LOOPBACK_TRANSPORT_H
+
+#include <string>
+#include <future>
+#include <optional>
+
+#include "unit_test.h"
+#include "../../ipc/transport.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  LoopbackTransport class
+ *
+ *  the service transport with a client connected to it over the loopback interface, handshake
+ *  done and the writer thread running, the way the overseer has it. The tests play the client
+ */
+// --------------------------------------------------------------------- //
+
+class LoopbackTransport {
+public:
+
+    using ServiceMessageCode = IpcProto::ProtocolConstants::ServiceMessageCode;
+
+public:
+
+    explicit LoopbackTransport (unsigned short port, const OutboundPolicy& outboundPolicy = OutboundPolicy {})
+    : m_server {std::make_unique<Spinlock>(), outboundPolicy} {
+        auto accepted = std::async(std::launch::async, [this, port]() { m_server.launch(port); });
+
+        // the client may well be ahead of the acceptor
+        for (auto attempt = 0; ; ++attempt) {
+            try {
+                m_client.launch("127.0.0.1", std::to_string(port));
+
+                break;
+            } catch (const asio::system_error&) {
+                if (attempt == 100) {
+                    throw;
+                }
+
+                std::this_thread::sleep_for(std::chrono::milliseconds {10});
+            }
+        }
+
+        accepted.get();
+    }
+
+    ServerIpcTransport& server () { return m_server; }
+    ClientIpcTransport& client () { return m_client; }
+
+    // the next message the service has sent, its code read off already; nothing if none comes in time
+    std::optional<BinaryIStream> receive (buffer_t& storage, ServiceMessageCode& code,
+                                          std::chrono::milliseconds timeout = std::chrono::seconds {5}) {
+        if (!eventually([this]() { return m_client.dataPending(); }, timeout)) {
+            return std::nullopt;
+        }
+
+        BinaryIStream message = m_client.receive(storage);
+        IpcProto::message_code_t messageCode {IpcProto::ProtocolConstants::invalidMessageCode};
+
+        message >> messageCode;
+        code = static_cast<ServiceMessageCode>(messageCode);
+
+        return std::optional<BinaryIStream> {std::move(message)};
+    }
+
+private:
+
+    ServerIpcTransport m_server;
+    ClientIpcTransport m_client;
+};
+
+#endif //IQOPTIONTESTTASK_LOOPBACK_TRANSPORT_H
@@ -0,0 +1,34 @@
+#include <iostream>
+#include <exception>
+
+#include "unit_test.h"
+
+int main () {
+    auto failedTests {0u};
+
+    for (const auto& test : unitTests()) {
+        auto failuresBefore = unitTestFailures();
+
+        try {
+            test.body();
+        } catch (const std::exception& e) {
+            ++unitTestFailures();
+
+            std::cerr << test.name << ": exception: " << e.what() << std::endl;
+        } catch (...) {
+            ++unitTestFailures();
+
+            std::cerr << test.name << ": unknown exception" << std::endl;
+        }
+
+        auto passed = unitTestFailures() == failuresBefore;
+
+        failedTests += passed ? 0 : 1;
+
+        std::cout << (passed ? "[ OK ] " : "[FAIL] ") << test.name << std::endl;
+    }
+
+    std::cout << unitTests().size() - failedTests << " of " << unitTests().size() << " tests passed" << std::endl;
+
+    return failedTests ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+#include "unit_test.h"
+#include "../../service/message_dispatcher.h"
+#include "../../service/job_queue.h"
+#include "../../service/registered_ids.h"
+#include "../../service/rating_streamer.h"
+#include "../../service/top_rating_feed.h"
+#include "../../utils/coarse_clock.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+// a slot that long never ends while a test runs
+static constexpr std::chrono::hours testSlot {24};
+
+// the streamer and the feed are never started, the transport is never connected
+struct DispatcherFixture {
+    JobQueue jobQueue {1, 4};
+    IncomingDataBuffer buffer;
+    CoarseClock clock {testSlot, testSlot};
+    RegisteredIdSet registeredIds;
+    RatingStampTable ratingStamps;
+    CoreRatingData data;
+    CoreDataSyncBlock syncBlock;
+    ServerIpcTransport transport {std::make_unique<Spinlock>()};
+    RatingStreamer streamer {data, syncBlock, transport};
+    TopRatingFeed topFeed {data, syncBlock, transport};
+    MessageDispatcher dispatcher {jobQueue, buffer, clock, registeredIds, ratingStamps, streamer, topFeed};
+
+    void registerUser (id_t id) {
+        dispatcher.dispatch(IpcProto::UserRegisteredMsg {id, std::string {"user"}});
+    }
+
+    ProtocolErrorRecord nextError () {
+        return jobQueue.getConsumer(0).dequeueError();
+    }
+
+    RatingRequest nextRatingRequest () {
+        return jobQueue.getConsumer(0).dequeueRatingRequest();
+    }
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(registeredIdsSpanTheSegments) {
+    RegisteredIdSet registeredIds;
+
+    for (id_t id : {0, 63, 64, 65535, 65536, 1 << 30}) {
+        registeredIds.insert(id);
+    }
+
+    for (id_t id : {0, 63, 64, 65535, 65536, 1 << 30}) {
+        CHECK(registeredIds.contains(id));
+    }
+
+    // the neighbours in the same words and segments, and a segment never touched
+    for (id_t id : {1, 62, 65, 65534, 65537, (1 << 30) + 1, 1 << 20}) {
+        CHECK(!registeredIds.contains(id));
+    }
+}
+
+UNIT_TEST(messagesAboutUnknownUsersAreRejected) {
+    DispatcherFixture f;
+
+    f.dispatcher.dispatch(IpcProto::UserConnectedMsg {5});
+    f.dispatcher.dispatch(IpcProto::UserDealWonMsg {5, 100});
+    f.dispatcher.dispatch(IpcProto::UserRenamedMsg {5, std::string {"x"}});
+    f.dispatcher.dispatch(IpcProto::UserDisconnectedMsg {5});
+
+    // none of them gets into the buffer, each one is answered with an error instead
+    CHECK(f.buffer.connectionChanges.empty());
+    CHECK(f.buffer.dealsWon.empty());
+    CHECK(f.buffer.usersRenamed.empty());
+    CHECK(f.nextRatingRequest().userId == UserDataConstants::invalidId);
+
+    for (int i = 0; i < 4; ++i) {
+        auto error = f.nextError();
+
+        CHECK(error.code == IpcProto::ProtocolConstants::ProtocolError::USER_UNRECOGNIZED);
+        CHECK(error.userId == 5);
+    }
+
+    CHECK(!f.nextError());
+}
+
+UNIT_TEST(messagesAboutRegisteredUsersPassThrough) {
+    DispatcherFixture f;
+
+    f.registerUser(5);
+    f.dispatcher.dispatch(IpcProto::UserDealWonMsg {5, 100});
+    f.dispatcher.dispatch(IpcProto::UserConnectedMsg {5});
+
+    CHECK(f.registeredIds.contains(5));
+    CHECK(f.buffer.usersRegistered.count(5) == 1);
+    CHECK(f.buffer.dealsWon[5] == 100);
+    CHECK(f.buffer.connectionChanges.count(5) == 1);
+    CHECK(f.nextRatingRequest().userId == 5);
+    CHECK(!f.nextError());
+}
+
+UNIT_TEST(ratingStampsClaimOncePerTick) {
+    RatingStampTable ratingStamps;
+
+    CHECK(ratingStamps.claim(1, 10));
+    CHECK(!ratingStamps.claim(1, 10));
+    CHECK(ratingStamps.claim(2, 10));
+    CHECK(ratingStamps.claim(1, 11));
+
+    // a released claim can be made again within the same tick
+    ratingStamps.release(1, 11);
+
+    CHECK(ratingStamps.claim(1, 11));
+
+    // but a release for a tick gone by leaves the newer claim alone
+    CHECK(ratingStamps.claim(2, 12));
+
+    ratingStamps.release(2, 10);
+
+    CHECK(!ratingStamps.claim(2, 12));
+}
+
+UNIT_TEST(reconnectsWithinATickGetOneRating) {
+    DispatcherFixture f;
+
+    f.registerUser(5);
+
+    for (int i = 0; i < 3; ++i) {
+        f.dispatcher.dispatch(IpcProto::UserConnectedMsg {5});
+        f.dispatcher.dispatch(IpcProto::UserDisconnectedMsg {5});
+    }
+
+    f.dispatcher.dispatch(IpcProto::UserConnectedMsg {5});
+
+    // the connection changes still get through, only the rating is held back
+    CHECK(f.buffer.connectionChanges.count(5) == 1);
+    CHECK(f.buffer.connectionChanges[5] != UserDataConstants::invalidSlot);
+    CHECK(f.nextRatingRequest().userId == 5);
+    CHECK(f.nextRatingRequest().userId == UserDataConstants::invalidId);
+}
+
+UNIT_TEST(rejectedConnectReleasesTheRatingStamp) {
+    DispatcherFixture f;
+
+    for (id_t id = 1; id <= 5; ++id) {
+        f.registerUser(id);
+        f.dispatcher.dispatch(IpcProto::UserConnectedMsg {id});
+    }
+
+    // the queue only has room for four, the fifth connect has nothing sent for it
+    CHECK(f.jobQueue.rejectedJobCount() == 1);
+
+    for (id_t id = 1; id <= 4; ++id) {
+        CHECK(f.nextRatingRequest().userId == id);
+    }
+
+    f.dispatcher.dispatch(IpcProto::UserConnectedMsg {5});
+    f.dispatcher.dispatch(IpcProto::UserConnectedMsg {4});
+
+    // so the user gets its rating on the next connect within the tick, unlike the ones already served
+    CHECK(f.nextRatingRequest().userId == 5);
+    CHECK(f.nextRatingRequest().userId == UserDataConstants::invalidId);
+}
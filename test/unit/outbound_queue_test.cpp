@@ -0,0 +1,137 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "unit_test.h"
+#include "../../ipc/outbound_queue.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr size_t messageSize {60};
+static constexpr std::chrono::milliseconds settleTime {100}; // how long a blocked producer is given to show it stays blocked
+
+static OutboundPolicy policyOf (size_t bufferSize, std::chrono::milliseconds maxBlockTime) {
+    OutboundPolicy policy;
+
+    policy.bufferSize = bufferSize;
+    policy.maxBlockTime = maxBlockTime;
+
+    return policy;
+}
+
+static buffer_t messageOf (unsigned char tag, size_t size = messageSize) {
+    return buffer_t(size, tag);
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(outboundPushWaitsForTheWriter) {
+    Spinlock lock;
+    OutboundQueue queue {lock, policyOf(100, std::chrono::seconds {5})};
+    std::vector<buffer_t> batch;
+
+    CHECK(queue.push(messageOf(1)));
+    CHECK(queue.pop(batch) && batch.size() == 1);
+
+    // the batch being written still counts against the buffer size
+    std::atomic<bool> pushed {false};
+    std::thread producer([&queue, &pushed]() {
+        pushed = queue.push(messageOf(2));
+    });
+
+    CHECK(!eventually([&pushed]() { return pushed.load(); }, settleTime));
+    CHECK(queue.statistics().depth == messageSize);
+
+    // the writer coming back for more makes the room
+    CHECK(queue.pop(batch) && batch.size() == 1 && batch.front() == messageOf(2));
+
+    producer.join();
+
+    auto stats = queue.statistics();
+
+    CHECK(pushed.load());
+    CHECK(stats.blockedPushes == 1 && !stats.overflown);
+    CHECK(stats.messages == 2 && stats.peakDepth == messageSize);
+}
+
+UNIT_TEST(outboundOverflowClosesTheQueue) {
+    Spinlock lock;
+    OutboundQueue queue {lock, policyOf(100, std::chrono::milliseconds::zero())};
+    std::vector<buffer_t> batch;
+
+    // a message larger than the whole buffer goes through alone
+    CHECK(queue.push(messageOf(1, 150)));
+    CHECK(queue.pop(batch) && batch.size() == 1);
+
+    // without the block time the connection is dropped right away
+    CHECK(!queue.push(messageOf(2)));
+    CHECK(queue.statistics().overflown);
+
+    // and stays dropped, whatever room there is
+    CHECK(!queue.pop(batch));
+    CHECK(!queue.push(messageOf(3, 1)));
+}
+
+UNIT_TEST(outboundPinnedPushWaitsBriefly) {
+    Spinlock lock;
+    OutboundQueue queue {lock, policyOf(100, std::chrono::seconds {5})};
+
+    CHECK(queue.push(messageOf(1)));
+
+    auto startedAt = std::chrono::steady_clock::now();
+
+    // nobody writes, the worker gives up well before the block time of the others
+    CHECK(!queue.push(messageOf(2), 7, true, true));
+    CHECK(std::chrono::steady_clock::now() - startedAt < std::chrono::seconds {2});
+
+    auto stats = queue.statistics();
+
+    CHECK(stats.overflown && stats.blockedPushes == 1);
+    CHECK(stats.blockedTime >= OutboundPolicy::maxPinnedBlockTime);
+}
+
+UNIT_TEST(outboundStalePacksAreDropped) {
+    Spinlock lock;
+    OutboundQueue queue {lock, policyOf(1000, std::chrono::milliseconds::zero())};
+    std::vector<buffer_t> batch;
+
+    // a newer periodic pack replaces the one still waiting
+    CHECK(queue.push(messageOf(1), 7, true));
+    CHECK(queue.push(messageOf(2), 7, true));
+
+    // the packs a user waits for are never dropped
+    CHECK(queue.push(messageOf(3), 8, false));
+    CHECK(queue.push(messageOf(4), 8, true));
+
+    // nor are the other messages
+    CHECK(queue.push(messageOf(5)));
+    CHECK(queue.push(messageOf(6)));
+
+    auto stats = queue.statistics();
+
+    CHECK(stats.stalePacksDropped == 1);
+    CHECK(stats.depth == 5 * messageSize);
+
+    CHECK(queue.pop(batch) && batch.size() == 6);
+    CHECK(batch.size() == 6 && batch[0].empty());
+
+    for (size_t i = 1; i < batch.size(); ++i) {
+        CHECK(batch[i] == messageOf(static_cast<unsigned char>(i + 1)));
+    }
+
+    // a pack already taken by the writer is out of reach
+    CHECK(queue.push(messageOf(7), 7, true));
+    CHECK(queue.statistics().stalePacksDropped == 1);
+
+    queue.close();
+
+    CHECK(!queue.pop(batch));
+}
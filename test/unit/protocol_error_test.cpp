@@ -0,0 +1,66 @@
+#include "unit_test.h"
+#include "../../ipc/protocol.h"
+
+using namespace IpcProto;
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static buffer_t storedRecord (const ProtocolErrorRecord& record) {
+    BinaryOStream stream;
+
+    record.store(stream);
+
+    return stream.storage();
+}
+
+static buffer_t storedError (const GenericProtocolError& error) {
+    BinaryOStream stream;
+
+    error.store(stream);
+
+    return stream.storage();
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(defaultErrorRecordHoldsNoError) {
+    ProtocolErrorRecord record {};
+
+    CHECK(!record);
+    CHECK(ProtocolErrorRecord::userUnrecognized(1));
+    CHECK(ProtocolErrorRecord::multipleRegistration(1));
+    CHECK(ProtocolErrorRecord::ratingQueryRejected(1, 2));
+    CHECK(ProtocolErrorRecord::protocolVersionUnsupported());
+}
+
+UNIT_TEST(errorRecordsAreStoredAsTheErrorClasses) {
+    CHECK(storedRecord(ProtocolErrorRecord::userUnrecognized(42)) == storedError(UserUnrecognizedError {42}));
+    CHECK(storedRecord(ProtocolErrorRecord::multipleRegistration(42)) == storedError(MultipleRegistrationError {42}));
+    CHECK(storedRecord(ProtocolErrorRecord::ratingQueryRejected(42, 7))
+          == storedError(RatingQueryRejectedError {42, 7}));
+    CHECK(storedRecord(ProtocolErrorRecord::protocolVersionUnsupported())
+          == storedError(UnsupportedProtocolVersionError {}));
+}
+
+UNIT_TEST(errorRecordsReadBackThroughTheErrorClasses) {
+    auto data = storedRecord(ProtocolErrorRecord::ratingQueryRejected(42, 7));
+    BinaryIStream stream {data};
+    error_code_t code {0};
+    RatingQueryRejectedError error;
+
+    stream >> code;
+    error.init(stream);
+
+    CHECK(code == static_cast<error_code_t>(ProtocolConstants::ProtocolError::RATING_QUERY_REJECTED));
+    CHECK(error.getUserId() == 42);
+    CHECK(error.getRequestId() == 7);
+    CHECK(stream.getPos() == data.size());
+}
@@ -0,0 +1,236 @@
+#include <thread>
+
+#include "unit_test.h"
+#include "../../service/rating_calculator.h"
+#include "../../service/job_queue.h"
+#include "../../service/rating_generation.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr unsigned int testSlotCount {60};
+
+// acknowledges the epochs the way the ingest shard thread does, unless told to lag behind
+class ShardWriterStub {
+public:
+
+    explicit ShardWriterStub (IncomingDataRing& ring) : m_ring {ring} {
+        m_taskHandle = std::thread {&ShardWriterStub::doWork, this};
+    }
+
+    ~ShardWriterStub () {
+        {
+            std::lock_guard lg(m_ring.lock);
+
+            m_stopping = true;
+        }
+
+        m_ring.writerTrigger.notify_one();
+        m_taskHandle.join();
+    }
+
+    void lag (bool lagging) {
+        {
+            std::lock_guard lg(m_ring.lock);
+
+            m_lagging = lagging;
+        }
+
+        m_ring.writerTrigger.notify_one();
+    }
+
+    // the buffer of the epoch the writer is in, only to be filled between the recalculations
+    IncomingDataBuffer& buffer () {
+        std::lock_guard lg(m_ring.lock);
+
+        return m_ring.buffers[m_ring.writerEpoch % IncomingDataRing::size];
+    }
+
+private:
+
+    void doWork () {
+        std::unique_lock<std::mutex> lock(m_ring.lock);
+
+        for (;;) {
+            m_ring.writerTrigger.wait(lock, [this]()->bool{
+                return m_stopping || (!m_lagging && m_ring.publishedEpoch != m_ring.writerEpoch);
+            });
+
+            if (m_stopping) {
+                break;
+            }
+
+            m_ring.writerEpoch = m_ring.publishedEpoch;
+            m_ring.epochAcknowledged.notify_one();
+        }
+    }
+
+private:
+
+    IncomingDataRing& m_ring;
+
+    bool m_stopping {false};
+    bool m_lagging {false};
+
+    std::thread m_taskHandle;
+};
+
+struct CalculatorFixture {
+    CoreRatingData data;
+    CoreDataSyncBlock syncBlock;
+    IterationData iterationData {testSlotCount};
+    IncomingDataShards incomingData = IncomingDataShards(1);
+    JobQueue jobQueue {1, 1024};
+    RatingCalculator calculator {data, syncBlock, iterationData, incomingData, jobQueue, nullptr};
+    ShardWriterStub writer {incomingData[0]};
+
+    void registerUser (id_t id) {
+#ifdef PASS_NAMES_AROUND
+        writer.buffer().usersRegistered.emplace(id, buffer_t {'u', static_cast<unsigned char>('0' + id)});
+#else
+        writer.buffer().usersRegistered.insert(id);
+#endif
+    }
+
+    monetary_t amountOf (id_t id) {
+        auto activeUser = data.activeUsers.find(id);
+
+        return activeUser == data.activeUsers.end() ? 0 : activeUser->second.amountWon;
+    }
+
+    bool ratingConsistent () {
+        if (data.rating.size() != data.activeUsers.size()) {
+            return false;
+        }
+
+        for (size_t i = 0; i < data.rating.size(); ++i) {
+            if (data.rating[i]->rating != static_cast<int>(i) || (i && data.rating[i - 1]->amountWon < data.rating[i]->amountWon)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(ringHandoffDrainsTheAcknowledgedEpoch) {
+    CalculatorFixture f;
+
+    f.registerUser(1);
+    f.registerUser(2);
+    f.writer.buffer().dealsWon[1] = 100;
+    f.writer.buffer().dealsWon[2] = 300;
+
+    f.calculator.recalculate(false);
+
+    CHECK(f.incomingData[0].writerEpoch == 1);
+    CHECK(f.incomingData[0].drainedEpoch == 1);
+    CHECK(f.data.rating.size() == 2);
+    CHECK(f.data.rating[0]->id == 2);
+    CHECK(f.ratingConsistent());
+
+    // the next epoch's buffer is filled and drained the same way
+    f.writer.buffer().dealsWon[1] = 250;
+
+    f.calculator.recalculate(false);
+
+    CHECK(f.data.rating[0]->id == 1);
+    CHECK(f.amountOf(1) == 350);
+    CHECK(f.ratingConsistent());
+}
+
+UNIT_TEST(ringHandoffMissedByTheWriter) {
+    CalculatorFixture f;
+
+    f.registerUser(1);
+    f.registerUser(2);
+    f.registerUser(3);
+    f.writer.buffer().dealsWon[1] = 100;
+
+    f.calculator.recalculate(false);
+
+    // the writer misses the next handoff and keeps writing into its buffer, nothing gets drained
+    f.writer.lag(true);
+    f.writer.buffer().dealsWon[1] = 10;
+    f.writer.buffer().dealsWon[2] = 50;
+    f.writer.buffer().connectionChanges[2] = 5;
+
+    f.calculator.recalculate(false);
+
+    CHECK(f.incomingData[0].drainedEpoch == 1);
+    CHECK(f.amountOf(1) == 100);
+    CHECK(f.data.rating.size() == 1);
+
+    // it switches over late, and the recalculation after that drains both of its buffers at once
+    {
+        std::lock_guard lg(f.incomingData[0].lock);
+
+        f.incomingData[0].writerEpoch = f.incomingData[0].publishedEpoch;
+    }
+
+    f.writer.lag(false);
+    f.writer.buffer().dealsWon[1] = 20;
+    f.writer.buffer().dealsWon[2] = 5;
+    f.writer.buffer().dealsWon[3] = 7;
+    f.writer.buffer().connectionChanges[2] = 7;
+
+    f.calculator.recalculate(false);
+
+    CHECK(f.incomingData[0].drainedEpoch == 3);
+    CHECK(f.amountOf(1) == 130);
+    CHECK(f.amountOf(2) == 55);
+    CHECK(f.amountOf(3) == 7);
+    CHECK(f.data.rating.size() == 3);
+    CHECK(f.ratingConsistent());
+    CHECK(f.iterationData.usersOnline[5].size() == 0);
+    CHECK(f.iterationData.usersOnline[7].size() == 1);
+}
+
+#ifdef PASS_NAMES_AROUND
+UNIT_TEST(generationNamesStayAsCaptured) {
+    CalculatorFixture f;
+    buffer_t names;
+    std::vector<uint32_t> nameOffsets;
+
+    f.registerUser(1);
+    f.registerUser(2);
+    f.writer.buffer().dealsWon[1] = 100;
+    f.writer.buffer().dealsWon[2] = 50;
+
+    f.calculator.recalculate(false);
+
+    auto generation = RatingGeneration::capture(f.data, chrono_t {}, SIZE_MAX, false);
+
+    // renamed twice after the capture, once in the rating and once out of it
+    f.writer.buffer().usersRenamed[1] = buffer_t {'x'};
+
+    f.calculator.recalculate(false);
+
+    f.writer.buffer().usersRenamed[1] = buffer_t {'y', 'y'};
+
+    f.calculator.recalculate(true);
+
+    generation->resolveNames(f.data, 0, generation->size(), names, nameOffsets);
+
+    CHECK((names == buffer_t {'u', '1', 'u', '2'}));
+    CHECK((nameOffsets == std::vector<uint32_t> {0, 2, 4}));
+    CHECK(f.data.nameHistory.nameAt(1, generation->number) != nullptr);
+
+    // a generation captured later sees the latest name, and nothing is kept once the old one is gone
+    auto laterGeneration = RatingGeneration::capture(f.data, chrono_t {}, SIZE_MAX, false);
+
+    generation.reset();
+    f.calculator.recalculate(false);
+
+    CHECK(f.data.nameHistory.nameAt(1, laterGeneration->number) == nullptr);
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef IQOPTIONTESTTASK_RATING_FIXTURE_H
+#define IQOPTIONTESTTASK_RATING_FIXTURE_H
+
+#include <vector>
+#include <utility>
+
+#include "../../service/core_data.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Rating fixture
+ *
+ *  a recalculation in miniature for the tests of the occasional readers: the readers which
+ *  have pinned the data are waited out, then the rated users get the amounts given, in that order,
+ *  as a new generation. The users left out stay in the directory, just out of the rating
+ */
+// --------------------------------------------------------------------- //
+
+using RatingEntries = std::vector<std::pair<id_t, monetary_t>>;
+
+inline void recalculateAs (CoreRatingData& data, CoreDataSyncBlock& syncBlock, const RatingEntries& rating) {
+    {
+        std::unique_lock<std::mutex> lock(syncBlock.dataLock);
+
+        // the new readers wait for the lock meanwhile
+        syncBlock.readersGoneTrigger.wait(lock, [&syncBlock]()->bool{
+            return syncBlock.dataReaderCount.load(std::memory_order_relaxed) == 0;
+        });
+
+        data.rating.clear();
+
+        for (const auto& [id, amount] : rating) {
+            FullUserData& userData = data.activeUsers.try_emplace(id, id, amount, BasicUserData {}).first->second;
+
+            userData.amountWon = amount;
+            userData.rating = static_cast<int>(data.rating.size());
+            data.rating.push_back(&userData);
+        }
+
+        ++data.generation;
+    }
+
+    syncBlock.dataRefreshedTrigger.notify_all();
+}
+
+#endif //IQOPTIONTESTTASK_RATING_FIXTURE_H
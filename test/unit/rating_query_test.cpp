@@ -0,0 +1,216 @@
+#include "unit_test.h"
+#include "loopback_transport.h"
+#include "../../service/worker_pool.h"
+#include "../../service/message_dispatcher.h"
+#include "../../service/registered_ids.h"
+#include "../../service/rating_streamer.h"
+#include "../../service/top_rating_feed.h"
+#include "../../service/subscriber_hub.h"
+#include "../../utils/coarse_clock.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr unsigned short testPort {47461};
+static constexpr std::chrono::hours testSlot {24};
+static constexpr int ratedUserCount {10};
+static constexpr id_t silentUserId {50};
+
+using ServiceMessageCode = IpcProto::ProtocolConstants::ServiceMessageCode;
+using Limits = IpcProto::ProtocolConstants::RatingQueryLimits;
+
+// the users 1 to 10 in this order in the rating, and one registered user not in it; the workers are only
+// started once the test is done queueing, so it can overflow the queue on purpose
+struct QueryFixture {
+    QueryFixture () {
+        for (id_t id = 1; id <= ratedUserCount; ++id) {
+            FullUserData& userData = data.activeUsers.try_emplace(id, id, (ratedUserCount + 1 - id) * 100, BasicUserData {}).first->second;
+
+            userData.rating = static_cast<int>(data.rating.size());
+            data.rating.push_back(&userData);
+            registeredIds.insert(id);
+        }
+
+        data.silentUsers.emplace(silentUserId, BasicUserData {});
+        registeredIds.insert(silentUserId);
+    }
+
+    ~QueryFixture () {
+        syncBlock.stopSignals.signalError(false);
+        jobQueue.wakeConsumers();
+    }
+
+    void query (id_t id, IpcProto::request_id_t requestId, IpcProto::rating_dimension_t top,
+                IpcProto::rating_dimension_t before, IpcProto::rating_dimension_t after) {
+        dispatcher.dispatch(IpcProto::GetRatingMsg {id, requestId, top, before, after});
+    }
+
+    std::optional<IpcProto::RatingQueryResult> nextResult () {
+        buffer_t storage;
+        ServiceMessageCode code {};
+        auto message = loopback.receive(storage, code);
+
+        if (!message || code != ServiceMessageCode::RATING_QUERY_RESULT) {
+            return std::nullopt;
+        }
+
+        IpcProto::RatingQueryResult result;
+
+        result.init(*message);
+
+        return result;
+    }
+
+    CoreRatingData data;
+    CoreDataSyncBlock syncBlock;
+    CoarseClock clock {testSlot, testSlot};
+    RegisteredIdSet registeredIds;
+    RatingStampTable ratingStamps;
+    JobQueue jobQueue {1, 2};
+    IncomingDataBuffer buffer;
+    LoopbackTransport loopback {testPort};
+    SubscriberHub subscribers {SubscriberPolicy {}};
+    RatingStreamer streamer {data, syncBlock, loopback.server()};
+    TopRatingFeed topFeed {data, syncBlock, loopback.server()};
+    MessageDispatcher dispatcher {jobQueue, buffer, clock, registeredIds, ratingStamps, streamer, topFeed};
+    WorkerPool workerPool {data, syncBlock, clock, ratingStamps, loopback.server(), subscribers};
+};
+
+static std::vector<id_t> idsOf (const IpcProto::RatingQueryResult::rating_pack_t& entries) {
+    std::vector<id_t> ids;
+
+    for (const auto& entry : entries) {
+        ids.push_back(entry.id);
+    }
+
+    return ids;
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(ratingQueryGetsTheTopAndTheSurroundings) {
+    QueryFixture f;
+
+    // the user at position 5, and the one at 1 whose surroundings are all within the top
+    f.query(6, 11, 2, 2, 1);
+    f.query(2, 12, 3, 5, 1);
+    f.workerPool.start(f.jobQueue);
+
+    auto result = f.nextResult();
+
+    CHECK(result.has_value());
+
+    if (result) {
+        CHECK(result->getRequestId() == 11);
+        CHECK(result->getUserId() == 6);
+        CHECK(result->getRatingLength() == ratedUserCount);
+        CHECK(result->getRatingPos() == 5);
+        CHECK((idsOf(result->getTopRatings()) == std::vector<id_t> {1, 2}));
+        CHECK(result->getSurroundingsBegin() == 3);
+        CHECK((idsOf(result->getSurroundings()) == std::vector<id_t> {4, 5, 6, 7}));
+        CHECK(result->getSurroundings()[2].winnings == 500);
+    }
+
+    result = f.nextResult();
+
+    CHECK(result.has_value());
+
+    if (result) {
+        CHECK(result->getRequestId() == 12);
+        CHECK(result->getRatingPos() == 1);
+        CHECK((idsOf(result->getTopRatings()) == std::vector<id_t> {1, 2, 3}));
+        CHECK(result->getSurroundings().empty());
+    }
+}
+
+UNIT_TEST(ratingQueryOfUsersOutOfTheRating) {
+    QueryFixture f;
+
+    // the top asked for is longer than the whole rating
+    f.query(silentUserId, 21, 20, 5, 5);
+    f.query(77, 22, 1, 1, 1);
+    f.workerPool.start(f.jobQueue);
+
+    auto result = f.nextResult();
+
+    CHECK(result.has_value());
+
+    if (result) {
+        // one past the last, like the connects get
+        CHECK(result->getRatingPos() == ratedUserCount);
+        CHECK(result->getTopRatings().size() == ratedUserCount);
+        CHECK(result->getSurroundings().empty());
+    }
+
+    result = f.nextResult();
+
+    CHECK(result.has_value());
+
+    if (result) {
+        // a query doesn't fail for an unknown user, it just has no position
+        CHECK(result->getRequestId() == 22);
+        CHECK(result->getRatingPos() == -1);
+        CHECK((idsOf(result->getTopRatings()) == std::vector<id_t> {1}));
+        CHECK(result->getSurroundings().empty());
+    }
+}
+
+UNIT_TEST(ratingQueryDimensionsAreClamped) {
+    QueryFixture f;
+
+    f.query(1, 41, 60000, 60000, 3);
+
+    auto request = f.jobQueue.getConsumer(0).dequeueRatingRequest();
+
+    CHECK(request.userId == 1);
+    CHECK(request.isQuery);
+    CHECK(request.query.requestId == 41);
+    CHECK(request.query.topPositions == Limits::maxTopPositions);
+    CHECK(request.query.positionsBefore == Limits::maxCompetitionDistance);
+    CHECK(request.query.positionsAfter == 3);
+}
+
+UNIT_TEST(ratingQueryRejectedByTheQueues) {
+    QueryFixture f;
+
+    f.query(1, 31, 1, 0, 0);
+    f.query(2, 32, 1, 0, 0);
+    f.query(3, 33, 1, 0, 0);
+
+    CHECK(f.jobQueue.rejectedJobCount() == 1);
+
+    f.workerPool.start(f.jobQueue);
+
+    // the errors go ahead of everything else
+    buffer_t storage;
+    ServiceMessageCode code {};
+    auto message = f.loopback.receive(storage, code);
+
+    CHECK(message.has_value());
+    CHECK(code == ServiceMessageCode::PROTOCOL_ERROR);
+
+    if (message) {
+        IpcProto::error_code_t errorCode {0};
+        IpcProto::RatingQueryRejectedError error;
+
+        *message >> errorCode;
+        error.init(*message);
+
+        CHECK(errorCode == static_cast<IpcProto::error_code_t>(IpcProto::ProtocolConstants::ProtocolError::RATING_QUERY_REJECTED));
+        CHECK(error.getUserId() == 3);
+        CHECK(error.getRequestId() == 33);
+    }
+
+    for (IpcProto::request_id_t requestId : {31, 32}) {
+        auto result = f.nextResult();
+
+        CHECK(result.has_value() && result->getRequestId() == requestId);
+    }
+}
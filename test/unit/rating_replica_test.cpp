@@ -0,0 +1,174 @@
+#include <atomic>
+#include <thread>
+
+#include "unit_test.h"
+#include "rating_fixture.h"
+#include "../../service/replica_publisher.h"
+#include "../../ipc/rating_replica.h"
+
+#ifdef IQOPTIONTESTTASK_HAS_SHM
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+using ReplicaReader = IpcProto::RatingReplicaReader;
+
+// the publisher never unlinks the segment, so that the readers survive the restarts; the test does
+class TemporarySegment {
+public:
+
+    explicit TemporarySegment (const std::string& name) : m_name {"/" + name + "_" + std::to_string(getpid())} {
+        shm_unlink(m_name.c_str());
+    }
+
+    ~TemporarySegment () {
+        shm_unlink(m_name.c_str());
+    }
+
+    const std::string& name () const { return m_name; }
+
+private:
+
+    std::string m_name;
+};
+
+struct ReplicaFixture {
+    explicit ReplicaFixture (const std::string& name, unsigned int capacity) : policy {name, capacity} {}
+
+    void recalculate (const RatingEntries& rating) {
+        recalculateAs(data, syncBlock, rating);
+    }
+
+    CoreRatingData data;
+    CoreDataSyncBlock syncBlock;
+    ReplicaPolicy policy;
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(replicaMirrorsTheLatestGeneration) {
+    TemporarySegment segment {"iqo_unit_replica"};
+    ReplicaFixture f {segment.name(), 2};
+
+    f.recalculate({{3, 300}, {1, 200}, {7, 100}});
+
+    ReplicaPublisher publisher {f.data, f.syncBlock, f.policy};
+
+    publisher.start();
+
+    ReplicaReader reader {segment.name()};
+    ReplicaReader::UserPosition position;
+
+    CHECK(reader.valid());
+    CHECK(eventually([&reader, &position]() { return reader.findUser(1, position) && position.generation == 1; }));
+    CHECK(position.position == 1);
+    CHECK(position.amount == 200);
+    CHECK(position.ratingSize == 3);
+
+    // the user past the capacity is still counted in the rating size, but can't be found
+    CHECK(!reader.findUser(7, position));
+    CHECK(position.ratingSize == 3);
+    CHECK(!reader.findUser(5, position));
+
+    f.recalculate({{7, 400}, {3, 300}, {1, 200}});
+
+    CHECK(eventually([&reader, &position]() { return reader.findUser(7, position) && position.generation == 2; }));
+    CHECK(position.position == 0);
+    CHECK(!reader.findUser(1, position));
+
+    ReplicaReader::WindowEntry entries[4];
+    unsigned long long generation {0};
+
+    CHECK(reader.window(0, 4, entries, generation) == 2);
+    CHECK(generation == 2);
+    CHECK(entries[0].id == 7 && entries[0].amount == 400);
+    CHECK(entries[1].id == 3 && entries[1].amount == 300);
+    CHECK(reader.window(1, 4, entries, generation) == 1);
+    CHECK(reader.window(5, 4, entries, generation) == 0);
+}
+
+UNIT_TEST(replicaReadsNeverMixTheGenerations) {
+    static constexpr int userCount {64};
+    static constexpr int generationCount {300};
+
+    TemporarySegment segment {"iqo_unit_replica_race"};
+    ReplicaFixture f {segment.name(), userCount};
+    RatingEntries rating(userCount);
+
+    // every user has the amount of the generation number, so a torn read can't go unnoticed
+    auto fillRating = [&rating](monetary_t generation) {
+        for (int i = 0; i < userCount; ++i) {
+            rating[i] = {i + 1, generation};
+        }
+    };
+
+    fillRating(1);
+    f.recalculate(rating);
+
+    ReplicaPublisher publisher {f.data, f.syncBlock, f.policy};
+
+    publisher.start();
+
+    ReplicaReader reader {segment.name()};
+    std::atomic<bool> publishing {true};
+    std::atomic<int> tornReads {0};
+    std::atomic<int> reads {0};
+
+    CHECK(reader.valid());
+
+    std::thread readerThread {[&reader, &publishing, &tornReads, &reads]() {
+        ReplicaReader::WindowEntry entries[userCount];
+        unsigned long long generation {0};
+
+        while (publishing.load()) {
+            auto copied = reader.window(0, userCount, entries, generation);
+
+            for (size_t i = 0; i < copied; ++i) {
+                if (entries[i].amount != static_cast<monetary_t>(generation)) {
+                    tornReads.fetch_add(1);
+
+                    break;
+                }
+            }
+
+            reads.fetch_add(1);
+        }
+    }};
+
+    for (int generation = 2; generation <= generationCount; ++generation) {
+        fillRating(generation);
+        f.recalculate(rating);
+
+        std::this_thread::yield();
+    }
+
+    ReplicaReader::UserPosition position;
+
+    CHECK(eventually([&reader, &position]() { return reader.findUser(1, position) && position.generation == generationCount; }));
+
+    publishing.store(false);
+    readerThread.join();
+
+    CHECK(reads.load() > 0);
+    CHECK(tornReads.load() == 0);
+    CHECK(position.amount == generationCount);
+}
+
+#endif // IQOPTIONTESTTASK_HAS_SHM
+
+UNIT_TEST(replicaReaderWithoutASegment) {
+    IpcProto::RatingReplicaReader reader {"/iqo_unit_replica_missing"};
+    IpcProto::RatingReplicaReader::UserPosition position;
+    unsigned long long generation {0};
+
+    CHECK(!reader.valid());
+    CHECK(!reader.findUser(1, position));
+    CHECK(reader.window(0, 1, nullptr, generation) == 0);
+}
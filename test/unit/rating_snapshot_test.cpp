@@ -0,0 +1,165 @@
+#include "unit_test.h"
+#include "temporary_path.h"
+#include "../../service/rating_snapshot.h"
+#include "../../service/snapshot_writer.h"
+#include "../../service/registered_ids.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr size_t testShardCount {2};
+
+static BasicUserData userNamed (const std::string& name) {
+    BasicUserData userData;
+
+#ifdef PASS_NAMES_AROUND
+    userData.name.assign(name.begin(), name.end());
+#endif
+
+    return userData;
+}
+
+// the directory the way a recalculation leaves it, the rated users go in the rating order
+static void addRatedUser (CoreRatingData& data, id_t id, monetary_t amount, const std::string& name) {
+    FullUserData& userData = data.activeUsers.try_emplace(id, id, amount, userNamed(name)).first->second;
+
+    userData.rating = static_cast<int>(data.rating.size());
+    data.rating.push_back(&userData);
+}
+
+static void fillData (CoreRatingData& data) {
+    addRatedUser(data, 3, 300, "carol");
+    addRatedUser(data, 1, 200, "alice");
+    addRatedUser(data, 7, 200, "");
+    data.silentUsers.emplace(2, userNamed("bob"));
+    data.silentUsers.emplace(9, userNamed("ivan"));
+
+    data.appliedSequences = {41, 40};
+    data.expirationDate = chrono_t {std::chrono::milliseconds {1234567}};
+    data.generation = 5;
+}
+
+static std::string nameOf (const BasicUserData& userData) {
+#ifdef PASS_NAMES_AROUND
+    return std::string {userData.name.begin(), userData.name.end()};
+#else
+    return std::string {};
+#endif
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(snapshotRoundTripRestoresTheDirectory) {
+    TemporaryPath snapshotFile {"unit_rating_snapshot.snap"};
+    CoreRatingData data;
+    CoreDataSyncBlock syncBlock;
+    SnapshotPolicy policy {snapshotFile.path()};
+
+    fillData(data);
+
+    {
+        SnapshotWriter writer {data, syncBlock, policy, nullptr};
+
+        CHECK(!writer.ready());
+
+        writer.start();
+
+        CHECK(writer.ready());
+
+        writer.submit(RatingSnapshot::capture(data, 777));
+
+        // the announcer would find it busy until the file is written
+        CHECK(eventually([&writer]() { return writer.ready(); }));
+    }
+
+    CoreRatingData loaded;
+    RegisteredIdSet registeredIds;
+    RatingSnapshot::LoadStatistics stats;
+    uint64_t logOffset {0};
+
+    loaded.appliedSequences.resize(testShardCount);
+
+    CHECK(RatingSnapshot::load(loaded, registeredIds, snapshotFile.path(), logOffset, stats));
+    CHECK(stats.users == 5);
+    CHECK(stats.ratedUsers == 3);
+    CHECK(logOffset == 777);
+    CHECK((loaded.appliedSequences == std::vector<sequence_t> {41, 40}));
+    CHECK(loaded.expirationDate == data.expirationDate);
+    CHECK(loaded.rating.size() == 3);
+    CHECK(loaded.activeUsers.size() == 3);
+    CHECK(loaded.silentUsers.size() == 2);
+
+    for (size_t i = 0; i < loaded.rating.size() && i < data.rating.size(); ++i) {
+        const FullUserData& user = *loaded.rating[i];
+
+        CHECK(user.id == data.rating[i]->id);
+        CHECK(user.amountWon == data.rating[i]->amountWon);
+        CHECK(user.rating == static_cast<int>(i));
+        CHECK(nameOf(user) == nameOf(*data.rating[i]));
+        CHECK(&loaded.activeUsers.at(user.id) == &user);
+    }
+
+#ifdef PASS_NAMES_AROUND
+    CHECK(nameOf(loaded.silentUsers.at(2)) == "bob");
+    CHECK(nameOf(loaded.silentUsers.at(9)) == "ivan");
+#endif
+
+    for (id_t id : {1, 2, 3, 7, 9}) {
+        CHECK(registeredIds.contains(id));
+    }
+}
+
+UNIT_TEST(snapshotOfAnotherLayoutIsRefused) {
+    TemporaryPath snapshotFile {"unit_rating_snapshot_layout.snap"};
+    CoreRatingData data;
+    RatingSnapshot::LoadStatistics stats;
+    uint64_t logOffset {0};
+
+    fillData(data);
+
+    auto content = RatingSnapshot::capture(data, 0);
+
+    // no names at all is fine for the format, they just come out empty
+    RatingSnapshot::store(content, [](size_t from, size_t to, buffer_t& names, std::vector<uint32_t>& nameOffsets) {
+        names.clear();
+        nameOffsets.assign(to - from + 1, 0);
+    }, snapshotFile.path());
+
+    {
+        // the service has been restarted with another number of ingest shards
+        CoreRatingData loaded;
+        RegisteredIdSet registeredIds;
+
+        loaded.appliedSequences.resize(testShardCount + 1);
+
+        CHECK(!RatingSnapshot::load(loaded, registeredIds, snapshotFile.path(), logOffset, stats));
+    }
+
+    {
+        CoreRatingData loaded;
+        RegisteredIdSet registeredIds;
+
+        loaded.appliedSequences.resize(testShardCount);
+
+        CHECK(RatingSnapshot::load(loaded, registeredIds, snapshotFile.path(), logOffset, stats));
+        CHECK(loaded.rating.size() == 3);
+        CHECK(nameOf(*loaded.rating[0]).empty());
+    }
+
+    // nor is there anything to load once the file is gone
+    std::filesystem::remove(snapshotFile.path());
+
+    CoreRatingData loaded;
+    RegisteredIdSet registeredIds;
+
+    loaded.appliedSequences.resize(testShardCount);
+
+    CHECK(!RatingSnapshot::load(loaded, registeredIds, snapshotFile.path(), logOffset, stats));
+}
@@ -0,0 +1,266 @@
+#include <climits>
+
+#include "unit_test.h"
+#include "loopback_transport.h"
+#include "rating_fixture.h"
+#include "../../service/rating_streamer.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr unsigned short testPort {47471};
+static constexpr std::chrono::milliseconds silenceTimeout {200}; // how long a client waits to tell nothing is coming
+
+using ServiceMessageCode = IpcProto::ProtocolConstants::ServiceMessageCode;
+using SnapshotEncoding = IpcProto::ProtocolConstants::SnapshotEncoding;
+using RatingSnapshotFrame = IpcProto::RatingSnapshotFrame;
+using VarintCoding = RatingSnapshotFrame::VarintCoding;
+
+// the users 1 to 10 in this order in the rating
+static RatingEntries tenUsers () {
+    RatingEntries rating;
+
+    for (id_t id = 1; id <= 10; ++id) {
+        rating.emplace_back(id, (11 - id) * 100);
+    }
+
+    return rating;
+}
+
+struct StreamerFixture {
+    StreamerFixture () {
+        recalculateAs(data, syncBlock, tenUsers());
+        streamer.start();
+    }
+
+    void requestStream (IpcProto::request_id_t requestId, unsigned int positionsPerFrame, unsigned int credits,
+                        SnapshotEncoding encoding = SnapshotEncoding::DELTA_VARINT) {
+        streamer.requestStream(RatingStreamer::StreamRequest {requestId, positionsPerFrame, credits, encoding});
+    }
+
+    std::optional<RatingSnapshotFrame> nextFrame (std::chrono::milliseconds timeout = std::chrono::seconds {5}) {
+        buffer_t storage;
+        ServiceMessageCode code {};
+        auto message = loopback.receive(storage, code, timeout);
+
+        if (!message || code != ServiceMessageCode::RATING_SNAPSHOT_FRAME) {
+            return std::nullopt;
+        }
+
+        RatingSnapshotFrame frame;
+
+        frame.init(*message);
+
+        return frame;
+    }
+
+    CoreRatingData data;
+    CoreDataSyncBlock syncBlock;
+    LoopbackTransport loopback {testPort};
+    RatingStreamer streamer {data, syncBlock, loopback.server()};
+};
+
+static buffer_t encoded (long long value) {
+    BinaryOStream buffer;
+
+    VarintCoding::store(buffer, value);
+
+    return buffer.storage();
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(varintsTakeLessForTheSmallerDifferences) {
+    CHECK((encoded(0) == buffer_t {0}));
+    CHECK((encoded(-1) == buffer_t {1}));
+    CHECK((encoded(1) == buffer_t {2}));
+    CHECK(encoded(-64).size() == 1);
+    CHECK(encoded(64).size() == 2);
+    CHECK(encoded(8191).size() == 2);
+    CHECK(encoded(8192).size() == 3);
+    CHECK(encoded(LLONG_MIN).size() == 10);
+
+    for (long long value : {0LL, 1LL, -1LL, 63LL, -64LL, 64LL, 300LL, -300LL, 1LL << 40, LLONG_MAX, LLONG_MIN}) {
+        auto data = encoded(value);
+        BinaryIStream stream {data};
+
+        CHECK(VarintCoding::load(stream) == value);
+        CHECK(stream.getPos() == data.size());
+    }
+
+    // a varint cut short is just as bad as any other truncated message
+    auto data = encoded(1LL << 40);
+    auto threw {false};
+
+    data.pop_back();
+
+    try {
+        BinaryIStream stream {data};
+
+        VarintCoding::load(stream);
+    } catch (const BinaryIStream::storage_underflow&) {
+        threw = true;
+    }
+
+    CHECK(threw);
+}
+
+UNIT_TEST(deltaFramesDecodeToThePlainOnes) {
+    using StorageBuilder = RatingSnapshotFrame::StorageBuilder;
+
+    RatingEntries entries {{5, 1000}, {3, 1000}, {900000, 20}, {4, -7}};
+    std::vector<RatingSnapshotFrame> frames;
+    std::vector<size_t> frameSizes;
+
+    for (auto encoding : {SnapshotEncoding::PLAIN, SnapshotEncoding::DELTA_VARINT}) {
+        BinaryOStream buffer;
+        id_t previousId {0};
+        monetary_t previousWinnings {0};
+
+        StorageBuilder::storeFrameHeader(buffer, 7, 3, 40, 20, static_cast<unsigned int>(entries.size()), encoding, 0);
+
+        for (const auto& [id, winnings] : entries) {
+            StorageBuilder::storeFrameEntry(buffer, encoding, id, winnings, previousId, previousWinnings
+#ifdef PASS_NAMES_AROUND
+                                            , buffer_t {'n'}
+#endif
+                                            );
+            previousId = id;
+            previousWinnings = winnings;
+        }
+
+        auto data = buffer.storage();
+        BinaryIStream stream {data};
+
+        frames.emplace_back();
+        frames.back().init(stream);
+        frameSizes.push_back(data.size());
+    }
+
+    CHECK(frames[1].getRequestId() == 7);
+    CHECK(frames[1].getGeneration() == 3);
+    CHECK(frames[1].getFrameBegin() == 20);
+    CHECK(!frames[1].isLast());
+    CHECK(frames[1].getRatings().size() == entries.size());
+
+    for (size_t i = 0; i < entries.size() && i < frames[1].getRatings().size(); ++i) {
+        CHECK(frames[1].getRatings()[i].id == entries[i].first);
+        CHECK(frames[1].getRatings()[i].winnings == entries[i].second);
+        CHECK(frames[0].getRatings()[i].id == entries[i].first);
+    }
+
+    // even with a jump back and forth in the ids, the differences are shorter than the values
+    CHECK(frameSizes[1] < frameSizes[0]);
+}
+
+UNIT_TEST(streamSendsAFramePerCredit) {
+    StreamerFixture f;
+    std::vector<id_t> streamedIds;
+
+    f.requestStream(5, 3, 2);
+
+    auto collect = [&streamedIds](const RatingSnapshotFrame& frame) {
+        for (const auto& entry : frame.getRatings()) {
+            streamedIds.push_back(entry.id);
+        }
+    };
+
+    for (int i = 0; i < 2; ++i) {
+        auto frame = f.nextFrame();
+
+        CHECK(frame && frame->getRequestId() == 5 && frame->getFrameBegin() == i * 3 && !frame->isLast());
+
+        if (frame) {
+            collect(*frame);
+        }
+    }
+
+    // the credits are spent, the client has to ask for more
+    CHECK(!f.nextFrame(silenceTimeout));
+
+    f.streamer.grantCredits(5, 1);
+
+    auto frame = f.nextFrame();
+
+    CHECK(frame && frame->getFrameBegin() == 6 && !frame->isLast());
+
+    if (frame) {
+        collect(*frame);
+    }
+
+    // more than the rest of the stream needs, only the last frame comes
+    f.streamer.grantCredits(5, 10);
+
+    frame = f.nextFrame();
+
+    CHECK(frame && frame->getFrameBegin() == 9 && frame->isLast() && frame->getRatingLength() == 10);
+
+    if (frame) {
+        collect(*frame);
+    }
+
+    CHECK((streamedIds == std::vector<id_t> {1, 2, 3, 4, 5, 6, 7, 8, 9, 10}));
+    CHECK(!f.nextFrame(silenceTimeout));
+}
+
+UNIT_TEST(streamStaysWithItsGeneration) {
+    StreamerFixture f;
+
+    f.requestStream(6, 5, 1, SnapshotEncoding::PLAIN);
+
+    auto first = f.nextFrame();
+
+    CHECK(first && first->getGeneration() == 1);
+
+    // the rating is turned around while the client takes its time
+    auto reversed = tenUsers();
+
+    std::reverse(reversed.begin(), reversed.end());
+    recalculateAs(f.data, f.syncBlock, reversed);
+
+    f.streamer.grantCredits(6, 1);
+
+    auto second = f.nextFrame();
+
+    CHECK(second && second->getGeneration() == 1 && second->isLast());
+    CHECK(second && second->getRatings().front().id == 6);
+    CHECK(second && second->getRatings().back().winnings == 100);
+
+    // while a stream starting now gets the new one
+    f.requestStream(7, 10, 1);
+
+    auto latest = f.nextFrame();
+
+    CHECK(latest && latest->getGeneration() == 2 && latest->getRatings().front().id == 10);
+}
+
+UNIT_TEST(streamsBeyondTheLimitAreRejected) {
+    StreamerFixture f;
+
+    // none of these has any credits, so they all stay active
+    for (IpcProto::request_id_t requestId = 1; requestId <= 4; ++requestId) {
+        f.requestStream(requestId, 1, 0);
+    }
+
+    f.requestStream(9, 1, 1);
+
+    auto frame = f.nextFrame();
+
+    CHECK(frame && frame->getRequestId() == 9 && frame->isRejected() && frame->isLast());
+    CHECK(frame && frame->getRatings().empty());
+
+    // the credits of a rejected stream have nothing to go to
+    f.streamer.grantCredits(9, 1);
+    f.streamer.grantCredits(2, 1);
+
+    frame = f.nextFrame();
+
+    CHECK(frame && frame->getRequestId() == 2 && !frame->isRejected());
+}
@@ -0,0 +1,48 @@
+#ifndef IQOPTIONTESTTASK_TEMPORARY_PATH_H
+#define IQOPTIONTESTTASK_TEMPORARY_PATH_H
+
+#include <string>
+#include <filesystem>
+
+// --------------------------------------------------------------------- //
+/*
+ *  TemporaryPath class
+ *
+ *  a file in the temporary directory for the tests which write to the disk,
+ *  removed both before and after the test along with the file written next to it
+ */
+// --------------------------------------------------------------------- //
+
+class TemporaryPath {
+public:
+
+    explicit TemporaryPath (const std::string& name)
+    : m_path {(std::filesystem::temp_directory_path() / name).string()} {
+        removeFiles();
+    }
+
+    ~TemporaryPath () {
+        removeFiles();
+    }
+
+    TemporaryPath (const TemporaryPath&) = delete;
+    TemporaryPath& operator= (const TemporaryPath&) = delete;
+
+    const std::string& path () const { return m_path; }
+
+private:
+
+    void removeFiles () {
+        std::error_code ec;
+
+        // the services write the files as path.tmp first
+        std::filesystem::remove(m_path, ec);
+        std::filesystem::remove(m_path + ".tmp", ec);
+    }
+
+private:
+
+    std::string m_path;
+};
+
+#endif //IQOPTIONTESTTASK_TEMPORARY_PATH_H
@@ -0,0 +1,156 @@
+#include "unit_test.h"
+#include "loopback_transport.h"
+#include "rating_fixture.h"
+#include "../../service/top_rating_feed.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  Helper values and types
+ */
+// --------------------------------------------------------------------- //
+
+static constexpr unsigned short testPort {47481};
+static constexpr std::chrono::milliseconds silenceTimeout {200}; // how long a client waits to tell nothing is coming
+
+using ServiceMessageCode = IpcProto::ProtocolConstants::ServiceMessageCode;
+using TopChangeFlags = IpcProto::ProtocolConstants::TopChangeFlags;
+using TopRatingDiff = IpcProto::TopRatingDiff;
+
+struct FeedFixture {
+    FeedFixture () {
+        recalculateAs(data, syncBlock, {{1, 500}, {2, 400}, {3, 300}, {4, 200}, {5, 100}});
+        feed.start();
+    }
+
+    std::optional<TopRatingDiff> nextDiff (std::chrono::milliseconds timeout = std::chrono::seconds {5}) {
+        buffer_t storage;
+        ServiceMessageCode code {};
+        auto message = loopback.receive(storage, code, timeout);
+
+        if (!message || code != ServiceMessageCode::TOP_RATING_DIFF) {
+            return std::nullopt;
+        }
+
+        TopRatingDiff diff;
+
+        diff.init(*message);
+
+        return diff;
+    }
+
+    CoreRatingData data;
+    CoreDataSyncBlock syncBlock;
+    LoopbackTransport loopback {testPort};
+    TopRatingFeed feed {data, syncBlock, loopback.server()};
+};
+
+// the change of the user, with the flags zeroed if there's none
+static TopRatingDiff::TopChange changeOf (const TopRatingDiff& diff, id_t id) {
+    for (const auto& change : diff.getChanges()) {
+        if (change.id == id) {
+            return change;
+        }
+    }
+
+    return TopRatingDiff::TopChange {};
+}
+
+// --------------------------------------------------------------------- //
+/*
+ *  Tests
+ */
+// --------------------------------------------------------------------- //
+
+UNIT_TEST(topDiffStartsWithABaseline) {
+    FeedFixture f;
+
+    f.feed.subscribe(8, 3);
+
+    auto diff = f.nextDiff();
+
+    CHECK(diff && diff->isBaseline() && diff->getSubscriptionId() == 8);
+    CHECK(diff && diff->getGeneration() == 1 && diff->getRatingLength() == 5 && diff->getTopPositions() == 3);
+    CHECK(diff && diff->getChanges().size() == 3);
+
+    for (id_t id = 1; diff && id <= 3; ++id) {
+        auto change = changeOf(*diff, id);
+
+        CHECK(change.flags == TopChangeFlags::entered);
+        CHECK(change.position == id - 1);
+        CHECK(change.winnings == (6 - id) * 100);
+    }
+}
+
+UNIT_TEST(topDiffHasOnlyTheChangedPositions) {
+    FeedFixture f;
+
+    f.feed.subscribe(8, 3);
+
+    CHECK(f.nextDiff().has_value());
+
+    // the two leaders swap, the third one drops out of the top and the fourth one takes the place
+    recalculateAs(f.data, f.syncBlock, {{2, 450}, {1, 400}, {4, 350}, {3, 300}, {5, 100}});
+
+    auto diff = f.nextDiff();
+
+    CHECK(diff && !diff->isBaseline() && diff->getGeneration() == 2);
+    CHECK(diff && diff->getChanges().size() == 4);
+
+    if (diff) {
+        CHECK(changeOf(*diff, 2).flags == (TopChangeFlags::moved | TopChangeFlags::amountChanged));
+        CHECK(changeOf(*diff, 2).position == 0 && changeOf(*diff, 2).winnings == 450);
+        CHECK(changeOf(*diff, 1).flags == (TopChangeFlags::moved | TopChangeFlags::amountChanged));
+        CHECK(changeOf(*diff, 4).flags == TopChangeFlags::entered && changeOf(*diff, 4).position == 2);
+
+        // the one who has left comes with the old position
+        CHECK(changeOf(*diff, 3).flags == TopChangeFlags::left && changeOf(*diff, 3).position == 2);
+    }
+
+    // nothing within the top has changed, so nothing is sent
+    recalculateAs(f.data, f.syncBlock, {{2, 450}, {1, 400}, {4, 350}, {5, 320}, {3, 300}});
+
+    CHECK(!f.nextDiff(silenceTimeout));
+
+    // and the next diff is against the top the subscriber has last been told about
+    recalculateAs(f.data, f.syncBlock, {{2, 450}, {1, 400}, {5, 360}, {4, 350}, {3, 300}});
+
+    diff = f.nextDiff();
+
+    CHECK(diff && diff->getGeneration() == 4 && diff->getChanges().size() == 2);
+
+    if (diff) {
+        CHECK(changeOf(*diff, 5).flags == TopChangeFlags::entered && changeOf(*diff, 5).winnings == 360);
+        CHECK(changeOf(*diff, 4).flags == TopChangeFlags::left);
+    }
+}
+
+UNIT_TEST(topDiffPerSubscriptionSize) {
+    FeedFixture f;
+
+    f.feed.subscribe(1, 1);
+    f.feed.subscribe(2, 4);
+
+    for (int i = 0; i < 2; ++i) {
+        CHECK(f.nextDiff().has_value());
+    }
+
+    // the change below the top of the first subscriber only goes to the second one
+    recalculateAs(f.data, f.syncBlock, {{1, 500}, {2, 400}, {4, 350}, {3, 300}, {5, 100}});
+
+    auto diff = f.nextDiff();
+
+    CHECK(diff && diff->getSubscriptionId() == 2 && diff->getChanges().size() == 2);
+    CHECK(!f.nextDiff(silenceTimeout));
+
+    // a cancelled subscription gets nothing, a renewed one starts over with a baseline
+    f.feed.subscribe(2, 0);
+    f.feed.subscribe(1, 2);
+
+    diff = f.nextDiff();
+
+    CHECK(diff && diff->getSubscriptionId() == 1 && diff->isBaseline() && diff->getChanges().size() == 2);
+
+    recalculateAs(f.data, f.syncBlock, {{1, 500}, {2, 400}, {3, 380}, {4, 350}, {5, 100}});
+
+    CHECK(!f.nextDiff(silenceTimeout));
+}
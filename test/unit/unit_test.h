@@ -0,0 +1,71 @@
+#ifndef IQOPTIONTESTTASK_UNIT_TEST_H
+#define IQOPTIONTESTTASK_UNIT_TEST_H
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+// --------------------------------------------------------------------- //
+/*
+ *  Unit test registry
+ *
+ *  every test file defines its tests with UNIT_TEST, they register themselves before main runs
+ *  and report the failed checks without stopping, so a single run shows all of them
+ */
+// --------------------------------------------------------------------- //
+
+struct UnitTest {
+    const char* name;
+    void (*body) ();
+};
+
+inline std::vector<UnitTest>& unitTests () {
+    static std::vector<UnitTest> tests;
+
+    return tests;
+}
+
+inline unsigned int& unitTestFailures () {
+    static unsigned int failures {0};
+
+    return failures;
+}
+
+inline void reportCheckFailure (const char* file, int line, const char* condition) {
+    ++unitTestFailures();
+
+    std::cerr << file << ":" << line << ": check failed: " << condition << std::endl;
+}
+
+struct UnitTestRegistrar {
+    UnitTestRegistrar (const char* name, void (*body) ()) {
+        unitTests().push_back(UnitTest {name, body});
+    }
+};
+
+// for the work done by the background threads: polls the condition until it holds or the time is out
+template <typename Condition>
+bool eventually (Condition condition, std::chrono::milliseconds timeout = std::chrono::seconds {5}) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds {5});
+    }
+
+    return true;
+}
+
+#define UNIT_TEST(testName) \
+    static void testName (); \
+    static UnitTestRegistrar testName##Registrar {#testName, &testName}; \
+    static void testName ()
+
+#define CHECK(condition) \
+    do { if (!(condition)) { reportCheckFailure(__FILE__, __LINE__, #condition); } } while (false)
+
+#endif //IQOPTIONTESTTASK_UNIT_TEST_H
@@ -21,11 +21,24 @@ public:
 
     class storage_underflow {};
 
+    using pos_t = buffer_t::size_type;
+
 public:
 
     BinaryIStream (buffer_t& storage) : m_storage{storage} {}
     BinaryIStream (BinaryIStream&&) = default;
 
+    pos_t getPos () const { return m_curPos; }
+    bool setPos (pos_t newPos) {
+        if (newPos > m_storage.size()) {
+            return false;
+        }
+
+        m_curPos = newPos;
+
+        return true;
+    }
+
     template <typename POD,
             typename std::enable_if_t<std::is_pod<POD>::value>* = nullptr>
     BinaryIStream& operator>> (POD& data) {
@@ -59,7 +72,7 @@ public:
 
 private:
 
-    buffer_t::size_type m_curPos {0};
+    pos_t m_curPos {0};
     buffer_t& m_storage; // storing by reference is for the calling party to reuse the buffer later without reallocations
 };
 
@@ -0,0 +1,113 @@
+#ifndef IQOPTIONTESTTASK_CLOCK_SOURCE_H
+#define IQOPTIONTESTTASK_CLOCK_SOURCE_H
+
+#include <chrono>
+
+#include "../utils/types.h"
+
+using steady_t = std::chrono::steady_clock::time_point;
+
+// --------------------------------------------------------------------- //
+/*
+ *  ClockSource class
+ *
+ *  the source of the time DateTime works with. It provides both the wall clock time
+ *  and a monotonic one, and translates them back into the real steady clock moments
+ *  the threads actually have to sleep until
+ */
+// --------------------------------------------------------------------- //
+
+class ClockSource {
+public:
+
+    virtual ~ClockSource () = default;
+
+    virtual chrono_t now () const = 0;
+    virtual steady_t steadyNow () const = 0;
+
+    virtual steady_t realDeadline (chrono_t time) const = 0;
+    virtual steady_t realDeadline (steady_t time) const = 0;
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  SystemClockSource class
+ *
+ *  the real time as it is
+ */
+// --------------------------------------------------------------------- //
+
+class SystemClockSource : public ClockSource {
+public:
+
+    chrono_t now () const override {
+        return std::chrono::system_clock::now();
+    }
+
+    steady_t steadyNow () const override {
+        return std::chrono::steady_clock::now();
+    }
+
+    steady_t realDeadline (chrono_t time) const override {
+        auto timeLeft = time - std::chrono::system_clock::now();
+
+        return std::chrono::steady_clock::now() + std::chrono::duration_cast<steady_t::duration>(timeLeft);
+    }
+
+    steady_t realDeadline (steady_t time) const override {
+        return time;
+    }
+};
+
+// --------------------------------------------------------------------- //
+/*
+ *  SimulatedClockSource class
+ *
+ *  the time starting at the given moment and running faster than the real one
+ *  by the given factor, so that the weekly cycles can be run through in minutes
+ */
+// --------------------------------------------------------------------- //
+
+class SimulatedClockSource : public ClockSource {
+public:
+
+    SimulatedClockSource (chrono_t startTime, double speedup)
+    : m_startTime {startTime}, m_realOrigin {std::chrono::steady_clock::now()}, m_speedup {speedup} {}
+
+    chrono_t now () const override {
+        return m_startTime + std::chrono::duration_cast<chrono_t::duration>(simulatedElapsed());
+    }
+
+    steady_t steadyNow () const override {
+        return m_realOrigin + std::chrono::duration_cast<steady_t::duration>(simulatedElapsed());
+    }
+
+    steady_t realDeadline (chrono_t time) const override {
+        return m_realOrigin + realDuration(time - m_startTime);
+    }
+
+    steady_t realDeadline (steady_t time) const override {
+        return m_realOrigin + realDuration(time - m_realOrigin);
+    }
+
+private:
+
+    using seconds_d = std::chrono::duration<double>;
+
+    seconds_d simulatedElapsed () const {
+        return seconds_d {std::chrono::steady_clock::now() - m_realOrigin} * m_speedup;
+    }
+
+    template <typename Duration>
+    steady_t::duration realDuration (Duration simulated) const {
+        return std::chrono::duration_cast<steady_t::duration>(seconds_d {simulated} / m_speedup);
+    }
+
+private:
+
+    const chrono_t m_startTime;
+    const steady_t m_realOrigin;
+    const double m_speedup;
+};
+
+#endif //IQOPTIONTESTTASK_CLOCK_SOURCE_H
@@ -0,0 +1,112 @@
+#ifndef IQOPTIONTESTTASK_COARSE_CLOCK_H
+#define IQOPTIONTESTTASK_COARSE_CLOCK_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <cstdint>
+
+#include "date_time.h"
+
+// --------------------------------------------------------------------- //
+/*
+ *  CoarseClock class
+ *
+ *  keeps the current slot index, tick count and week start published through atomics, so that
+ *  the hot paths read the time with a single relaxed load instead of querying the
+ *  system clock. A ticker thread wakes up at every slot start to refresh the values
+ */
+// --------------------------------------------------------------------- //
+
+class CoarseClock {
+    static constexpr std::chrono::microseconds tickerLeadTime {500};
+
+public:
+
+    CoarseClock (std::chrono::milliseconds period, std::chrono::milliseconds slot)
+    : m_period {period}, m_slot {slot} {
+        publish();
+
+        m_tickerHandle = std::async(std::launch::async, &CoarseClock::doWork, this);
+    }
+
+    ~CoarseClock () {
+        {
+            std::lock_guard lg(m_lock);
+
+            m_stopping = true;
+        }
+
+        m_stopTrigger.notify_one();
+        m_tickerHandle.wait();
+    }
+
+    CoarseClock (const CoarseClock&) = delete;
+    CoarseClock& operator= (const CoarseClock&) = delete;
+
+    unsigned int slotIndex () const noexcept {
+        return m_slotIndex.load(std::memory_order_relaxed);
+    }
+
+    // the number of slots passed since the epoch, wrapping around
+    uint32_t tickCount () const noexcept {
+        return m_tickCount.load(std::memory_order_relaxed);
+    }
+
+    chrono_t weekStart () const noexcept {
+        return chrono_t {chrono_t::duration {m_weekStart.load(std::memory_order_relaxed)}};
+    }
+
+private:
+
+    void publish () noexcept {
+        auto sinceEpoch = std::chrono::floor<std::chrono::milliseconds>(DateTime::now().time_since_epoch());
+
+        m_slotIndex.store(DateTime::currentSlotIndex(m_period, m_slot), std::memory_order_relaxed);
+        m_tickCount.store(static_cast<uint32_t>(sinceEpoch / m_slot), std::memory_order_relaxed);
+        m_weekStart.store(DateTime::currentWeekStart().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    /*
+     *  The readers take the published slot for the time a message has come at, so it must never lag behind
+     *  the real one for longer than a message takes to come through. The thread wakeup being imprecise,
+     *  the ticker wakes up a bit in advance and yields till the exact slot start
+     */
+
+    void doWork () {
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        for (;;) {
+            auto slotStart = DateTime::nextSlotStart(m_slot);
+            auto wakeupTime = DateTime::clockSource().realDeadline(slotStart) - tickerLeadTime;
+
+            if (m_stopTrigger.wait_until(lock, wakeupTime, [this]()->bool{ return m_stopping; })) {
+                break;
+            }
+
+            while (DateTime::now() < slotStart) {
+                std::this_thread::yield();
+            }
+
+            publish();
+        }
+    }
+
+private:
+
+    const std::chrono::milliseconds m_period;
+    const std::chrono::milliseconds m_slot;
+
+    std::atomic_uint m_slotIndex {0};
+    std::atomic<uint32_t> m_tickCount {0};
+    std::atomic<chrono_t::rep> m_weekStart {0};
+
+    std::mutex m_lock;
+    std::condition_variable m_stopTrigger;
+    bool m_stopping {false};
+
+    std::future<void> m_tickerHandle;
+};
+
+#endif //IQOPTIONTESTTASK_COARSE_CLOCK_H
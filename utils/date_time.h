@@ -2,8 +2,11 @@
 #define IQOPTIONTESTTASK_DATE_TIME_H
 
 #include <chrono>
+#include <thread>
+#include <atomic>
 
 #include "../utils/types.h"
+#include "../utils/clock_source.h"
 
 class DateTime {
     using days = std::chrono::duration
@@ -16,8 +19,33 @@ class DateTime {
 
 public:
 
+    // the source is not owned and must outlive its use, null brings the system clock back
+    static void setClockSource (const ClockSource* source) {
+        s_clockSource.store(source, std::memory_order_release);
+    }
+
+    static const ClockSource& clockSource () {
+        static const SystemClockSource systemClockSource;
+        const ClockSource* source = s_clockSource.load(std::memory_order_acquire);
+
+        return source ? *source : systemClockSource;
+    }
+
+    static chrono_t now () {
+        return clockSource().now();
+    }
+
+    static steady_t steadyNow () {
+        return clockSource().steadyNow();
+    }
+
+    template <typename TimePoint>
+    static void sleepUntil (TimePoint time) {
+        std::this_thread::sleep_until(clockSource().realDeadline(time));
+    }
+
     static chrono_t currentWeekStart () {
-        chrono_t now = std::chrono::system_clock::now();
+        chrono_t now = DateTime::now();
 
         now -= days{4};
         auto sysWeekStart = std::chrono::floor<weeks>(now);
@@ -27,24 +55,36 @@ public:
     }
 
     static chrono_t nextFullMinute () {
-        chrono_t now = std::chrono::system_clock::now();
+        chrono_t now = DateTime::now();
 
         return std::chrono::time_point_cast<chrono_t::duration>(std::chrono::ceil<minutes>(now));
     }
 
     static chrono_t nextFullSecond () {
-        chrono_t now = std::chrono::system_clock::now();
+        chrono_t now = DateTime::now();
 
         return std::chrono::time_point_cast<chrono_t::duration>(std::chrono::ceil<seconds>(now));
     }
 
-    static unsigned char currentSecondIndex () {
-        chrono_t now = std::chrono::system_clock::now();
-        auto secondsFromTheMinuteStart = std::chrono::duration_cast<seconds>(
-                std::chrono::floor<seconds>(now)-std::chrono::floor<minutes>(now));
+    static chrono_t nextSlotStart (std::chrono::milliseconds slot) {
+        chrono_t now = DateTime::now();
+        auto sinceEpoch = std::chrono::ceil<std::chrono::milliseconds>(now.time_since_epoch());
+        auto slotStart = (sinceEpoch + slot - std::chrono::milliseconds{1}) / slot * slot;
+
+        return chrono_t {std::chrono::duration_cast<chrono_t::duration>(slotStart)};
+    }
+
+    // slots are counted from the start of the period, and the periods are counted from the epoch
+    static unsigned int currentSlotIndex (std::chrono::milliseconds period, std::chrono::milliseconds slot) {
+        chrono_t now = DateTime::now();
+        auto sinceEpoch = std::chrono::floor<std::chrono::milliseconds>(now.time_since_epoch());
 
-        return static_cast<unsigned char>(secondsFromTheMinuteStart.count());
+        return static_cast<unsigned int>((sinceEpoch % period) / slot);
     }
+
+private:
+
+    static inline std::atomic<const ClockSource*> s_clockSource {nullptr};
 };
 
 #endif //IQOPTIONTESTTASK_DATE_TIME_H
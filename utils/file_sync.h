@@ -0,0 +1,61 @@
+#ifndef IQOPTIONTESTTASK_FILE_SYNC_H
+#define IQOPTIONTESTTASK_FILE_SYNC_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// flushes the stream and makes sure its data has reached the disk, non-zero on failure
+inline int syncFile (std::FILE* file) {
+    if (std::fflush(file) != 0) {
+        return -1;
+    }
+
+#if defined(_WIN32)
+    return _commit(_fileno(file));
+#elif defined(__APPLE__)
+    return fsync(fileno(file));
+#else
+    return fdatasync(fileno(file));
+#endif
+}
+
+// a 64-bit offset from the start, the plain fseek only takes a long, which is 32 bits on Windows; non-zero on failure
+inline int seekFile (std::FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET);
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
+
+// makes a rename within the directory of the path survive a crash, non-zero on failure
+inline int syncDirectory (const std::string& path) {
+#ifdef _WIN32
+    // the CRT can't open a directory, the rename is left to the NTFS journal
+    return 0;
+#else
+    auto directory = std::filesystem::path {path}.parent_path();
+    int fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    auto result = fsync(fd);
+
+    close(fd);
+
+    return result;
+#endif
+}
+
+#endif //IQOPTIONTESTTASK_FILE_SYNC_H
@@ -0,0 +1,122 @@
+#ifndef IQOPTIONTESTTASK_MAPPED_FILE_H
+#define IQOPTIONTESTTASK_MAPPED_FILE_H
+
+#include <cstdio>
+#include <string>
+
+#include "types.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IQOPTIONTESTTASK_HAS_MMAP 1
+#endif
+
+// --------------------------------------------------------------------- //
+/*
+ *  MappedFile class
+ *
+ *  a read-only view of a whole file. The file is memory-mapped where the platform
+ *  allows it, so only the pages actually touched are ever read, otherwise it is read
+ *  into memory at once. An empty view means the file couldn't be opened
+ */
+// --------------------------------------------------------------------- //
+
+class MappedFile {
+public:
+
+    explicit MappedFile (const std::string& path) {
+#ifdef IQOPTIONTESTTASK_HAS_MMAP
+        if (map(path)) {
+            return;
+        }
+#endif
+        read(path);
+    }
+
+    ~MappedFile () {
+#ifdef IQOPTIONTESTTASK_HAS_MMAP
+        if (m_mapping) {
+            munmap(m_mapping, m_size);
+        }
+#endif
+    }
+
+    MappedFile (const MappedFile&) = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    const unsigned char* data () const {
+        return m_data;
+    }
+
+    size_t size () const {
+        return m_size;
+    }
+
+private:
+
+#ifdef IQOPTIONTESTTASK_HAS_MMAP
+    bool map (const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat fileStat {};
+        void* mapping = MAP_FAILED;
+
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+            mapping = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+
+        // the mapping stays valid after the descriptor is closed
+        close(fd);
+
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+
+        // the file is going to be read through once, front to back
+        madvise(mapping, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+
+        m_mapping = mapping;
+        m_data = static_cast<const unsigned char*>(mapping);
+        m_size = static_cast<size_t>(fileStat.st_size);
+
+        return true;
+    }
+#endif
+
+    void read (const std::string& path) {
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+
+        if (!file) {
+            return;
+        }
+
+        unsigned char chunk[64 * 1024];
+        size_t chunkSize {0};
+
+        while ((chunkSize = std::fread(chunk, 1, sizeof(chunk), file)) != 0) {
+            m_contents.insert(m_contents.end(), chunk, chunk + chunkSize);
+        }
+
+        std::fclose(file);
+
+        m_data = m_contents.data();
+        m_size = m_contents.size();
+    }
+
+private:
+
+    const unsigned char* m_data {nullptr};
+    size_t m_size {0};
+
+    void* m_mapping {nullptr};
+    buffer_t m_contents; // only used when the file couldn't be mapped
+};
+
+#endif //IQOPTIONTESTTASK_MAPPED_FILE_H
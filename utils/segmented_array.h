@@ -0,0 +1,85 @@
+#ifndef IQOPTIONTESTTASK_SEGMENTED_ARRAY_H
+#define IQOPTIONTESTTASK_SEGMENTED_ARRAY_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// --------------------------------------------------------------------- //
+/*
+ *  SegmentedAtomicArray class
+ *
+ *  a huge array of zero-initialized atomics indexed by a 32-bit value, split into
+ *  segments which are only allocated once some element within them is first written.
+ *  Segment allocation is lock-free: the threads racing to create a segment agree on
+ *  a single one with CAS, the losers just drop theirs
+ */
+// --------------------------------------------------------------------- //
+
+template <typename T, unsigned int indexBits, unsigned int segmentBits>
+class SegmentedAtomicArray {
+    static_assert(indexBits <= 32 && segmentBits <= indexBits, "the array is indexed by 32-bit values");
+
+public:
+
+    SegmentedAtomicArray () : m_segments {std::make_unique<std::atomic<Segment*>[]>(segmentCount)} {
+        for (size_t i = 0; i < segmentCount; ++i) {
+            m_segments[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~SegmentedAtomicArray () {
+        for (size_t i = 0; i < segmentCount; ++i) {
+            delete m_segments[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    SegmentedAtomicArray (const SegmentedAtomicArray&) = delete;
+    SegmentedAtomicArray& operator= (const SegmentedAtomicArray&) = delete;
+
+    // the element to be written, its segment gets allocated if necessary
+    std::atomic<T>& at (uint32_t index) {
+        return acquireSegment(index >> segmentBits).elements[index & segmentMask];
+    }
+
+    // the element to be read, or null if nothing within its segment has ever been written
+    const std::atomic<T>* find (uint32_t index) const {
+        const Segment* segment = m_segments[index >> segmentBits].load(std::memory_order_acquire);
+
+        return segment ? &segment->elements[index & segmentMask] : nullptr;
+    }
+
+private:
+
+    static constexpr size_t segmentCount {size_t {1} << (indexBits - segmentBits)};
+    static constexpr size_t segmentSize {size_t {1} << segmentBits};
+    static constexpr uint32_t segmentMask {static_cast<uint32_t>(segmentSize - 1)};
+
+    struct Segment {
+        std::atomic<T> elements[segmentSize] {};
+    };
+
+    Segment& acquireSegment (size_t index) {
+        Segment* segment = m_segments[index].load(std::memory_order_acquire);
+
+        if (segment) {
+            return *segment;
+        }
+
+        auto newSegment = std::make_unique<Segment>();
+
+        if (m_segments[index].compare_exchange_strong(segment, newSegment.get(),
+                                                      std::memory_order_acq_rel, std::memory_order_acquire)) {
+            segment = newSegment.release();
+        }
+
+        return *segment;
+    }
+
+private:
+
+    std::unique_ptr<std::atomic<Segment*>[]> m_segments;
+};
+
+#endif //IQOPTIONTESTTASK_SEGMENTED_ARRAY_H
@@ -2,21 +2,146 @@
 #define IQOPTIONTESTTASK_SPINLOCK_H
 
 #include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define IQOPTIONTESTTASK_CPU_PAUSE() _mm_pause()
+#else
+#define IQOPTIONTESTTASK_CPU_PAUSE() ((void)0)
+#endif
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// --------------------------------------------------------------------- //
+/*
+ *  Spinlock class
+ *
+ *  spins for a while in the hope that the holder is about to leave, backing off
+ *  exponentially between the attempts, and then parks the thread on a futex (or just
+ *  keeps yielding where there are no futexes). The lock keeps contention statistics,
+ *  which cost a couple of relaxed increments and two steady clock reads per acquisition
+ */
+// --------------------------------------------------------------------- //
 
 class Spinlock {
+public:
+
+    struct Statistics {
+        unsigned long long acquisitions {0};
+        unsigned long long contendedAcquisitions {0};
+        unsigned long long spins {0};
+        unsigned long long parks {0};
+        std::chrono::nanoseconds holdTime {0};
+    };
+
 public:
 
     void lock () noexcept {
-        while (locked.test_and_set(std::memory_order_acquire));
+        int state {unlocked};
+
+        if (!m_state.compare_exchange_strong(state, locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+            lockContended();
+        }
+
+        m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+        m_acquiredAt = std::chrono::steady_clock::now();
     }
 
     void unlock () noexcept {
-        locked.clear(std::memory_order_release);
+        auto heldFor = std::chrono::steady_clock::now() - m_acquiredAt;
+
+        m_holdTime.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(heldFor).count(),
+                             std::memory_order_relaxed);
+
+        if (m_state.exchange(unlocked, std::memory_order_release) == lockedWithWaiters) {
+            wakeWaiter();
+        }
+    }
+
+    Statistics statistics () const noexcept {
+        Statistics stats;
+
+        stats.acquisitions = m_acquisitions.load(std::memory_order_relaxed);
+        stats.contendedAcquisitions = m_contendedAcquisitions.load(std::memory_order_relaxed);
+        stats.spins = m_spins.load(std::memory_order_relaxed);
+        stats.parks = m_parks.load(std::memory_order_relaxed);
+        stats.holdTime = std::chrono::nanoseconds {m_holdTime.load(std::memory_order_relaxed)};
+
+        return stats;
+    }
+
+private:
+
+    static constexpr int unlocked {0};
+    static constexpr int locked {1};
+    static constexpr int lockedWithWaiters {2};
+
+    static constexpr int maxSpinRounds {16};
+    static constexpr int maxPausesPerRound {64};
+
+    void lockContended () noexcept {
+        m_contendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+
+        // spinning phase: only trying to grab the lock when it looks free, pausing longer after every failure
+        for (int round = 0, pauses = 1; round < maxSpinRounds; ++round, pauses = std::min(pauses * 2, maxPausesPerRound)) {
+            for (int i = 0; i < pauses; ++i) {
+                IQOPTIONTESTTASK_CPU_PAUSE();
+            }
+
+            m_spins.fetch_add(1, std::memory_order_relaxed);
+
+            int state {unlocked};
+
+            if (m_state.load(std::memory_order_relaxed) == unlocked &&
+                m_state.compare_exchange_weak(state, locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+
+        // parking phase: marking the lock as having waiters, so that the holder wakes one of us on unlock
+        while (m_state.exchange(lockedWithWaiters, std::memory_order_acquire) != unlocked) {
+            m_parks.fetch_add(1, std::memory_order_relaxed);
+
+            waitForWakeup();
+        }
     }
 
+#ifdef __linux__
+    void waitForWakeup () noexcept {
+        // returns at once if the lock has changed its state meanwhile, no wakeup gets lost
+        syscall(SYS_futex, reinterpret_cast<int*>(&m_state), FUTEX_WAIT_PRIVATE, lockedWithWaiters, nullptr, nullptr, 0);
+    }
+
+    void wakeWaiter () noexcept {
+        syscall(SYS_futex, reinterpret_cast<int*>(&m_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+#else
+    void waitForWakeup () noexcept {
+        std::this_thread::yield();
+    }
+
+    void wakeWaiter () noexcept {}
+#endif
+
 private:
 
-    std::atomic_flag locked = ATOMIC_FLAG_INIT;
+    static_assert(sizeof(std::atomic_int) == sizeof(int), "futex requires a plain int lock word");
+
+    std::atomic_int m_state {unlocked};
+    std::chrono::steady_clock::time_point m_acquiredAt; // only touched by the holder
+
+    std::atomic<unsigned long long> m_acquisitions {0};
+    std::atomic<unsigned long long> m_contendedAcquisitions {0};
+    std::atomic<unsigned long long> m_spins {0};
+    std::atomic<unsigned long long> m_parks {0};
+    std::atomic<long long> m_holdTime {0};
 };
 
 #endif //IQOPTIONTESTTASK_SPINLOCK_H